@@ -0,0 +1,406 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ext.h"
+#include "recover.h"
+
+/* Block numbers listed by an indirect */
+#define PER_IND     (BYTES_PER_BLOCK / sizeof(uint32_t))
+
+/* A file planted by bmp_undelete_mkimg, from the manifest */
+struct planted_s {
+    uint32_t header;
+    uint32_t size;
+    /* Every data block, in order */
+    uint32_t *blocks;
+    uint32_t count;
+    uint32_t cap;
+};
+
+struct planted_s *files = 0;
+size_t n_files = 0;
+/*
+ * Planted BMP headers, then 1x, 2x, 3x indirects, sorted once the manifest
+ * is read
+ */
+uint32_t *truth [4] = { 0, 0, 0, 0 };
+size_t n_truth [4] = { 0, 0, 0, 0 };
+size_t cap_truth [4] = { 0, 0, 0, 0 };
+
+void usage () {
+    printf("Usage: ./bmp_undelete_bench [-j threads] [-b backend] [-o json] "
+        "image manifest\n");
+    printf("  -j threads  number of scan worker threads (default 1)\n");
+    printf("  -b backend  block access for the scan: mmap, pread, uring "
+        "(default mmap)\n");
+    printf("  -o json     save the counters and phase timings to json\n");
+    printf("Scans and recovers the image made by ./bmp_undelete_mkimg, then "
+        "checks what\nwas found against its manifest. The image is "
+        "changed.\n");
+}
+
+/*
+ * Only failures are shown, the report comes at the end
+ */
+void status (struct recover_s *r, enum status_code_e sl, ...) {
+    va_list ap;
+
+    (void)r;
+    if (sl != ERROR) {
+        return;
+    }
+    va_start(ap, sl);
+    vfprintf(stderr, va_arg(ap, const char*), ap);
+    va_end(ap);
+}
+
+/*
+ * Orders block numbers for qsort(3) and bsearch(3)
+ */
+int cmp_block (const void *a, const void *b) {
+    uint32_t ba = *(const uint32_t*)a;
+    uint32_t bb = *(const uint32_t*)b;
+
+    return (ba > bb) - (ba < bb);
+}
+
+/*
+ * Orders planted files by their header block
+ */
+int cmp_file (const void *a, const void *b) {
+    return cmp_block(&((const struct planted_s*)a)->header,
+        &((const struct planted_s*)b)->header);
+}
+
+/*
+ * Appends a block number to a growing list
+ * Return 0 if success, -1 if out of memory
+ */
+int push (uint32_t **list, size_t *count, size_t *cap, uint32_t block) {
+    uint32_t *grown;
+
+    if (*count == *cap) {
+        *cap = (*cap > 0) ? *cap * 2 : 64;
+        grown = realloc(*list, *cap * sizeof(**list));
+        if (!grown) {
+            return -1;
+        }
+        *list = grown;
+    }
+    *(*list + (*count)++) = block;
+    return 0;
+}
+
+/*
+ * Reads the manifest: a bmp line starts each file, its ext lines list its
+ * data blocks in runs, ind lines list the indirects
+ * Return 0 if success, -1 if fail
+ */
+int load_manifest (const char *path) {
+    struct planted_s *file = 0;
+    char kind [8];
+    uint32_t a;
+    uint32_t b;
+    size_t count;
+    size_t cap;
+    size_t cap_files = 0;
+    FILE *f;
+    int ret = 0;
+
+    f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    while (!ret && fscanf(f, "%7s %u %u", kind, &a, &b) == 3) {
+        if (!strcmp(kind, "bmp")) {
+            if (n_files == cap_files) {
+                cap_files = (cap_files > 0) ? cap_files * 2 : 64;
+                file = realloc(files, cap_files * sizeof(*files));
+                if (!file) {
+                    ret = -1;
+                    break;
+                }
+                files = file;
+            }
+            file = files + n_files++;
+            memset(file, 0, sizeof(*file));
+            file->header = a;
+            file->size = b;
+            ret = push(truth, n_truth, cap_truth, a);
+        } else if (!strcmp(kind, "ext") && file) {
+            for (; !ret && b > 0; a++, b--) {
+                count = file->count;
+                cap = file->cap;
+                ret = push(&file->blocks, &count, &cap, a);
+                file->count = count;
+                file->cap = cap;
+            }
+        } else if (!strcmp(kind, "ind") && a >= 1 && a <= 3) {
+            ret = push(truth + a, n_truth + a, cap_truth + a, b);
+        } else {
+            ret = -1;
+        }
+    }
+    if (!feof(f)) {
+        ret = -1;
+    }
+    fclose(f);
+
+    qsort(files, n_files, sizeof(*files), cmp_file);
+    for (a = 0; a < 4; a++) {
+        qsort(*(truth + a), *(n_truth + a), sizeof(**truth), cmp_block);
+    }
+    return ret;
+}
+
+/*
+ * Finds the planted file with the given header block
+ * Return the file, 0 if none was planted there
+ */
+struct planted_s* find_file (uint32_t header) {
+    struct planted_s key;
+
+    key.header = header;
+    return bsearch(&key, files, n_files, sizeof(*files), cmp_file);
+}
+
+/*
+ * Counts the candidates that were planted, the rest are false positives
+ * Return the number of true candidates
+ */
+size_t count_true (const struct cand_s *found, uint32_t kind) {
+    uint32_t block;
+    size_t count = 0;
+    size_t cx;
+
+    for (cx = 0; cx < found->count; cx++) {
+        block = cand_get(found, cx);
+        if (bsearch(&block, *(truth + kind), *(n_truth + kind),
+            sizeof(**truth), cmp_block)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/*
+ * Tests if a recovered inode lists the very blocks that were planted
+ * Return 1 if it does, 0 if not
+ */
+int intact (const uint8_t *img, const struct inode_s *ino,
+    const struct planted_s *file) {
+    const uint32_t *iblocks = (const uint32_t*)ino->i_block;
+    const uint32_t *ind1;
+    const uint32_t *ind2;
+    uint32_t cx;
+    uint32_t pos;
+
+    if (ino->i_size_lo != file->size) {
+        return 0;
+    }
+    for (cx = 0; cx < file->count; cx++) {
+        if (cx < 12) {
+            pos = *(iblocks + cx);
+        } else if (cx < 12 + PER_IND) {
+            ind1 = (const uint32_t*)(img +
+                BLOCK_OFF((uint64_t)*(iblocks + SIN_IND)));
+            pos = *(ind1 + cx - 12);
+        } else {
+            ind2 = (const uint32_t*)(img +
+                BLOCK_OFF((uint64_t)*(iblocks + DBL_IND)));
+            ind1 = (const uint32_t*)(img + BLOCK_OFF((uint64_t)
+                *(ind2 + (cx - 12 - PER_IND) / PER_IND)));
+            pos = *(ind1 + (cx - 12 - PER_IND) % PER_IND);
+        }
+        if (pos != *(file->blocks + cx)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Goes through the inodes of the recovered image, counting the files that
+ * came back whole and the ones that weren't planted at all
+ * Return 0 if success, -1 if fail
+ */
+int check_files (const char *path, uint32_t *n_intact, uint32_t *n_false) {
+    const struct sb_s *sb;
+    const struct gd_s *gd;
+    const struct inode_s *ino;
+    const struct planted_s *file;
+    const uint8_t *img;
+    uint32_t ngroups;
+    uint32_t group;
+    uint32_t cx;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st)) {
+        return -1;
+    }
+    img = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (img == MAP_FAILED) {
+        return -1;
+    }
+
+    sb = (const struct sb_s*)(img + SB_OFF);
+    ngroups = (sb->s_blocks_count_lo + BLOCKS_PER_GROUP - 1) /
+        BLOCKS_PER_GROUP;
+    for (group = 0; group < ngroups; group++) {
+        gd = (const struct gd_s*)(img + GD_OFF(group));
+        for (cx = 0; cx < sb->s_inodes_per_group; cx++) {
+            ino = (const struct inode_s*)(img +
+                BLOCK_OFF((uint64_t)gd->bg_inode_table_lo) +
+                cx * sb->s_inode_size);
+            if (group * sb->s_inodes_per_group + cx + 1 < sb->s_first_ino ||
+                !BMP_BIT(img + BLOCK_OFF((uint64_t)gd->bg_inode_bitmap_lo),
+                cx) || (ino->i_mode & TYPE_MASK) != TYPE_REG) {
+                continue;
+            }
+            file = find_file(*(const uint32_t*)ino->i_block);
+            if (!file) {
+                (*n_false)++;
+            } else if (intact(img, ino, file)) {
+                (*n_intact)++;
+            }
+        }
+    }
+
+    munmap((void*)img, st.st_size);
+    return 0;
+}
+
+int main (int argc, char **argv) {
+    struct recover_s *r;
+    const struct fs_info_s *info;
+    const char *json = 0;
+    const char *names [] = { "BMP", "1x", "2x", "3x" };
+    const struct cand_s *found;
+    long threads = 1;
+    int backend = BLKIO_MMAP;
+    uint32_t n_rec;
+    uint32_t n_intact = 0;
+    uint32_t n_false = 0;
+    uint64_t bytes;
+    uint64_t msec;
+    size_t n_true;
+    struct timespec start;
+    struct timespec end;
+    uint32_t cx;
+    FILE *f;
+    int opt;
+    int ret;
+
+    /* Parse the options */
+    while ((opt = getopt(argc, argv, "j:b:o:")) != -1) {
+        switch (opt) {
+        case 'j':
+            threads = strtol(optarg, 0, 10);
+            if (threads < 1) {
+                usage();
+                exit(-1);
+            }
+            break;
+        case 'b':
+            backend = blkio_parse(optarg);
+            if (backend < 0) {
+                usage();
+                exit(-1);
+            }
+            break;
+        case 'o':
+            json = optarg;
+            break;
+        default:
+            usage();
+            exit(-1);
+        }
+    }
+    if (argc - optind != 2) {
+        usage();
+        exit(-1);
+    }
+    if (load_manifest(*(argv + optind + 1))) {
+        fprintf(stderr, "Unable to read the manifest: %s\n",
+            *(argv + optind + 1));
+        exit(-1);
+    }
+
+    /* Scan and recover, like the CLI does */
+    r = init(*(argv + optind), 0);
+    if (!r) {
+        exit(-1);
+    }
+    set_scan_threads(r, threads);
+    set_scan_backend(r, backend);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = scan(r);
+    ret = (ret < 0) ? ret : collect(r);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (ret < 0) {
+        cleanup(r);
+        exit(-1);
+    }
+
+    /* How fast */
+    info = fs_info(r);
+    bytes = *info->scan_bytes;
+    msec = (*info->scan_msec > 0) ? *info->scan_msec : 1;
+    printf("Scanned %u MiB with %s and %u threads in %u.%03u s: "
+        "%u MB/s\n", (uint32_t)(bytes >> 20), blkio_name(backend),
+        (uint32_t)threads, (uint32_t)(msec / 1000),
+        (uint32_t)(msec % 1000), (uint32_t)(bytes / 1000 / msec));
+    msec = (end.tv_sec - start.tv_sec) * 1000 +
+        (end.tv_nsec - start.tv_nsec) / 1000000;
+    printf("Scan and collect took %u.%03u s\n", (uint32_t)(msec / 1000),
+        (uint32_t)(msec % 1000));
+
+    /* What the scan found, against what was planted */
+    printf("%-10s %8s %8s %8s %8s\n", "candidate", "planted", "found",
+        "true", "false");
+    for (cx = 0; cx < 4; cx++) {
+        found = (cx == 0) ? info->bmp_starts : info->indirects + cx - 1;
+        n_true = count_true(found, cx);
+        printf("%-10s %8u %8u %8u %8u\n", *(names + cx),
+            (uint32_t)*(n_truth + cx), (uint32_t)found->count,
+            (uint32_t)n_true, (uint32_t)(found->count - n_true));
+    }
+
+    n_rec = *info->n_rec;
+    if (json) {
+        f = fopen(json, "w");
+        ret = (f) ? perf_json(info->perf, info->name, f, 0) : -1;
+        if (f) {
+            fprintf(f, "\n");
+            ret = (fclose(f) == 0) ? ret : -1;
+        }
+        if (ret) {
+            fprintf(stderr, "Unable to save the metrics: %s\n", json);
+        }
+    }
+    cleanup(r);
+
+    /* What came back, read from the image itself */
+    if (check_files(*(argv + optind), &n_intact, &n_false)) {
+        fprintf(stderr, "Unable to read back: %s\n", *(argv + optind));
+        exit(-1);
+    }
+    printf("Files: %u planted, %u recovered, %u intact, "
+        "%u false positives\n", (uint32_t)n_files, n_rec, n_intact,
+        n_false);
+
+    exit(0);
+}
@@ -0,0 +1,580 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include "blkio.h"
+#include "ext.h"
+#include "pace.h"
+
+#define WIN_BYTES   (BLKIO_WINDOW * BYTES_PER_BLOCK)
+
+/* A run of blocks read in as one request */
+struct window_s {
+    uint8_t *buf;
+    uint32_t first;
+    uint32_t count;
+    int ready;
+    /* When the read was submitted, for the pace */
+    uint64_t started;
+};
+
+/* The mapped io_uring queues */
+struct uring_s {
+    int fd;
+    uint8_t *sq_ptr;
+    size_t sq_len;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    uint8_t *cq_ptr;
+    size_t cq_len;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned queued;
+};
+
+struct blkio_s {
+    enum blkio_backend_e backend;
+    int fd;
+    uint8_t *map;
+    uint32_t first;
+    uint32_t last;
+    uint64_t bytes;
+    /* Read ahead windows in block order, oldest at head */
+    struct window_s win [BLKIO_DEPTH];
+    uint32_t depth;
+    uint32_t head;
+    uint32_t n_win;
+    uint32_t next;
+    uint8_t *scratch [BLKIO_SLOTS];
+    struct uring_s ring;
+    /* Shared pace the reads wait on, and where BLKIO_MMAP next waits */
+    struct pace_s *pace;
+    uint32_t paced;
+};
+
+const char *blkio_names [] = {
+    "mmap", "pread", "uring"
+};
+
+/*
+ * Private method
+ * pread(2) until the whole length is read
+ * Return 0 if success, -1 if fail
+ */
+int read_full (int fd, uint8_t *buf, size_t len, uint64_t off) {
+    ssize_t got;
+
+    while (len > 0) {
+        got = pread(fd, buf, len, (off_t)off);
+        if (got <= 0) {
+            return -1;
+        }
+        buf += got;
+        len -= got;
+        off += got;
+    }
+
+    return 0;
+}
+
+/*
+ * Private method
+ * Tears down the io_uring queues
+ */
+void uring_close (struct uring_s *r) {
+    if (r->sqes) {
+        munmap(r->sqes, r->sqes_len);
+    }
+    if (r->cq_ptr) {
+        munmap(r->cq_ptr, r->cq_len);
+    }
+    if (r->sq_ptr) {
+        munmap(r->sq_ptr, r->sq_len);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    r->fd = -1;
+}
+
+/*
+ * Private method
+ * Sets up an io_uring with the given number of entries
+ * Return 0 if success, -1 if fail
+ */
+int uring_setup (struct uring_s *r, unsigned entries) {
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) {
+        return -1;
+    }
+
+    /* Map the submission queue */
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->sq_ptr = mmap(0, r->sq_len, PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        r->sq_ptr = 0;
+        uring_close(r);
+        return -1;
+    }
+    r->sq_tail = (unsigned*)(r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned*)(r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(r->sq_ptr + p.sq_off.array);
+
+    /* Map the submission entries */
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(0, r->sqes_len, PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = 0;
+        uring_close(r);
+        return -1;
+    }
+
+    /* Map the completion queue */
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->cq_ptr = mmap(0, r->cq_len, PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    if (r->cq_ptr == MAP_FAILED) {
+        r->cq_ptr = 0;
+        uring_close(r);
+        return -1;
+    }
+    r->cq_head = (unsigned*)(r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned*)(r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned*)(r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(r->cq_ptr + p.cq_off.cqes);
+    r->queued = 0;
+
+    return 0;
+}
+
+/*
+ * Private method
+ * Queues a read, submitted on the next uring_enter()
+ */
+void uring_queue_read (struct uring_s *r, uint64_t tag, int fd,
+    uint8_t *buf, uint32_t len, uint64_t off) {
+    unsigned tail = *r->sq_tail;
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = r->sqes + idx;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(size_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = tag;
+    *(r->sq_array + idx) = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->queued++;
+}
+
+/*
+ * Private method
+ * Submits the queued reads, optionally waiting for a completion
+ * Return 0 if success, -1 if fail
+ */
+int uring_enter (struct uring_s *r, unsigned wait) {
+    int ret;
+
+    ret = syscall(__NR_io_uring_enter, r->fd, r->queued, wait,
+        wait ? IORING_ENTER_GETEVENTS : 0, (void*)0, 0);
+    if (ret < 0) {
+        return -1;
+    }
+    r->queued -= ((unsigned)ret < r->queued) ? (unsigned)ret : r->queued;
+
+    return 0;
+}
+
+/*
+ * Private method
+ * Queues the next window of the range
+ */
+void issue_window (struct blkio_s *s) {
+    struct window_s *w = s->win + ((s->head + s->n_win) % s->depth);
+
+    w->first = s->next;
+    w->count = (s->last - s->next < BLKIO_WINDOW)
+        ? s->last - s->next
+        : BLKIO_WINDOW;
+    w->ready = 0;
+    s->next += w->count;
+    s->n_win++;
+    if (s->pace) {
+        w->started = pace_start(s->pace, w->count * BYTES_PER_BLOCK);
+    }
+
+    if (s->backend == BLKIO_URING) {
+        uring_queue_read(&s->ring, w - s->win, s->fd, w->buf,
+            w->count * BYTES_PER_BLOCK,
+            (uint64_t)BLOCK_OFF((uint64_t)w->first));
+        /* A paced read goes right away, the next may wait on the pace */
+        if (s->pace) {
+            uring_enter(&s->ring, 0);
+        }
+    } else {
+        w->ready = (read_full(s->fd, w->buf, w->count * BYTES_PER_BLOCK,
+            BLOCK_OFF((uint64_t)w->first)) == 0) ? 1 : -1;
+        s->bytes += w->count * BYTES_PER_BLOCK;
+        if (s->pace) {
+            pace_done(s->pace, w->started);
+        }
+    }
+}
+
+/*
+ * Private method
+ * Collects the finished reads, redoing short or failed ones with pread(2)
+ */
+void reap_windows (struct blkio_s *s) {
+    struct uring_s *r = &s->ring;
+    struct io_uring_cqe *cqe;
+    struct window_s *w;
+    unsigned head = *r->cq_head;
+    uint32_t len;
+
+    while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = r->cqes + (head & *r->cq_mask);
+        w = s->win + cqe->user_data;
+        len = w->count * BYTES_PER_BLOCK;
+
+        if (cqe->res >= 0 && (uint32_t)cqe->res == len) {
+            w->ready = 1;
+        } else {
+            w->ready = (read_full(s->fd, w->buf, len,
+                BLOCK_OFF((uint64_t)w->first)) == 0) ? 1 : -1;
+        }
+        s->bytes += len;
+        head++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Private method
+ * Waits for a window's read to finish
+ * Only reads waited on tell the pace their latency, the others finished
+ * some time before they were reaped
+ * Return 0 if success, -1 if fail
+ */
+int wait_window (struct blkio_s *s, struct window_s *w) {
+    int waited = !w->ready;
+
+    while (!w->ready) {
+        if (uring_enter(&s->ring, 1)) {
+            return -1;
+        }
+        reap_windows(s);
+    }
+    if (waited && s->pace) {
+        pace_done(s->pace, w->started);
+    }
+
+    return (w->ready > 0) ? 0 : -1;
+}
+
+/*
+ * Private method
+ * Paces a BLKIO_MMAP stream once per window, the page faults read it in
+ * as the kernel reads ahead
+ * The fault on the window's first block stands in for the read's latency,
+ * if the kernel hasn't already read it ahead
+ */
+void mmap_pace (struct blkio_s *s, uint32_t block) {
+    volatile const uint8_t *page = s->map + BLOCK_OFF((uint64_t)block);
+    unsigned char resident = 1;
+    uint64_t started;
+
+    s->paced = (block / BLKIO_WINDOW + 1) * BLKIO_WINDOW;
+    s->paced = (s->paced < s->last) ? s->paced : s->last;
+    started = pace_start(s->pace,
+        (uint64_t)(s->paced - block) * BYTES_PER_BLOCK);
+    mincore((void*)page, BYTES_PER_BLOCK, &resident);
+    (void)*page;
+    if (!(resident & 1)) {
+        pace_done(s->pace, started);
+    }
+}
+
+/*
+ * Public method
+ * Opens a stream over the blocks [first, last)
+ */
+struct blkio_s* blkio_open (enum blkio_backend_e backend, int fd,
+    uint8_t *map, uint32_t first, uint32_t last) {
+    struct blkio_s *s = calloc(1, sizeof(*s));
+    uint32_t cx;
+
+    if (!s) {
+        return 0;
+    }
+    s->backend = backend;
+    s->fd = fd;
+    s->map = map;
+    s->first = first;
+    s->last = last;
+    s->next = first;
+    s->ring.fd = -1;
+
+    if (backend == BLKIO_MMAP) {
+        return s;
+    }
+
+    /* Fall back to pread if io_uring is not available */
+    if (backend == BLKIO_URING && uring_setup(&s->ring, BLKIO_DEPTH)) {
+        s->backend = BLKIO_PREAD;
+    }
+    s->depth = (s->backend == BLKIO_URING) ? BLKIO_DEPTH : 1;
+
+    /* Aligned buffers so the reads can go straight to the device */
+    for (cx = 0; cx < s->depth; cx++) {
+        if (posix_memalign((void**)&(s->win + cx)->buf,
+            BYTES_PER_BLOCK, WIN_BYTES)) {
+            blkio_close(s);
+            return 0;
+        }
+    }
+    for (cx = 0; cx < BLKIO_SLOTS; cx++) {
+        if (posix_memalign((void**)(s->scratch + cx),
+            BYTES_PER_BLOCK, BYTES_PER_BLOCK)) {
+            blkio_close(s);
+            return 0;
+        }
+    }
+
+    return s;
+}
+
+/*
+ * Public method
+ * Moves the stream up to the given block
+ */
+const uint8_t* blkio_stream (struct blkio_s *s, uint32_t block) {
+    struct window_s *w;
+
+    if (block < s->first || block >= s->last) {
+        return 0;
+    }
+
+    if (s->backend == BLKIO_MMAP) {
+        s->next = block;
+        s->bytes += BYTES_PER_BLOCK;
+        if (s->pace && block >= s->paced) {
+            mmap_pace(s, block);
+        }
+        return s->map + BLOCK_OFF((uint64_t)block);
+    }
+
+    for (;;) {
+        /* Retire windows that are behind the block */
+        while (s->n_win > 0) {
+            w = s->win + s->head;
+            if (w->first + w->count > block) {
+                break;
+            }
+            if (s->backend == BLKIO_URING && wait_window(s, w) &&
+                !w->ready) {
+                return 0;
+            }
+            s->head = (s->head + 1) % s->depth;
+            s->n_win--;
+        }
+
+        /* Jumped past everything read in, restart from the block */
+        if (s->n_win == 0) {
+            s->next = block;
+        }
+
+        /* Keep the queue full */
+        while (s->n_win < s->depth && s->next < s->last) {
+            issue_window(s);
+        }
+        if (s->backend == BLKIO_URING && s->ring.queued &&
+            uring_enter(&s->ring, 0)) {
+            return 0;
+        }
+
+        w = s->win + s->head;
+        if (w->first <= block) {
+            if (s->backend == BLKIO_URING && wait_window(s, w)) {
+                return 0;
+            }
+            if (w->ready < 0) {
+                return 0;
+            }
+            return w->buf + BLOCK_OFF((uint64_t)(block - w->first));
+        }
+    }
+}
+
+/*
+ * Public method
+ * Gets any block, from the stream or the scratch slot
+ */
+const uint8_t* blkio_block (struct blkio_s *s, uint32_t block,
+    uint32_t slot) {
+    struct window_s *w;
+    uint32_t cx;
+    uint64_t started = 0;
+
+    /* Only count blocks other than the one streamed in */
+    if (s->backend == BLKIO_MMAP) {
+        s->bytes += (block != s->next) ? BYTES_PER_BLOCK : 0;
+        return s->map + BLOCK_OFF((uint64_t)block);
+    }
+
+    /* Already read in by the stream */
+    for (cx = 0; cx < s->n_win; cx++) {
+        w = s->win + ((s->head + cx) % s->depth);
+        if (w->ready > 0 && block >= w->first &&
+            block < w->first + w->count) {
+            return w->buf + BLOCK_OFF((uint64_t)(block - w->first));
+        }
+    }
+
+    if (s->pace) {
+        started = pace_start(s->pace, BYTES_PER_BLOCK);
+    }
+    if (read_full(s->fd, *(s->scratch + slot), BYTES_PER_BLOCK,
+        BLOCK_OFF((uint64_t)block))) {
+        return 0;
+    }
+    s->bytes += BYTES_PER_BLOCK;
+    if (s->pace) {
+        pace_done(s->pace, started);
+    }
+
+    return *(s->scratch + slot);
+}
+
+/*
+ * Public method
+ * Holds the stream's reads to a pace
+ */
+void blkio_pace (struct blkio_s *s, struct pace_s *pace) {
+    s->pace = pace;
+}
+
+/*
+ * Public method
+ * Drops the blocks from the page cache
+ * The mapping has to let go of its pages first, the kernel keeps mapped
+ * pages cached
+ */
+void blkio_drop (struct blkio_s *s, uint32_t first, uint32_t last) {
+    uint64_t off = BLOCK_OFF((uint64_t)first);
+    uint64_t len = BLOCK_OFF((uint64_t)(last - first));
+
+    if (last <= first) {
+        return;
+    }
+    if (s->backend == BLKIO_MMAP) {
+        madvise(s->map + off, len, MADV_DONTNEED);
+    }
+    posix_fadvise(s->fd, (off_t)off, (off_t)len, POSIX_FADV_DONTNEED);
+}
+
+/*
+ * Public method
+ * Reads a block back into the page cache
+ */
+void blkio_keep (struct blkio_s *s, uint32_t block) {
+    posix_fadvise(s->fd, (off_t)BLOCK_OFF((uint64_t)block), BYTES_PER_BLOCK,
+        POSIX_FADV_WILLNEED);
+}
+
+/*
+ * Public method
+ * Bytes read from the device so far
+ */
+uint64_t blkio_bytes (const struct blkio_s *s) {
+    return s->bytes;
+}
+
+/*
+ * Public method
+ * The backend actually in use
+ */
+enum blkio_backend_e blkio_backend (const struct blkio_s *s) {
+    return s->backend;
+}
+
+/*
+ * Public method
+ * Waits out any reads in flight and frees the stream
+ */
+void blkio_close (struct blkio_s *s) {
+    uint32_t cx;
+
+    if (s->backend == BLKIO_URING) {
+        for (cx = 0; cx < s->n_win; cx++) {
+            wait_window(s, s->win + ((s->head + cx) % s->depth));
+        }
+        uring_close(&s->ring);
+    }
+    for (cx = 0; cx < BLKIO_SLOTS; cx++) {
+        free(*(s->scratch + cx));
+    }
+    for (cx = 0; cx < BLKIO_DEPTH; cx++) {
+        free((s->win + cx)->buf);
+    }
+    free(s);
+}
+
+/*
+ * Public method
+ * Opens the device for direct reads
+ * The window and scratch buffers are already block aligned, as O_DIRECT
+ * needs them to be
+ */
+int blkio_direct (const char *path) {
+    return open(path, O_RDONLY | O_DIRECT);
+}
+
+/*
+ * Public method
+ * Name of the backend
+ */
+const char* blkio_name (enum blkio_backend_e backend) {
+    if ((unsigned)backend >= sizeof(blkio_names) / sizeof(*blkio_names)) {
+        return 0;
+    }
+
+    return *(blkio_names + backend);
+}
+
+/*
+ * Public method
+ * Backend from its name
+ */
+int blkio_parse (const char *name) {
+    int cx;
+
+    for (cx = 0; cx < (int)(sizeof(blkio_names) / sizeof(*blkio_names));
+        cx++) {
+        if (!strcmp(name, *(blkio_names + cx))) {
+            return cx;
+        }
+    }
+
+    return -1;
+}
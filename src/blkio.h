@@ -0,0 +1,86 @@
+#ifndef BLKIO_H_20261016_153140
+#define BLKIO_H_20261016_153140
+
+#include <stdint.h>
+
+#include "pace.h"
+
+/*
+ * Block access for the drive scan
+ *
+ * BLKIO_MMAP   read through the device mapping, page fault per page
+ * BLKIO_PREAD  batched pread(2) of BLKIO_WINDOW blocks at a time
+ * BLKIO_URING  io_uring with BLKIO_DEPTH windows in flight ahead of the scan
+ */
+enum blkio_backend_e {
+    BLKIO_MMAP, BLKIO_PREAD, BLKIO_URING
+};
+
+#define BLKIO_WINDOW    (256)
+#define BLKIO_DEPTH     (8)
+#define BLKIO_SLOTS     (3)
+
+/* A stream over a range of blocks, owned by a single thread */
+struct blkio_s;
+
+/*
+ * Opens a stream over the blocks [first, last)
+ * Falls back to BLKIO_PREAD if the backend can't be set up
+ * Returns 0 on failure
+ */
+struct blkio_s* blkio_open (enum blkio_backend_e backend, int fd,
+    uint8_t *map, uint32_t first, uint32_t last);
+
+/*
+ * Moves the stream up to the given block, reading ahead of it
+ * Blocks must be requested in increasing order
+ * Returns the block's data, 0 on read failure
+ */
+const uint8_t* blkio_stream (struct blkio_s *s, uint32_t block);
+
+/*
+ * Gets any block, from the stream if it is already read in,
+ * otherwise read into the scratch slot (0 to BLKIO_SLOTS - 1)
+ * The data is valid until the slot is reused
+ * Returns the block's data, 0 on read failure
+ */
+const uint8_t* blkio_block (struct blkio_s *s, uint32_t block,
+    uint32_t slot);
+
+/*
+ * Holds the stream's reads to a pace shared with other streams, null for
+ * none
+ */
+void blkio_pace (struct blkio_s *s, struct pace_s *pace);
+
+/*
+ * Drops the blocks [first, last) from the page cache, and from the device
+ * mapping for BLKIO_MMAP, they are read in again if needed
+ */
+void blkio_drop (struct blkio_s *s, uint32_t first, uint32_t last);
+
+/* Reads a block back into the page cache on its own, in the background */
+void blkio_keep (struct blkio_s *s, uint32_t block);
+
+/* Bytes read from the device so far */
+uint64_t blkio_bytes (const struct blkio_s *s);
+
+/* The backend actually in use */
+enum blkio_backend_e blkio_backend (const struct blkio_s *s);
+
+void blkio_close (struct blkio_s *s);
+
+/*
+ * Opens the device for reads that go around the page cache (O_DIRECT),
+ * for the BLKIO_PREAD and BLKIO_URING backends
+ * Returns the file descriptor, -1 if the device doesn't support it
+ */
+int blkio_direct (const char *path);
+
+/* Name of the backend, 0 if invalid */
+const char* blkio_name (enum blkio_backend_e backend);
+
+/* Backend from its name, -1 if unknown */
+int blkio_parse (const char *name);
+
+#endif /* BLKIO_H_20261016_153140 */
@@ -0,0 +1,374 @@
+#include <stdlib.h>
+
+#include "cand.h"
+
+/*
+ * Private method
+ * Makes room for at least n more chunk pointers
+ * Return 1 if success, 0 if fail
+ */
+int grow_table (struct cand_s *c, size_t n) {
+    uint32_t **chunks;
+    size_t *starts;
+    size_t cap;
+
+    if (c->n_chunks + n <= c->cap_chunks) {
+        return 1;
+    }
+    cap = (c->cap_chunks > 0) ? c->cap_chunks : 8;
+    while (cap < c->n_chunks + n) {
+        cap *= 2;
+    }
+    chunks = realloc(c->chunks, cap * sizeof(*chunks));
+    if (!chunks) {
+        return 0;
+    }
+    c->chunks = chunks;
+    starts = realloc(c->starts, cap * sizeof(*starts));
+    if (!starts) {
+        return 0;
+    }
+    c->starts = starts;
+    c->cap_chunks = cap;
+    return 1;
+}
+
+/*
+ * Private method
+ * Room left in the last chunk
+ */
+size_t chunk_room (const struct cand_s *c) {
+    if (c->n_chunks == 0) {
+        return 0;
+    }
+    return CAND_CHUNK - (c->count - *(c->starts + c->n_chunks - 1));
+}
+
+/*
+ * Private method
+ * Adds a chunk to the end of the store, there has to be room in the table
+ */
+void add_chunk (struct cand_s *c, uint32_t *chunk) {
+    *(c->chunks + c->n_chunks) = chunk;
+    *(c->starts + c->n_chunks) = c->count;
+    c->n_chunks++;
+}
+
+/*
+ * Public method
+ * Adds a block to the end of the store
+ */
+int cand_push (struct cand_s *c, uint32_t block) {
+    uint32_t *chunk;
+    size_t last;
+
+    /* Start a new chunk when the last one is full */
+    if (chunk_room(c) == 0) {
+        if (!grow_table(c, 1)) {
+            return 0;
+        }
+        chunk = malloc(CAND_CHUNK * sizeof(*chunk));
+        if (!chunk) {
+            return 0;
+        }
+        add_chunk(c, chunk);
+    }
+    last = c->n_chunks - 1;
+    *(*(c->chunks + last) + (c->count - *(c->starts + last))) = block;
+
+    /* Still dense if no short chunk came before */
+    if (c->dense == c->count && *(c->starts + last) == last * CAND_CHUNK) {
+        c->dense++;
+    }
+    c->count++;
+    return 1;
+}
+
+/*
+ * Public method
+ * Gets the block at the given index
+ * Past the dense blocks, the chunk is looked up by its first index
+ */
+uint32_t cand_get (const struct cand_s *c, size_t index) {
+    size_t lo;
+    size_t hi;
+    size_t mid;
+
+    if (index < c->dense) {
+        return *(*(c->chunks + index / CAND_CHUNK) + index % CAND_CHUNK);
+    }
+
+    lo = c->dense / CAND_CHUNK;
+    hi = c->n_chunks - 1;
+    while (lo < hi) {
+        mid = lo + (hi - lo + 1) / 2;
+        if (*(c->starts + mid) <= index) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return *(*(c->chunks + lo) + (index - *(c->starts + lo)));
+}
+
+/*
+ * Public method
+ * Moves every block in src onto the end of dest
+ * Handing over chunks leaves dest's last chunk short, which is only worth
+ * it when src has a full chunk, the per group parts of a scan mostly hold
+ * a few blocks and are copied
+ */
+int cand_splice (struct cand_s *dest, struct cand_s *src) {
+    uint32_t *spare = 0;
+    size_t cx;
+
+    if (src->count == 0) {
+        cand_free(src);
+        return 1;
+    }
+
+    if (src->count >= CAND_CHUNK) {
+        if (!grow_table(dest, src->n_chunks)) {
+            return 0;
+        }
+        /* What was dense in src stays so if dest ends on a full chunk */
+        if (dest->dense == dest->count &&
+            dest->count == dest->n_chunks * CAND_CHUNK) {
+            dest->dense += src->dense;
+        }
+        for (cx = 0; cx < src->n_chunks; cx++) {
+            *(dest->chunks + dest->n_chunks) = *(src->chunks + cx);
+            *(dest->starts + dest->n_chunks) = dest->count +
+                *(src->starts + cx);
+            dest->n_chunks++;
+        }
+        dest->count += src->count;
+        free(src->chunks);
+        free(src->starts);
+        src->chunks = 0;
+        src->starts = 0;
+        src->n_chunks = 0;
+        src->cap_chunks = 0;
+        src->count = 0;
+        src->dense = 0;
+        return 1;
+    }
+
+    /*
+     * Less than a chunk needs at most one more, taken before copying so
+     * that nothing can fail partway
+     */
+    if (chunk_room(dest) < src->count) {
+        if (!grow_table(dest, 1)) {
+            return 0;
+        }
+        spare = malloc(CAND_CHUNK * sizeof(*spare));
+        if (!spare) {
+            return 0;
+        }
+    }
+    for (cx = 0; cx < src->count; cx++) {
+        if (chunk_room(dest) == 0) {
+            add_chunk(dest, spare);
+        }
+        cand_push(dest, cand_get(src, cx));
+    }
+    cand_free(src);
+    return 1;
+}
+
+/*
+ * Public method
+ * Writes the blocks to the file, a chunk at a time
+ */
+int cand_write (const struct cand_s *c, FILE *f) {
+    size_t cx;
+    size_t n;
+
+    for (cx = 0; cx < c->n_chunks; cx++) {
+        n = (cx + 1 < c->n_chunks) ? *(c->starts + cx + 1) : c->count;
+        n -= *(c->starts + cx);
+        if (fwrite(*(c->chunks + cx), sizeof(**c->chunks), n, f) != n) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Public method
+ * Reads blocks from the file onto the end of the store
+ */
+int cand_read (struct cand_s *c, FILE *f, size_t n) {
+    uint32_t buf [1024];
+    size_t len;
+    size_t cx;
+
+    while (n > 0) {
+        len = (n < 1024) ? n : 1024;
+        if (fread(buf, sizeof(*buf), len, f) != len) {
+            return 0;
+        }
+        for (cx = 0; cx < len; cx++) {
+            if (!cand_push(c, *(buf + cx))) {
+                return 0;
+            }
+        }
+        n -= len;
+    }
+    return 1;
+}
+
+/*
+ * Public method
+ * Releases the memory held by the store
+ */
+void cand_free (struct cand_s *c) {
+    size_t cx;
+
+    for (cx = 0; cx < c->n_chunks; cx++) {
+        free(*(c->chunks + cx));
+    }
+    free(c->chunks);
+    free(c->starts);
+    c->chunks = 0;
+    c->starts = 0;
+    c->n_chunks = 0;
+    c->cap_chunks = 0;
+    c->count = 0;
+    c->dense = 0;
+}
+
+/*
+ * Private method
+ * Bucket of a key, Fibonacci hashing
+ */
+uint32_t map_bucket (const struct cand_map_s *m, uint32_t key) {
+    return (uint32_t)((key * 2654435761UL) & 0xFFFFFFFFUL) >> (32 - m->bits);
+}
+
+/*
+ * Private method
+ * Appends a position to the end of its bucket's chain
+ */
+void map_link (struct cand_map_s *m, uint32_t pos) {
+    uint32_t bucket = map_bucket(m, *(m->keys + pos));
+
+    *(m->next + pos) = 0;
+    if (*(m->tails + bucket)) {
+        *(m->next + *(m->tails + bucket) - 1) = pos + 1;
+    } else {
+        *(m->heads + bucket) = pos + 1;
+    }
+    *(m->tails + bucket) = pos + 1;
+}
+
+/*
+ * Private method
+ * Doubles the buckets and relinks every position in order
+ * Return 1 if success, 0 if fail
+ */
+int map_rehash (struct cand_map_s *m) {
+    uint32_t bits = (m->bits > 0) ? m->bits + 1 : 10;
+    uint32_t *heads = calloc((size_t)1 << bits, sizeof(*heads));
+    uint32_t *tails = calloc((size_t)1 << bits, sizeof(*tails));
+    size_t cx;
+
+    if (!heads || !tails) {
+        free(heads);
+        free(tails);
+        return 0;
+    }
+    free(m->heads);
+    free(m->tails);
+    m->heads = heads;
+    m->tails = tails;
+    m->bits = bits;
+    for (cx = 0; cx < m->count; cx++) {
+        map_link(m, cx);
+    }
+    return 1;
+}
+
+/*
+ * Public method
+ * Adds the key of the next position, growing to keep chains short
+ */
+int cand_map_add (struct cand_map_s *m, uint32_t key) {
+    uint32_t *keys;
+    uint32_t *next;
+    size_t cap;
+
+    if (m->count == m->cap) {
+        cap = (m->cap > 0) ? m->cap * 2 : CAND_CHUNK;
+        keys = realloc(m->keys, cap * sizeof(*keys));
+        if (!keys) {
+            return 0;
+        }
+        m->keys = keys;
+        next = realloc(m->next, cap * sizeof(*next));
+        if (!next) {
+            return 0;
+        }
+        m->next = next;
+        m->cap = cap;
+    }
+    *(m->keys + m->count) = key;
+    m->count++;
+
+    /* Keep at most one position per bucket on average */
+    if (m->bits == 0 || m->count > ((size_t)1 << m->bits)) {
+        return map_rehash(m);
+    }
+    map_link(m, m->count - 1);
+    return 1;
+}
+
+/*
+ * Public method
+ * Finds the first position with the key
+ */
+uint32_t cand_map_first (const struct cand_map_s *m, uint32_t key) {
+    uint32_t pos;
+
+    if (m->count == 0) {
+        return 0;
+    }
+    pos = *(m->heads + map_bucket(m, key));
+    while (pos && *(m->keys + pos - 1) != key) {
+        pos = *(m->next + pos - 1);
+    }
+    return pos;
+}
+
+/*
+ * Public method
+ * Finds the next position with the same key
+ */
+uint32_t cand_map_next (const struct cand_map_s *m, uint32_t pos) {
+    uint32_t key = *(m->keys + pos - 1);
+
+    pos = *(m->next + pos - 1);
+    while (pos && *(m->keys + pos - 1) != key) {
+        pos = *(m->next + pos - 1);
+    }
+    return pos;
+}
+
+/*
+ * Public method
+ * Releases the memory held by the index
+ */
+void cand_map_free (struct cand_map_s *m) {
+    free(m->heads);
+    free(m->tails);
+    free(m->keys);
+    free(m->next);
+    m->heads = 0;
+    m->tails = 0;
+    m->bits = 0;
+    m->keys = 0;
+    m->next = 0;
+    m->count = 0;
+    m->cap = 0;
+}
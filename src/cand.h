@@ -0,0 +1,94 @@
+#ifndef CAND_H_20261016_190412
+#define CAND_H_20261016_190412
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define CAND_CHUNK  (4096)
+
+/*
+ * Append only store of candidate block numbers
+ * Blocks live in fixed size chunks which are never moved once allocated,
+ * only the table of chunk pointers grows, and it doubles each time
+ * Chunks spliced in whole can leave the one before them short, so each
+ * chunk keeps the index of its first block, blocks before dense are all
+ * in full chunks and are found without looking it up
+ */
+struct cand_s {
+    uint32_t **chunks;
+    size_t *starts;
+    size_t n_chunks;
+    size_t cap_chunks;
+    size_t count;
+    size_t dense;
+};
+
+#define CAND_EMPTY  { (uint32_t**)0, (size_t*)0, 0, 0, 0, 0 }
+
+/*
+ * Adds a block to the end of the store
+ * Returns 1 if success, 0 if out of memory
+ */
+int cand_push (struct cand_s *c, uint32_t block);
+
+/* Gets the block at the given index, which must be below c->count */
+uint32_t cand_get (const struct cand_s *c, size_t index);
+
+/*
+ * Moves every block in src onto the end of dest, leaving src empty
+ * Whole chunks are handed over without copying when src has a full one,
+ * less than a chunk is copied into dest's last chunk
+ * Returns 1 if success, 0 if out of memory, both are left as they were
+ */
+int cand_splice (struct cand_s *dest, struct cand_s *src);
+
+/*
+ * Writes the blocks to the file as raw native endian uint32_t
+ * Returns 1 if success, 0 if fail
+ */
+int cand_write (const struct cand_s *c, FILE *f);
+
+/*
+ * Reads n blocks written by cand_write() onto the end of the store
+ * Returns 1 if success, 0 if fail
+ */
+int cand_read (struct cand_s *c, FILE *f, size_t n);
+
+/* Releases the memory held by the store, leaving it empty */
+void cand_free (struct cand_s *c);
+
+/*
+ * Hash index from a key to the positions in a store with that key
+ * Positions with the same key come back in the order they were added
+ * Positions are stored plus one so that 0 can mean none
+ */
+struct cand_map_s {
+    uint32_t *heads;
+    uint32_t *tails;
+    uint32_t bits;
+    uint32_t *keys;
+    uint32_t *next;
+    size_t count;
+    size_t cap;
+};
+
+#define CAND_MAP_EMPTY  { (uint32_t*)0, (uint32_t*)0, 0, \
+    (uint32_t*)0, (uint32_t*)0, 0, 0 }
+
+/*
+ * Adds the key of the next position in the store, count positions so far
+ * Returns 1 if success, 0 if out of memory
+ */
+int cand_map_add (struct cand_map_s *m, uint32_t key);
+
+/* Returns the first position with the key plus one, 0 if none */
+uint32_t cand_map_first (const struct cand_map_s *m, uint32_t key);
+
+/* Returns the next position with the same key plus one, 0 if none */
+uint32_t cand_map_next (const struct cand_map_s *m, uint32_t pos);
+
+/* Releases the memory held by the index, leaving it empty */
+void cand_map_free (struct cand_map_s *m);
+
+#endif /* CAND_H_20261016_190412 */
@@ -1,6 +1,11 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "recover.h"
@@ -11,19 +16,154 @@
 #define GREEN       "" CSI "92m"
 #define RESET       "" CSI "0m"
 
+/* How the recovery of a batch target went */
+enum target_result_e {
+    TGT_PENDING, TGT_RECOVERED, TGT_EMPTY, TGT_FAILED
+};
+
+/* A target of the batch, and what its recovery found */
+struct target_s {
+    char *path;
+    enum target_result_e result;
+    uint32_t counts [4];
+    uint32_t n_rec;
+    uint64_t bytes;
+    uint64_t msec;
+    struct perf_s perf;
+};
+
+/* Set when there is more than one target */
+int batch = 0;
+struct target_s *targets = 0;
+size_t n_targets = 0;
+size_t cap_targets = 0;
+/* Next target for a batch worker to take */
+size_t next_target = 0;
+pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+uint32_t batch_threads = 1;
+enum blkio_backend_e batch_backend = BLKIO_MMAP;
+/* Set to only take back what the journal and inode tables still have */
+int itable_only = 0;
+/* Set to build files as soon as the scan finds their chains */
+int stream = 0;
+/* Set to keep the scan out of the page cache */
+int cache_neutral = 0;
+/* Caps on the scan's reads in MiB/s and reads per second, zero for none */
+uint32_t throttle_mib = 0;
+uint32_t throttle_iops = 0;
+/* Per mille of the drive sampled to forecast the scan, zero to scan it */
+uint32_t forecast = 0;
+/* Stop after this many files, or after the file at this block */
+uint32_t stop_files = 0;
+uint32_t stop_block = 0;
+/* Metrics saved as JSON at the end, and kept current for Prometheus */
+const char *metrics_json = 0;
+const char *metrics_prom = 0;
+
 void usage () {
-    printf("Usage: ./recover_cli [device]\n");
+    printf("Usage: ./recover_cli [-i] [-s] [-m files] [-t block] "
+        "[-j threads] [-b backend]\n"
+        "           [-d] [-q rate] [-e permille] [-c file [-g groups] [-r]]\n"
+        "           [-p patch | -a patch] [-o json] [-w prom] [device]\n");
+    printf("       ./recover_cli [-i] [-s] [-m files] [-t block] "
+        "[-j threads] [-b backend]\n"
+        "           [-d] [-q rate] [-n readers] [-l list] [-o json] "
+        "[device...]\n");
+    printf("  -i          only take back deleted files from the journal "
+        "and the inode\n              tables, skip the drive scan\n");
+    printf("  -s          recover files during the scan, as soon as their "
+        "blocks are found\n");
+    printf("  -m files    stop once this many files are recovered\n");
+    printf("  -t block    stop once the file whose header is at this block "
+        "is recovered\n");
+    printf("  -j threads  number of scan worker threads (default 1)\n");
+    printf("  -b backend  block access for the scan: mmap, pread, uring "
+        "(default mmap)\n");
+    printf("  -d          keep the scan out of the page cache, for busy "
+        "machines\n");
+    printf("  -q rate     throttle the scan to MiB/s[,IOPS] at idle "
+        "priority, either can\n              be left out, e.g. 50 or "
+        "50,200 or ,200\n");
+    printf("  -e permille only forecast the scan from a sample of this many "
+        "blocks per\n              thousand, the candidates it finds and "
+        "how long it takes\n");
+    printf("  -c file     checkpoint the scan to file\n");
+    printf("  -g groups   groups scanned between checkpoints or with -s "
+        "(default %u)\n", CKPT_GROUPS);
+    printf("  -r          resume the scan from the checkpoint file\n");
+    printf("  -p patch    open the device read-only, save the changes to "
+        "patch\n");
+    printf("  -a patch    write the changes saved in patch to the device\n");
+    printf("  -l list     also recover every device listed in the file, "
+        "one per line\n");
+    printf("  -n readers  most scan threads running at once across all "
+        "devices\n");
+    printf("              (default: the number of CPUs)\n");
+    printf("  -o json     save the counters and phase timings of each device "
+        "to json\n");
+    printf("  -w prom     keep the counters and phase timings current in a "
+        "Prometheus\n              text file while recovering\n");
+    printf("With several devices, they are recovered in parallel and only "
+        "the main steps\nare shown. -e, -c, -p, -a and -w take a single "
+        "device.\n");
     printf("NOTE: Requires root permissions.\n");
 }
 
+/*
+ * Tests if a status is left out of a batch, the per group, per block, and
+ * per file steps of every target would bury the main ones
+ * Return 1 if left out, 0 otherwise
+ */
+int batch_quiet (enum status_code_e sl) {
+    switch (sl) {
+    case CLEANUP:
+    case GROUP_INFO:
+    case GROUP_PROG:
+    case POP:
+    case POP_DIR:
+    case POP_IND:
+    case LINK:
+    case SCAN_IND:
+    case SCAN_BMP:
+    case ITABLE_BMP:
+    case JOURNAL_BMP:
+    case SANITY:
+    case INODE:
+    case DONE:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Starts a line with the target it is about, in a batch
+ */
+void print_target (struct recover_s *r) {
+    if (batch && r) {
+        printf("%s: ", fs_info(r)->name);
+    }
+}
+
 /* 
  * Recieve the broadcasted status
  */
-void status (enum status_code_e sl, ...) {
+void status (struct recover_s *r, enum status_code_e sl, ...) {
     va_list ap;
     uint32_t var = 0;
+    const char *fmt = 0;
+
+    /* Only the main steps of each target are shown in a batch */
+    if (batch && batch_quiet(sl)) {
+        return;
+    }
 
     va_start(ap, sl);
+    /* Targets of a batch share the terminal, keep each line whole */
+    flockfile(stdout);
+    if (sl != SCAN_PROG && sl != SCAN_BATCH) {
+        print_target(r);
+    }
 
     switch (sl) {
     /* Handle methods */
@@ -39,7 +179,7 @@ void status (enum status_code_e sl, ...) {
     case GROUP_PROG:
         var = va_arg(ap, uint32_t);
         /* Display the current group number accessed */
-        printf(" %u%s", var, ((var == *fs_info.ngroups - 1) ? "\n" : ""));
+        printf(" %u%s", var, ((var == *fs_info(r)->ngroups - 1) ? "\n" : ""));
         break;
 
     case POP:
@@ -65,10 +205,40 @@ void status (enum status_code_e sl, ...) {
         printf(RESET);
         break;
 
+    case ESTIMATE:
+        vprintf(YELLOW "[!] " RESET
+            "Sampling %u per mille of the drive to forecast the scan...\n",
+            ap);
+        break;
+    case EST_SAMPLE:
+        vprintf(YELLOW "[!] " RESET
+            "Sampled %u of the %u free blocks\n", ap);
+        break;
+    case EST_CAND:
+        vprintf(YELLOW "[!] " RESET
+            "Expecting about %u BMP headers, %u 1x, %u 2x and %u 3x "
+            "indirects\n", ap);
+        break;
+    case EST_TIME:
+        var = va_arg(ap, uint32_t);
+        printf(YELLOW "[!] " RESET
+            "Expecting %u MiB read", var);
+        var = va_arg(ap, uint32_t);
+        printf(" at %u MiB/s", var);
+        var = va_arg(ap, uint32_t);
+        printf(", about %u:%02u:%02u with one thread\n",
+            var / 3600, var / 60 % 60, var % 60);
+        break;
+
     case SCAN:
         printf(YELLOW "[!] " RESET
             "Scanning drive for important blocks...\n");
         break;
+    case SCAN_PLAN:
+        vprintf(YELLOW "[!] " RESET
+            "Reading %u MiB for %u free blocks in %u groups, "
+            "skipping %u groups\n", ap);
+        break;
     case SCAN_IND:
         printf(GREEN "[+] ");
         vprintf("Found potential %ux indirect block: %u\n", ap);
@@ -83,10 +253,50 @@ void status (enum status_code_e sl, ...) {
         var = va_arg(ap, uint32_t);
         /* Display progress every 10% */
         if (var % 10 == 0) {
+            print_target(r);
             printf(YELLOW "[!] " RESET
                 "%u%% complete...\n", var);
         }
         break;
+    case SCAN_RATE:
+        vprintf(YELLOW "[!] " RESET
+            "Scanned with %s: %u MiB read at %u MiB/s\n", ap);
+        break;
+    case SCAN_PACE:
+        vprintf(YELLOW "[!] " RESET
+            "Throttled to %u MiB/s, %u reads/s, at %u%% of the caps\n", ap);
+        break;
+    case SCAN_CKPT:
+        vprintf(YELLOW "[!] " RESET
+            "Checkpoint saved, next block %u\n", ap);
+        break;
+    case SCAN_RESUME:
+        vprintf(YELLOW "[!] " RESET
+            "Resuming scan from block %u\n", ap);
+        break;
+    case SCAN_BATCH:
+        fflush(stdout);
+        break;
+
+    case ITABLE:
+        printf(YELLOW "[!] " RESET
+            "Looking through the inode tables for deleted BMP files...\n");
+        break;
+    case ITABLE_BMP:
+        printf(GREEN "[+] ");
+        vprintf("Found deleted BMP inode %u at block %u\n", ap);
+        printf(RESET);
+        break;
+    case JOURNAL:
+        printf(YELLOW "[!] " RESET
+            "Looking through the journal for BMP files before they were "
+            "deleted...\n");
+        break;
+    case JOURNAL_BMP:
+        printf(GREEN "[+] ");
+        vprintf("Found BMP inode %u in journal transaction %u\n", ap);
+        printf(RESET);
+        break;
 
     case COLLECT:
         printf(YELLOW "[!] " RESET
@@ -102,6 +312,24 @@ void status (enum status_code_e sl, ...) {
         printf(RESET);
         break;
 
+    case COMMIT:
+        vprintf(YELLOW "[!] " RESET
+            "Wrote %u bytes in %u pages to the drive\n", ap);
+        break;
+    case PATCH:
+        vprintf(YELLOW "[!] " RESET
+            "Saved %u changed blocks to the patch file\n", ap);
+        break;
+
+    case APPLY:
+        printf(YELLOW "[!] " RESET
+            "Applying the patch file...\n");
+        break;
+    case CACHE:
+        vprintf(YELLOW "[!] " RESET
+            "Page cache peaked at %u MiB, %u MiB over the start\n", ap);
+        break;
+
     case DONE:
         printf(YELLOW "[!] " RESET
             "Done!\n"
@@ -111,43 +339,490 @@ void status (enum status_code_e sl, ...) {
     /* Handle error codes */
     case ERROR:
         printf(RED "[-] ");
-        vprintf(va_arg(ap, const char*), ap);
+        fmt = va_arg(ap, const char*);
+        vprintf(fmt, ap);
         printf(RESET);
         break;
     case WARN:
         printf(YELLOW "[!] ");
-        vprintf(va_arg(ap, const char*), ap);
+        fmt = va_arg(ap, const char*);
+        vprintf(fmt, ap);
         printf(RESET);
         break;
     }
+    /* The next line may be from another target, finish this one */
+    if (batch && (sl == ERROR || sl == WARN) &&
+        (!*fmt || *(fmt + strlen(fmt) - 1) != '\n')) {
+        printf("\n");
+    }
 
+    funlockfile(stdout);
     va_end(ap);
 }
 
+/*
+ * Adds a target to the batch
+ * Return 0 if success, -1 if fail
+ */
+int add_target (const char *path) {
+    struct target_s *grown;
+
+    if (n_targets == cap_targets) {
+        cap_targets = (cap_targets > 0) ? cap_targets * 2 : 16;
+        grown = realloc(targets, cap_targets * sizeof(*targets));
+        if (!grown) {
+            return -1;
+        }
+        targets = grown;
+    }
+    memset(targets + n_targets, 0, sizeof(*targets));
+    (targets + n_targets)->path = calloc(strlen(path) + 1, sizeof(char));
+    if (!(targets + n_targets)->path) {
+        return -1;
+    }
+    strcpy((targets + n_targets)->path, path);
+    n_targets++;
+    return 0;
+}
+
+/*
+ * Adds every target listed in the file, one per line
+ * Empty lines and lines starting with # are skipped
+ * Return 0 if success, -1 if fail
+ */
+int read_list (const char *fname) {
+    FILE *f;
+    char *line = 0;
+    size_t cap = 0;
+    ssize_t len;
+    int ret = 0;
+
+    f = fopen(fname, "r");
+    if (!f) {
+        return -1;
+    }
+    while (!ret && (len = getline(&line, &cap, f)) != -1) {
+        while (len > 0 && (*(line + len - 1) == '\n' ||
+            *(line + len - 1) == '\r')) {
+            *(line + --len) = 0;
+        }
+        if (len > 0 && *line != '#') {
+            ret = add_target(line);
+        }
+    }
+    free(line);
+    fclose(f);
+
+    return ret;
+}
+
+/*
+ * Takes back the deleted files the journal and the inode tables still
+ * have, then scans the drive for the rest
+ * Return 1 if anything was found, 0 if nothing, -1 if fail
+ */
+int find_files (struct recover_s *r) {
+    int journal;
+    int inodes;
+    int ret;
+
+    journal = scan_journal(r);
+    inodes = (journal < 0) ? journal : scan_inodes(r);
+    ret = (inodes < 0 || itable_only) ? inodes : scan(r);
+    if (ret < 0) {
+        return -1;
+    }
+    return (ret > 0 || journal > 0 || inodes > 0) ? 1 : 0;
+}
+
+/*
+ * Recovers a target of the batch, recording what was found
+ */
+void run_target (struct target_s *t) {
+    struct recover_s *r;
+    const struct fs_info_s *info;
+    int ret;
+    int cx;
+
+    t->result = TGT_FAILED;
+    r = init(t->path, 0);
+    if (!r) {
+        return;
+    }
+    set_scan_threads(r, batch_threads);
+    set_scan_backend(r, batch_backend);
+    set_cache_neutral(r, cache_neutral);
+    set_throttle(r, throttle_mib, throttle_iops);
+    set_stream(r, stream);
+    set_stop(r, stop_files, stop_block);
+
+    ret = find_files(r);
+    if (ret == 0) {
+        t->result = TGT_EMPTY;
+        status(r, WARN, "No deleted BMP files found\n");
+    } else if (ret > 0 && !collect(r)) {
+        t->result = TGT_RECOVERED;
+    }
+
+    info = fs_info(r);
+    *t->counts = info->bmp_starts->count;
+    for (cx = 0; cx < 3; cx++) {
+        *(t->counts + cx + 1) = (info->indirects + cx)->count;
+    }
+    t->n_rec = *info->n_rec;
+    t->bytes = *info->scan_bytes;
+    t->msec = *info->scan_msec;
+    perf_snap(info->perf, &t->perf);
+    cleanup(r);
+}
+
+/*
+ * Batch worker, recovers targets until there are none left
+ */
+void* batch_worker (void *arg) {
+    size_t cx;
+
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&batch_lock);
+        cx = next_target++;
+        pthread_mutex_unlock(&batch_lock);
+        if (cx >= n_targets) {
+            break;
+        }
+        run_target(targets + cx);
+    }
+
+    return 0;
+}
+
+/*
+ * Prints what was found on each target, then the combined throughput
+ */
+void print_summary (uint64_t wall_msec) {
+    const char *results [] = {
+        "pending", "recovered", "nothing", "failed"
+    };
+    size_t cx;
+    int width = 6;
+    uint32_t n_ok = 0;
+    uint32_t n_rec = 0;
+    uint64_t bytes = 0;
+    uint64_t msec;
+
+    for (cx = 0; cx < n_targets; cx++) {
+        if ((int)strlen((targets + cx)->path) > width) {
+            width = strlen((targets + cx)->path);
+        }
+    }
+
+    printf(YELLOW "[!] " RESET "Batch summary\n");
+    printf("  %-*s  %-9s  %8s  %8s  %8s  %8s  %5s  %8s  %7s\n",
+        width, "target", "result", "BMP", "1x", "2x", "3x", "files",
+        "MiB", "MiB/s");
+    for (cx = 0; cx < n_targets; cx++) {
+        struct target_s *t = targets + cx;
+
+        msec = (t->msec > 0) ? t->msec : 1;
+        printf("  %-*s  %-9s  %8u  %8u  %8u  %8u  %5u  %8u  %7u\n",
+            width, t->path, *(results + t->result),
+            *t->counts, *(t->counts + 1), *(t->counts + 2),
+            *(t->counts + 3), t->n_rec, (uint32_t)(t->bytes >> 20),
+            (uint32_t)(((t->bytes >> 10) * 1000 / msec) >> 10));
+        n_ok += (t->result == TGT_RECOVERED) ? 1 : 0;
+        n_rec += t->n_rec;
+        bytes += t->bytes;
+    }
+
+    msec = (wall_msec > 0) ? wall_msec : 1;
+    printf(YELLOW "[!] " RESET
+        "%u of %u targets recovered, %u files, "
+        "%u MiB read in %u.%03u s at %u MiB/s combined\n",
+        n_ok, (uint32_t)n_targets, n_rec, (uint32_t)(bytes >> 20),
+        (uint32_t)(wall_msec / 1000), (uint32_t)(wall_msec % 1000),
+        (uint32_t)(((bytes >> 10) * 1000 / msec) >> 10));
+}
+
+/*
+ * Saves the metrics of every target to the JSON file, as an array
+ * Return 0 if success, -1 if fail
+ */
+int save_metrics () {
+    FILE *f;
+    size_t cx;
+    int ok = 1;
+
+    f = fopen(metrics_json, "w");
+    if (!f) {
+        return -1;
+    }
+    fprintf(f, "[\n");
+    for (cx = 0; ok && cx < n_targets; cx++) {
+        ok = !perf_json(&(targets + cx)->perf, (targets + cx)->path, f, 2);
+        fprintf(f, "%s\n", (cx + 1 < n_targets) ? "," : "");
+    }
+    fprintf(f, "]\n");
+    ok = !ferror(f) && ok;
+    ok = (fclose(f) == 0) && ok;
+
+    return (ok) ? 0 : -1;
+}
+
+/*
+ * Recovers every target, as many at once as the readers allow
+ * Return 0 if every target was recovered, -1 if not
+ */
+int run_batch (uint32_t readers) {
+    pthread_t *workers;
+    uint32_t n_workers;
+    uint32_t cx;
+    struct timespec start;
+    struct timespec end;
+    uint64_t wall_msec;
+    int ret = 0;
+
+    /* Each target scans with its own threads, all count to the limit */
+    batch_threads = (batch_threads < readers) ? batch_threads : readers;
+    n_workers = readers / batch_threads;
+    n_workers = (n_workers < n_targets) ? n_workers : n_targets;
+    workers = calloc(n_workers, sizeof(*workers));
+    if (!workers) {
+        status(0, ERROR, "Unable to allocate the batch workers!\n");
+        return -1;
+    }
+
+    printf(YELLOW "[!] " RESET
+        "Recovering %u targets, %u at a time with %u scan threads each\n",
+        (uint32_t)n_targets, n_workers, batch_threads);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (cx = 0; cx < n_workers; cx++) {
+        if (pthread_create(workers + cx, 0, batch_worker, 0)) {
+            break;
+        }
+    }
+    /* Without any worker the targets are recovered here, one by one */
+    if (cx == 0) {
+        batch_worker(0);
+    }
+    n_workers = cx;
+    for (cx = 0; cx < n_workers; cx++) {
+        pthread_join(*(workers + cx), 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(workers);
+
+    wall_msec = (end.tv_sec - start.tv_sec) * 1000 +
+        (end.tv_nsec - start.tv_nsec) / 1000000;
+    print_summary(wall_msec);
+    if (metrics_json && save_metrics()) {
+        status(0, WARN, "Unable to save the metrics: %s\n", metrics_json);
+    }
+
+    for (cx = 0; cx < n_targets; cx++) {
+        if ((targets + cx)->result != TGT_RECOVERED) {
+            ret = -1;
+        }
+        free((targets + cx)->path);
+    }
+    free(targets);
+
+    return ret;
+}
+
 int main (int argc, char **argv) {
+    struct recover_s *r;
+    int opt;
+    int ret;
+    long threads = 1;
+    int backend = BLKIO_MMAP;
+    const char *ckpt = 0;
+    long groups = CKPT_GROUPS;
+    int resume = 0;
+    const char *patch = 0;
+    const char *apply = 0;
+    const char *list = 0;
+    long readers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* Parse the options */
+    while ((opt = getopt(argc, argv, "ij:b:dq:e:c:g:rp:a:l:n:sm:t:o:w:")) !=
+        -1) {
+        switch (opt) {
+        case 'i':
+            itable_only = 1;
+            break;
+        case 's':
+            stream = 1;
+            break;
+        case 'm':
+            stop_files = strtoul(optarg, 0, 10);
+            if (stop_files == 0) {
+                usage();
+                exit(-1);
+            }
+            break;
+        case 't':
+            stop_block = strtoul(optarg, 0, 10);
+            if (stop_block == 0) {
+                usage();
+                exit(-1);
+            }
+            break;
+        case 'j':
+            threads = strtol(optarg, 0, 10);
+            if (threads < 1) {
+                usage();
+                exit(-1);
+            }
+            break;
+        case 'b':
+            backend = blkio_parse(optarg);
+            if (backend < 0) {
+                usage();
+                exit(-1);
+            }
+            break;
+        case 'd':
+            cache_neutral = 1;
+            break;
+        case 'q':
+            if (pace_parse(optarg, &throttle_mib, &throttle_iops)) {
+                usage();
+                exit(-1);
+            }
+            break;
+        case 'e':
+            forecast = strtoul(optarg, 0, 10);
+            if (forecast < 1 || forecast > 1000) {
+                usage();
+                exit(-1);
+            }
+            break;
+        case 'c':
+            ckpt = optarg;
+            break;
+        case 'g':
+            groups = strtol(optarg, 0, 10);
+            if (groups < 1) {
+                usage();
+                exit(-1);
+            }
+            break;
+        case 'r':
+            resume = 1;
+            break;
+        case 'p':
+            patch = optarg;
+            break;
+        case 'a':
+            apply = optarg;
+            break;
+        case 'l':
+            list = optarg;
+            break;
+        case 'o':
+            metrics_json = optarg;
+            break;
+        case 'w':
+            metrics_prom = optarg;
+            break;
+        case 'n':
+            readers = strtol(optarg, 0, 10);
+            if (readers < 1) {
+                usage();
+                exit(-1);
+            }
+            break;
+        default:
+            usage();
+            exit(-1);
+        }
+    }
+
+    /* Gather the targets */
+    for (opt = optind; opt < argc; opt++) {
+        if (add_target(*(argv + opt))) {
+            status(0, ERROR, "Out of memory for the targets!\n");
+            exit(-1);
+        }
+    }
+    if (list && read_list(list)) {
+        status(0, ERROR, "Unable to read the target list: %s\n", list);
+        exit(-1);
+    }
+    batch = list || n_targets > 1;
+
     /* Test args */
-    if (argc != 2) {
+    if (n_targets < 1 || (resume && !ckpt) || (patch && apply) ||
+        (batch && (forecast || ckpt || patch || apply || metrics_prom))) {
         usage();
         exit(-1);
     }
 
     /* Test if running as root */
     if (getuid()) {
-        status(ERROR, "Requires root permissions to run!\n");
+        status(0, ERROR, "Requires root permissions to run!\n");
         exit(-1);
     }
 
+    /* Recover every target, several at once */
+    if (batch) {
+        batch_threads = threads;
+        batch_backend = backend;
+        exit((run_batch((readers > 0) ? readers : 1)) ? -1 : 0);
+    }
+
     /* Initialize */
-    init(*(argv + 1));
+    r = init(targets->path, patch);
+    if (!r) {
+        exit(-1);
+    }
 
-    /* Scan the drive */
-    if (!scan()) {
-        status(ERROR, "No potential BMP start blocks found, exiting...\n");
+    /* Only write out an earlier run's changes */
+    if (apply) {
+        ret = apply_patch(r, apply);
+        cleanup(r);
+        exit((ret) ? -1 : 0);
+    }
+    set_scan_threads(r, threads);
+    set_scan_backend(r, backend);
+    set_cache_neutral(r, cache_neutral);
+    set_throttle(r, throttle_mib, throttle_iops);
+    if (ckpt || stream) {
+        if (set_checkpoint(r, ckpt, groups)) {
+            cleanup(r);
+            exit(-1);
+        }
+        set_resume(r, resume);
+    }
+    set_stream(r, stream);
+    set_stop(r, stop_files, stop_block);
+    if (metrics_prom && set_metrics(r, metrics_prom)) {
+        status(r, ERROR, "Unable to write the metrics: %s\n", metrics_prom);
+        cleanup(r);
         exit(-1);
     }
 
-    /* Create entries for the files found */
-    collect();
+    /* Only forecast the scan */
+    if (forecast) {
+        ret = estimate(r, forecast);
+    } else {
+        /* Find the deleted files */
+        ret = find_files(r);
+        if (ret == 0) {
+            status(r, ERROR, "No deleted BMP files found, exiting...\n");
+        }
+
+        /* Create entries for the files found */
+        ret = (ret > 0) ? collect(r) : -1;
+    }
+    perf_snap(fs_info(r)->perf, &targets->perf);
+    cleanup(r);
+
+    if (metrics_json && save_metrics()) {
+        status(0, WARN, "Unable to save the metrics: %s\n", metrics_json);
+    }
+    free(targets->path);
+    free(targets);
 
-    exit(0);
+    exit((ret) ? -1 : 0);
 }
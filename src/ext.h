@@ -18,7 +18,11 @@
 #define MODE_070            ((0x20 | 0x10 | 0x08) & 0x38)
 #define MODE_700            ((0x0100 | 0x0080 | 0x0040) & 0x01C0)
 #define MODE_777            (MODE_007 | MODE_070 | MODE_700)
+#define TYPE_MASK           (0xF000)
 #define TYPE_REG            (0x8000)
+#define FLAG_EXTENTS        (0x80000)
+#define COMPAT_JOURNAL      (0x0004)
+#define BG_BLOCK_UNINIT     (0x0002)
 #define SIN_IND             (12)
 #define DBL_IND             (13)
 #define TRI_IND             (14)
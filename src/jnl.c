@@ -0,0 +1,317 @@
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ext.h"
+#include "jnl.h"
+
+/*
+ * Private method
+ * Reads a big endian field
+ */
+uint32_t be32 (const uint8_t *p) {
+    return ((uint32_t)*p << 24) | ((uint32_t)*(p + 1) << 16) |
+        ((uint32_t)*(p + 2) << 8) | (uint32_t)*(p + 3);
+}
+
+/*
+ * Private method
+ * Tests if transaction a was logged before b, sequences wrap around
+ */
+int seq_before (uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+/*
+ * Private method
+ * Orders copies by block, then oldest first, for qsort(3)
+ */
+int cmp_copy (const void *a, const void *b) {
+    const struct jnl_copy_s *ca = a;
+    const struct jnl_copy_s *cb = b;
+
+    if (ca->block != cb->block) {
+        return (ca->block > cb->block) - (ca->block < cb->block);
+    }
+    return seq_before(cb->seq, ca->seq) - seq_before(ca->seq, cb->seq);
+}
+
+/*
+ * Private method
+ * Gets a journal block
+ */
+const uint8_t* jnl_block (const struct jnl_s *j, uint32_t pos) {
+    return j->map + (uint64_t)*(j->blocks + pos) * BYTES_PER_BLOCK;
+}
+
+/*
+ * Private method
+ * Adds the blocks of the journal listed by a block map entry, up to len
+ * Return 0 if success, -1 if fail
+ */
+int map_journal (struct jnl_s *j, uint32_t nblocks, uint32_t block,
+    uint32_t ind, uint32_t len) {
+    const uint8_t *blk;
+    uint32_t cx;
+
+    if (block == 0 || block >= nblocks) {
+        return -1;
+    }
+    if (ind == 0) {
+        *(j->blocks + j->len++) = block;
+        return 0;
+    }
+
+    blk = j->map + (uint64_t)block * BYTES_PER_BLOCK;
+    for (cx = 0; j->len < len && cx < BYTES_PER_BLOCK / 4; cx++) {
+        if (map_journal(j, nblocks, *((const uint32_t*)blk + cx), ind - 1,
+            len)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Private method
+ * Adds a logged block, unescaping it if its magic was cleared
+ * Return 0 if success, -1 if out of memory
+ */
+int add_copy (struct jnl_s *j, uint32_t block, uint32_t seq,
+    const uint8_t *data, int escaped) {
+    struct jnl_copy_s *copies;
+    struct jnl_copy_s *c;
+    size_t cap;
+
+    if (j->count == j->cap) {
+        cap = (j->cap > 0) ? j->cap * 2 : 64;
+        copies = realloc(j->copies, cap * sizeof(*copies));
+        if (!copies) {
+            return -1;
+        }
+        j->copies = copies;
+        j->cap = cap;
+    }
+    c = j->copies + j->count;
+    c->block = block;
+    c->seq = seq;
+    c->data = data;
+    c->own = 0;
+    if (escaped) {
+        c->own = malloc(BYTES_PER_BLOCK);
+        if (!c->own) {
+            return -1;
+        }
+        memcpy(c->own, data, BYTES_PER_BLOCK);
+        *c->own = (JNL_MAGIC >> 24) & 0xFF;
+        *(c->own + 1) = (JNL_MAGIC >> 16) & 0xFF;
+        *(c->own + 2) = (JNL_MAGIC >> 8) & 0xFF;
+        *(c->own + 3) = JNL_MAGIC & 0xFF;
+        c->data = c->own;
+    }
+    j->count++;
+
+    return 0;
+}
+
+/*
+ * Private method
+ * Drops the copies added since mark, their transaction never committed
+ */
+void drop_copies (struct jnl_s *j, size_t mark) {
+    while (j->count > mark) {
+        j->count--;
+        free((j->copies + j->count)->own);
+    }
+}
+
+/*
+ * Private method
+ * Reads the transaction whose first descriptor is at pos
+ * Its copies are only kept if its commit block is found
+ * Returns the journal blocks it takes, 0 if it never committed,
+ * -1 if out of memory
+ */
+long read_txn (struct jnl_s *j, uint32_t nblocks, uint32_t pos) {
+    const uint8_t *blk = jnl_block(j, pos);
+    const uint8_t *tag;
+    uint32_t seq = be32(blk + 8);
+    uint32_t flags;
+    uint32_t off;
+    uint32_t end = BYTES_PER_BLOCK;
+    long steps = 0;
+    size_t mark = j->count;
+
+    /* Checksummed journals end descriptors with a checksum */
+    if (j->incompat & (JNL_CSUM_V2 | JNL_CSUM_V3)) {
+        end -= 4;
+    }
+    for (;;) {
+        blk = jnl_block(j, pos);
+        if (be32(blk) != JNL_MAGIC || be32(blk + 8) != seq) {
+            break;
+        }
+        if (be32(blk + 4) == JNL_COMMIT) {
+            return steps + 1;
+        }
+        if (be32(blk + 4) == JNL_DESC) {
+            /* Each tag is followed by its block, in order */
+            for (off = 12; off + j->tag_bytes <= end;
+                off += j->tag_bytes) {
+                tag = blk + off;
+                flags = be32(tag + 4) & 0xFFFF;
+                pos = (pos + 1 < j->len) ? pos + 1 : j->first;
+                steps++;
+                /* Blocks past 2^32 can't be on this filesystem */
+                if (!((j->incompat & JNL_64BIT) && be32(tag + 8) != 0) &&
+                    be32(tag) < nblocks &&
+                    add_copy(j, be32(tag), seq, jnl_block(j, pos),
+                    flags & JNL_ESCAPE)) {
+                    drop_copies(j, mark);
+                    return -1;
+                }
+                if (!(flags & JNL_SAME_UUID)) {
+                    off += 16;
+                }
+                if (flags & JNL_LAST_TAG) {
+                    break;
+                }
+            }
+        } else if (be32(blk + 4) != JNL_REVOKE) {
+            break;
+        }
+
+        pos = (pos + 1 < j->len) ? pos + 1 : j->first;
+        steps++;
+        if (steps >= (long)(j->len - j->first)) {
+            break;
+        }
+    }
+
+    drop_copies(j, mark);
+    return 0;
+}
+
+/*
+ * Public method
+ * Reads every committed transaction left in the journal
+ * The journal is circular, transactions before its start are older ones
+ * that have not been written over yet
+ */
+int jnl_load (struct jnl_s *j, const uint8_t *map, uint32_t nblocks,
+    const struct inode_s *ino) {
+    const uint32_t *iblocks = (const uint32_t*)(ino->i_block);
+    const uint8_t *sb;
+    uint32_t len = ino->i_size_lo / BYTES_PER_BLOCK;
+    uint32_t pos;
+    uint32_t cx;
+    long steps;
+
+    jnl_free(j);
+    j->map = map;
+
+    /* Map out the journal, it only uses block maps on ext3 */
+    if (len < 2 || len > nblocks || (ino->i_flags & FLAG_EXTENTS)) {
+        return -1;
+    }
+    j->blocks = malloc(len * sizeof(*j->blocks));
+    if (!j->blocks) {
+        return -1;
+    }
+    for (cx = 0; j->len < len && cx <= TRI_IND; cx++) {
+        if (map_journal(j, nblocks, *(iblocks + cx),
+            (cx < SIN_IND) ? 0 : cx - SIN_IND + 1, len)) {
+            jnl_free(j);
+            return -1;
+        }
+    }
+
+    /* The journal superblock sets the size and the tag layout */
+    sb = jnl_block(j, 0);
+    if (be32(sb) != JNL_MAGIC ||
+        (be32(sb + 4) != JNL_SB_V1 && be32(sb + 4) != JNL_SB_V2) ||
+        be32(sb + 12) != BYTES_PER_BLOCK || be32(sb + 16) > j->len ||
+        be32(sb + 20) == 0 || be32(sb + 20) >= be32(sb + 16)) {
+        jnl_free(j);
+        return -1;
+    }
+    j->len = be32(sb + 16);
+    j->first = be32(sb + 20);
+    j->incompat = (be32(sb + 4) == JNL_SB_V2) ? be32(sb + 40) : 0;
+    if (j->incompat & JNL_CSUM_V3) {
+        j->tag_bytes = 16;
+    } else {
+        j->tag_bytes = 12 + ((j->incompat & JNL_CSUM_V2) ? 2 : 0) -
+            ((j->incompat & JNL_64BIT) ? 0 : 4);
+    }
+
+    /* Data blocks are escaped, so only real descriptors carry the magic */
+    for (pos = j->first; pos < j->len; pos++) {
+        const uint8_t *blk = jnl_block(j, pos);
+
+        if (be32(blk) != JNL_MAGIC || be32(blk + 4) != JNL_DESC) {
+            continue;
+        }
+        steps = read_txn(j, nblocks, pos);
+        if (steps < 0) {
+            jnl_free(j);
+            return -1;
+        }
+        /* Skip over the transaction, unless it wrapped around */
+        if (steps > 0 && pos + steps <= j->len) {
+            pos += steps - 1;
+        } else if (steps > 0) {
+            break;
+        }
+    }
+    qsort(j->copies, j->count, sizeof(*j->copies), cmp_copy);
+
+    return 0;
+}
+
+/*
+ * Public method
+ * Finds the copy the block had as of the transaction
+ */
+const struct jnl_copy_s* jnl_find (const struct jnl_s *j, uint32_t block,
+    uint32_t seq) {
+    size_t lo = 0;
+    size_t hi = j->count;
+    size_t mid;
+    const struct jnl_copy_s *c;
+
+    /* Find the first copy past the block, or logged after seq */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        c = j->copies + mid;
+        if (c->block < block ||
+            (c->block == block && !seq_before(seq, c->seq))) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo > 0 && (j->copies + lo - 1)->block == block) {
+        return j->copies + lo - 1;
+    }
+    return 0;
+}
+
+/*
+ * Public method
+ * Drops every copy and the journal map
+ */
+void jnl_free (struct jnl_s *j) {
+    drop_copies(j, 0);
+    free(j->copies);
+    free(j->blocks);
+    j->copies = 0;
+    j->blocks = 0;
+    j->count = 0;
+    j->cap = 0;
+    j->len = 0;
+    j->first = 0;
+    j->incompat = 0;
+    j->tag_bytes = 0;
+}
@@ -0,0 +1,75 @@
+#ifndef JNL_H_20261016_232540
+#define JNL_H_20261016_232540
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ext.h"
+
+/*
+ * ext3 journal (JBD/JBD2) layout, every field is big endian
+ * Block header: magic, block type, transaction sequence
+ */
+#define JNL_MAGIC       (0xC03B3998)
+#define JNL_DESC        (1)
+#define JNL_COMMIT      (2)
+#define JNL_SB_V1       (3)
+#define JNL_SB_V2       (4)
+#define JNL_REVOKE      (5)
+
+/* Descriptor tag flags */
+#define JNL_ESCAPE      (0x1)
+#define JNL_SAME_UUID   (0x2)
+#define JNL_LAST_TAG    (0x8)
+
+/* Incompatible features that change the tag layout */
+#define JNL_64BIT       (0x2)
+#define JNL_CSUM_V2     (0x8)
+#define JNL_CSUM_V3     (0x10)
+
+/* A block logged by a committed transaction */
+struct jnl_copy_s {
+    uint32_t block;
+    uint32_t seq;
+    /* Where the copy is, own is set if it had to be unescaped */
+    const uint8_t *data;
+    uint8_t *own;
+};
+
+/*
+ * Every committed copy still in the journal, old transactions included
+ * Copies are ordered by block, then oldest first
+ */
+struct jnl_s {
+    const uint8_t *map;
+    /* Device block of each journal block */
+    uint32_t *blocks;
+    uint32_t len;
+    uint32_t first;
+    uint32_t incompat;
+    uint32_t tag_bytes;
+    struct jnl_copy_s *copies;
+    size_t count;
+    size_t cap;
+};
+
+#define JNL_EMPTY   { (const uint8_t*)0, (uint32_t*)0, 0, 0, 0, 0, \
+    (struct jnl_copy_s*)0, 0, 0 }
+
+/*
+ * Reads every committed transaction out of the journal held by the inode
+ * Returns 0 if success, -1 if fail or if it isn't a journal that can be read
+ */
+int jnl_load (struct jnl_s *j, const uint8_t *map, uint32_t nblocks,
+    const struct inode_s *ino);
+
+/*
+ * Finds the newest copy of a block logged no later than transaction seq
+ * Returns 0 if the journal has none
+ */
+const struct jnl_copy_s* jnl_find (const struct jnl_s *j, uint32_t block,
+    uint32_t seq);
+
+void jnl_free (struct jnl_s *j);
+
+#endif /* JNL_H_20261016_232540 */
@@ -0,0 +1,673 @@
+/*
+ * Times the block predicates on their own, over a drive held in memory
+ * The predicates and structures come from recover_int.h
+ */
+#define _XOPEN_SOURCE 700
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "blkio.h"
+#include "bmp.h"
+#include "cand.h"
+#include "ext.h"
+#include "recover.h"
+#include "recover_int.h"
+#include "simd.h"
+#include "txn.h"
+
+/* Blocks of the in-memory drive, the listed blocks of 1x indirects */
+#define MICRO_BLOCKS    (4 * 4096)
+#define LISTED_FIRST    (MICRO_BLOCKS / 2)
+#define PER_IND         (BYTES_PER_BLOCK / sizeof(uint32_t))
+/* Blocks in each set of generated inputs */
+#define SET_BLOCKS      (1024)
+#define SET_IND2        (64)
+#define SET_IND3        (16)
+/* 1x indirects listed by each 2x, 2x listed by each 3x */
+#define KIDS_IND2       (SET_BLOCKS / SET_IND2)
+#define KIDS_IND3       (SET_IND2 / SET_IND3)
+/* First block of the inputs, the ones before hold the metadata */
+#define SET_FIRST       (16)
+/* Random blocks the kernels are checked on, kernels they are checked in */
+#define CHECK_RANDOM    (1024)
+#define N_KERNELS       (3)
+/* Starts tried around a zero_tail boundary, past the widest vector */
+#define CHECK_SPAN      (9)
+/* Sizes of the candidate lists spliced together, full and partial chunks */
+#define N_SPLICES       (16)
+
+/*
+ * The inputs: blocks of zeros, random bytes, BMP headers, valid indirects
+ * and near misses that only fail at their last entry, or last child
+ * Indirects and near misses come in each level
+ */
+enum input_e {
+    IN_ZERO, IN_RANDOM, IN_IND, IN_NEAR, IN_BMP, N_INPUTS
+};
+
+enum pred_e {
+    PRED_CMP_IND, PRED_MAGIC, PRED_USED, PRED_FIND, PRED_MARK, N_PREDS
+};
+
+const char *input_names [] = {
+    "zero", "random", "indirect", "near miss", "bmp header"
+};
+const char *pred_names [] = {
+    "cmp_ind", "magic_check", "is_block_used", "find_next_ind", "mark_used"
+};
+
+const char *kernel_names [] = { "scalar", "sse2", "avx2" };
+
+struct recover_s *mr = 0;
+struct scan_part_s mpart;
+/* First block and size of every set, by input and level */
+uint32_t set_first [N_INPUTS][3];
+uint32_t set_count [N_INPUTS][3];
+uint64_t micro_state = 1;
+/* Results are summed here so the calls can't be optimized away */
+volatile uint32_t sink = 0;
+/* Block the kernels are checked on, and how the checks went */
+uint32_t chk_blk [PER_IND];
+uint32_t chk_blocks = 0;
+uint32_t chk_fails = 0;
+size_t splice_sizes [N_SPLICES] = {
+    0, 1, 5, CAND_CHUNK - 1, CAND_CHUNK, 3, CAND_CHUNK + 7, 0,
+    2 * CAND_CHUNK + 1, 100, 3 * CAND_CHUNK, 1, CAND_CHUNK - 3, 2,
+    CAND_CHUNK / 2, CAND_CHUNK + 1
+};
+
+void usage () {
+    printf("Usage: ./bmp_undelete_micro [-c] [-k kernel] [-t msec] "
+        "[-r seed]\n");
+    printf("  -c          check that every kernel the CPU supports gives the "
+        "same answers,\n              and that candidate lists splice "
+        "together, instead of timing\n");
+    printf("  -k kernel   ind1_check and zero_tail kernels: scalar, sse2, "
+        "avx2 (default\n              the fastest the CPU supports)\n");
+    printf("  -t msec     time spent on each predicate and input "
+        "(default 200)\n");
+    printf("  -r seed     seed of the random inputs (default 1)\n");
+}
+
+/*
+ * Only failures are shown
+ */
+void status (struct recover_s *r, enum status_code_e sl, ...) {
+    va_list ap;
+
+    (void)r;
+    if (sl != ERROR) {
+        return;
+    }
+    va_start(ap, sl);
+    vfprintf(stderr, va_arg(ap, const char*), ap);
+    va_end(ap);
+}
+
+/*
+ * Next number of the generator (xorshift64*)
+ */
+uint32_t micro_rand () {
+    micro_state ^= micro_state >> 12;
+    micro_state ^= micro_state << 25;
+    micro_state ^= micro_state >> 27;
+    return (uint32_t)((micro_state *
+        (((uint64_t)0x2545F491 << 32) | 0x4F6CDD1D)) >> 32);
+}
+
+/*
+ * Reads the monotonic clock in nanoseconds
+ */
+uint64_t micro_nsec () {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Gets a block of the in-memory drive as block numbers
+ */
+uint32_t* micro_block (uint32_t block) {
+    return (uint32_t*)(mr->dev + BLOCK_OFF(block));
+}
+
+/*
+ * Lays out a set of inputs after the last one
+ * Return the first block of the set
+ */
+uint32_t add_set (enum input_e in, uint32_t level, uint32_t count,
+    uint32_t *next) {
+    *(*(set_first + in) + level) = *next;
+    *(*(set_count + in) + level) = count;
+    *next += count;
+    return *(*(set_first + in) + level);
+}
+
+/*
+ * Makes a 1x indirect listing a full block of consecutive blocks, a near
+ * miss breaks the run at the last set of 4
+ */
+void make_ind1 (uint32_t block, int near) {
+    uint32_t *blk = micro_block(block);
+    uint32_t start = LISTED_FIRST + micro_rand() %
+        (MICRO_BLOCKS - LISTED_FIRST - PER_IND);
+    uint32_t cx;
+
+    for (cx = 0; cx < PER_IND; cx++) {
+        *(blk + cx) = start + cx;
+    }
+    if (near) {
+        (*(blk + PER_IND - 3))++;
+    }
+}
+
+/*
+ * Makes a 2x or 3x indirect listing its share of the set one level down,
+ * a near miss swaps its last child for a near miss of that level
+ */
+void make_ind (uint32_t block, uint32_t level, uint32_t pos, int near) {
+    uint32_t *blk = micro_block(block);
+    uint32_t kids = (level == 1) ? KIDS_IND2 : KIDS_IND3;
+    uint32_t cx;
+
+    for (cx = 0; cx < kids; cx++) {
+        *(blk + cx) = *(*(set_first + IN_IND) + level - 1) + pos * kids + cx;
+    }
+    if (near) {
+        *(blk + kids - 1) = *(*(set_first + IN_NEAR) + level - 1) + pos;
+    }
+}
+
+/*
+ * Builds the in-memory drive: one group with its descriptor and bitmaps,
+ * then every set of inputs, all marked free
+ * Return 0 if success, -1 if fail
+ */
+int make_drive () {
+    struct gd_s *gd;
+    struct bmp_head_s head;
+    uint32_t next = SET_FIRST;
+    uint32_t first;
+    uint32_t level;
+    uint32_t cx;
+    uint32_t cx2;
+
+    mr = calloc(1, sizeof(*mr));
+    if (!mr) {
+        return -1;
+    }
+    mr->devf = -1;
+    mr->dev_size = (size_t)MICRO_BLOCKS * BYTES_PER_BLOCK;
+    if (posix_memalign((void**)&mr->dev, BYTES_PER_BLOCK, mr->dev_size)) {
+        mr->dev = MAP_FAILED;
+        return -1;
+    }
+    memset(mr->dev, 0, mr->dev_size);
+    pthread_mutex_init(&mr->prog_lock, 0);
+    mr->nblocks = MICRO_BLOCKS;
+    mr->ngroups = 1;
+    mr->sb = (struct sb_s*)(mr->dev + SB_OFF);
+    mr->sb->s_blocks_count_lo = MICRO_BLOCKS;
+    txn_init(&mr->txn, mr->devf, mr->dev);
+
+    /* Superblock, descriptor, block bitmap, inode bitmap */
+    gd = (struct gd_s*)(mr->dev + GD_OFF(0));
+    gd->bg_block_bitmap_lo = 2;
+    gd->bg_inode_bitmap_lo = 3;
+    mr->gd = calloc(1, sizeof(*mr->gd));
+    mr->block_bmps = calloc(1, sizeof(*mr->block_bmps));
+    mr->inode_bmps = calloc(1, sizeof(*mr->inode_bmps));
+    mr->ind_memo = calloc(MICRO_BLOCKS / 16, sizeof(*mr->ind_memo));
+    if (!mr->gd || !mr->block_bmps || !mr->inode_bmps || !mr->ind_memo) {
+        return -1;
+    }
+    *mr->gd = gd;
+    point_bitmaps(mr);
+    for (cx = 0; cx < SET_FIRST; cx++) {
+        set_bmp_bit(*mr->block_bmps, cx);
+    }
+
+    /* Zeros, random bytes and BMP headers */
+    add_set(IN_ZERO, 0, SET_BLOCKS, &next);
+    first = add_set(IN_RANDOM, 0, SET_BLOCKS, &next);
+    for (cx = 0; cx < SET_BLOCKS * PER_IND; cx++) {
+        *(micro_block(first) + cx) = micro_rand();
+    }
+    first = add_set(IN_BMP, 0, SET_BLOCKS, &next);
+    for (cx = 0; cx < SET_BLOCKS; cx++) {
+        for (cx2 = 0; cx2 < PER_IND; cx2++) {
+            *(micro_block(first + cx) + cx2) = micro_rand();
+        }
+        memset(&head, 0, sizeof(head));
+        memcpy(head.bmp_magic, BMP_MAGIC, sizeof(head.bmp_magic));
+        head.bmp_file_size = micro_rand();
+        head.bmp_pixel_off = sizeof(head) + sizeof(struct dib_head_s);
+        memcpy(micro_block(first + cx), &head, sizeof(head));
+    }
+
+    /* Indirects, each level listing the one below */
+    for (level = 0; level < 3; level++) {
+        cx2 = (level == 0) ? SET_BLOCKS : (level == 1) ? SET_IND2 : SET_IND3;
+        add_set(IN_IND, level, cx2, &next);
+        add_set(IN_NEAR, level, cx2, &next);
+        for (cx = 0; cx < cx2; cx++) {
+            if (level == 0) {
+                make_ind1(*(*(set_first + IN_IND)) + cx, 0);
+                make_ind1(*(*(set_first + IN_NEAR)) + cx, 1);
+            } else {
+                make_ind(*(*(set_first + IN_IND) + level) + cx, level, cx,
+                    0);
+                make_ind(*(*(set_first + IN_NEAR) + level) + cx, level, cx,
+                    1);
+            }
+        }
+    }
+    /* The other inputs are the same for every level */
+    for (level = 1; level < 3; level++) {
+        for (cx = 0; cx < N_INPUTS; cx++) {
+            if (cx != IN_IND && cx != IN_NEAR) {
+                *(*(set_first + cx) + level) = **(set_first + cx);
+                *(*(set_count + cx) + level) = **(set_count + cx);
+            }
+        }
+    }
+
+    /* find_next_ind() looks through the valid 1x indirects */
+    for (cx = 0; cx < **(set_count + IN_IND); cx++) {
+        if (!cand_push(mr->indirects, **(set_first + IN_IND) + cx)) {
+            return -1;
+        }
+    }
+    if (index_indirects(mr)) {
+        return -1;
+    }
+
+    /* cmp_ind() reads the blocks through a stream of its own */
+    memset(&mpart, 0, sizeof(mpart));
+    mpart.io = blkio_open(BLKIO_MMAP, mr->devf, mr->dev, 0, MICRO_BLOCKS);
+    return (mpart.io) ? 0 : -1;
+}
+
+/*
+ * Runs a predicate on one block
+ * find_next_ind() looks for the indirect going on from the block before
+ * the first listed one, mark_used() takes the block as the given level
+ */
+uint32_t run_pred (enum pred_e pred, uint32_t level, uint32_t block) {
+    switch (pred) {
+    case PRED_CMP_IND:
+        return cmp_ind(mr, &mpart, block, level);
+    case PRED_MAGIC:
+        return magic_check(mr->dev + BLOCK_OFF(block));
+    case PRED_USED:
+        return is_block_used(mr, block);
+    case PRED_FIND:
+        return find_next_ind(mr, *micro_block(block) - 1, 0);
+    default:
+        return mark_used(mr, block, level);
+    }
+}
+
+/*
+ * Times a predicate over a set, a pass at a time until msec is up
+ * The memo of the indirect tests is cleared before every pass, so each
+ * block is tested from scratch as the scan would on first sight
+ */
+void time_row (enum pred_e pred, uint32_t level, enum input_e in,
+    uint32_t msec) {
+    const char *levels [] = { "1x", "2x", "3x" };
+    /* Only cmp_ind() takes the indirects of its level */
+    uint32_t set = (pred == PRED_CMP_IND) ? level : 0;
+    uint32_t first = *(*(set_first + in) + set);
+    uint32_t count = *(*(set_count + in) + set);
+    const char *label = "";
+    uint64_t spent = 0;
+    uint64_t blocks = 0;
+    uint64_t start;
+    uint32_t cx;
+
+    while (spent < (uint64_t)msec * 1000000) {
+        memset(mr->ind_memo, 0, MICRO_BLOCKS / 16 * sizeof(*mr->ind_memo));
+        start = micro_nsec();
+        for (cx = 0; cx < count; cx++) {
+            sink += run_pred(pred, level, first + cx);
+        }
+        spent += micro_nsec() - start;
+        blocks += count;
+    }
+
+    if (pred == PRED_CMP_IND) {
+        label = *(levels + level);
+    } else if (pred == PRED_MARK) {
+        label = (level == 0) ? "data" : "1x";
+    }
+    printf("%-14s %-5s %-11s %10lu %9lu.%lu %12lu\n", *(pred_names + pred),
+        label, *(input_names + in), (unsigned long)blocks,
+        (unsigned long)(spent / blocks),
+        (unsigned long)(spent * 10 / blocks % 10),
+        (unsigned long)(blocks * 1000000000 / spent));
+}
+
+/*
+ * Sets the ind1_check and zero_tail kernels by name
+ * Return 0 if success, -1 if unknown or not supported by the CPU
+ */
+int set_kernel (const char *name) {
+    if (!strcmp(name, "scalar")) {
+        ind1_check = ind1_check_scalar;
+        zero_tail = zero_tail_scalar;
+        return 0;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (!strcmp(name, "sse2") && __builtin_cpu_supports("sse2")) {
+        ind1_check = ind1_check_sse2;
+        zero_tail = zero_tail_sse2;
+        return 0;
+    } else if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2")) {
+        ind1_check = ind1_check_avx2;
+        zero_tail = zero_tail_avx2;
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+/*
+ * Gets the name of the kernels in use
+ */
+const char* kernel_name () {
+#if defined(__x86_64__) || defined(__i386__)
+    if (ind1_check == ind1_check_avx2) {
+        return "avx2";
+    } else if (ind1_check == ind1_check_sse2) {
+        return "sse2";
+    }
+#endif
+    return "scalar";
+}
+
+/*
+ * Fills the check block with a listing of len entries, sets of 4
+ * consecutive block numbers that never wrap, then zeros
+ */
+void chk_listing (uint32_t len) {
+    uint32_t base = 0;
+    uint32_t cx;
+
+    for (cx = 0; cx < PER_IND; cx++) {
+        if (cx % 4 == 0) {
+            base = micro_rand() % 0x7FFFFFF0 + 1;
+        }
+        *(chk_blk + cx) = (cx < len) ? base + cx % 4 : 0;
+    }
+}
+
+/*
+ * Reports a kernel giving another answer than the scalar one, or than
+ * expected
+ */
+void chk_fail (const char *kernel, const char *pred, const char *what,
+    uint32_t pos, uint32_t from, int got, int ref, int want) {
+    if (chk_fails++ < 16) {
+        fprintf(stderr, "%s %s on %s block %u (from %u): got %d, scalar "
+            "%d, expected %d\n", kernel, pred, what, pos, from, got, ref,
+            want);
+    }
+}
+
+/*
+ * Runs every kernel the CPU supports on the check block
+ * ind1_check has to agree with the scalar version and with want, unless
+ * it is -1, zero_tail with the scalar version from every entry in [lo, hi]
+ */
+void check_block (const char *what, uint32_t pos, int want, uint32_t lo,
+    uint32_t hi) {
+    uint32_t k;
+    uint32_t from;
+    int got;
+    int ref;
+
+    chk_blocks++;
+    for (k = 0; k < N_KERNELS; k++) {
+        if (set_kernel(*(kernel_names + k))) {
+            continue;
+        }
+
+        got = ind1_check(chk_blk) != 0;
+        ref = ind1_check_scalar(chk_blk) != 0;
+        if (got != ref || (want >= 0 && got != want)) {
+            chk_fail(*(kernel_names + k), "ind1_check", what, pos, 0, got,
+                ref, want);
+        }
+
+        for (from = lo; from <= hi && from <= PER_IND; from++) {
+            got = zero_tail(chk_blk, from) != 0;
+            ref = zero_tail_scalar(chk_blk, from) != 0;
+            if (got != ref) {
+                chk_fail(*(kernel_names + k), "zero_tail", what, pos, from,
+                    got, ref, ref);
+            }
+        }
+    }
+}
+
+/*
+ * Checks the ind1_check and zero_tail kernels against the scalar ones on
+ * blocks of zeros, random bytes, listings of every length, near misses
+ * and early ends at every entry, and single non-zero entries around every
+ * zero_tail boundary
+ * Return 0 if they all agree, -1 if not
+ */
+int run_check () {
+    uint32_t pos;
+    uint32_t lo;
+    uint32_t cx;
+
+    memset(chk_blk, 0, sizeof(chk_blk));
+    check_block("zero", 0, 1, 0, PER_IND);
+
+    for (cx = 0; cx < CHECK_RANDOM; cx++) {
+        for (pos = 0; pos < PER_IND; pos++) {
+            *(chk_blk + pos) = micro_rand();
+        }
+        check_block("random", cx, -1, 0, 2 * CHECK_SPAN);
+    }
+
+    for (pos = 0; pos < PER_IND; pos++) {
+        lo = (pos > CHECK_SPAN) ? pos - CHECK_SPAN : 0;
+
+        /* A listing of every length, the tail starts right after it */
+        chk_listing(pos + 1);
+        check_block("valid", pos, 0, lo, pos + CHECK_SPAN);
+
+        /* One entry off by one, and one zero with the listing going on */
+        chk_listing(PER_IND);
+        (*(chk_blk + pos))++;
+        check_block("near miss", pos, 1, lo, pos + CHECK_SPAN);
+        chk_listing(PER_IND);
+        *(chk_blk + pos) = 0;
+        check_block("early end", pos, pos != PER_IND - 1, lo,
+            pos + CHECK_SPAN);
+
+        /* A single non-zero entry, alone and right after a listing */
+        memset(chk_blk, 0, sizeof(chk_blk));
+        *(chk_blk + pos) = micro_rand() | 1;
+        check_block("zero tail", pos, pos != 0, lo, pos + CHECK_SPAN);
+        if (pos >= 2) {
+            chk_listing(pos - 1);
+            *(chk_blk + pos) = micro_rand() | 1;
+            check_block("stray", pos, 1, lo, pos + CHECK_SPAN);
+        }
+    }
+
+    /* A set of 4 running through zero ends the listing early */
+    chk_listing(PER_IND);
+    for (cx = 0; cx < 4; cx++) {
+        *(chk_blk + cx) = 0xFFFFFFFE + cx;
+    }
+    check_block("wrap", 0, 1, 0, 2 * CHECK_SPAN);
+
+    printf("Kernels:");
+    for (cx = 0; cx < N_KERNELS; cx++) {
+        if (!set_kernel(*(kernel_names + cx))) {
+            printf(" %s", *(kernel_names + cx));
+        }
+    }
+    printf(", %u blocks, %u disagreements\n", chk_blocks, chk_fails);
+    return (chk_fails) ? -1 : 0;
+}
+
+/*
+ * Tests that a list holds 0, 1, 2, ... up to its count, read both by
+ * index and back from a file
+ * Return the number of wrong blocks
+ */
+size_t check_list (const struct cand_s *c) {
+    struct cand_s back = CAND_EMPTY;
+    size_t wrong = 0;
+    size_t cx;
+    FILE *f;
+
+    for (cx = 0; cx < c->count; cx++) {
+        wrong += cand_get(c, cx) != cx;
+    }
+
+    f = tmpfile();
+    if (!f || !cand_write(c, f) || fseek(f, 0, SEEK_SET) ||
+        !cand_read(&back, f, c->count)) {
+        wrong++;
+    } else {
+        for (cx = 0; cx < back.count; cx++) {
+            wrong += cand_get(&back, cx) != cx;
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+    cand_free(&back);
+    return wrong;
+}
+
+/*
+ * Splices lists of every kind of size onto one, as a scan merges its
+ * groups, starting on both a full and a partial chunk, and pushes on past
+ * the end after each
+ * Return 0 if every block is where it should be, -1 if not
+ */
+int check_splice () {
+    struct cand_s dest = CAND_EMPTY;
+    struct cand_s src = CAND_EMPTY;
+    uint32_t next;
+    uint32_t start;
+    size_t wrong = 0;
+    size_t cx;
+    size_t cx2;
+
+    for (start = 0; start < 2; start++) {
+        next = 0;
+        for (cx = 0; start && cx < CAND_CHUNK / 3; cx++) {
+            wrong += !cand_push(&dest, next++);
+        }
+        for (cx = 0; cx < N_SPLICES; cx++) {
+            for (cx2 = 0; cx2 < *(splice_sizes + cx); cx2++) {
+                wrong += !cand_push(&src, next++);
+            }
+            wrong += !cand_splice(&dest, &src);
+            wrong += src.count != 0 || dest.count != next;
+            if (cx % 4 == 3) {
+                wrong += !cand_push(&dest, next++);
+            }
+        }
+        wrong += check_list(&dest);
+        printf("Splices: %u lists onto %u blocks, %lu blocks, "
+            "%lu wrong\n", N_SPLICES, (unsigned)(start * (CAND_CHUNK / 3)),
+            (unsigned long)dest.count, (unsigned long)wrong);
+        cand_free(&dest);
+    }
+
+    return (wrong) ? -1 : 0;
+}
+
+int main (int argc, char **argv) {
+    const char *kernel = 0;
+    int check = 0;
+    uint32_t msec = 200;
+    uint32_t level;
+    uint32_t cx;
+    int opt;
+
+    /* Parse the options */
+    while ((opt = getopt(argc, argv, "ck:t:r:")) != -1) {
+        switch (opt) {
+        case 'c':
+            check = 1;
+            break;
+        case 'k':
+            kernel = optarg;
+            break;
+        case 't':
+            msec = strtoul(optarg, 0, 10);
+            break;
+        case 'r':
+            micro_state = strtoul(optarg, 0, 10);
+            break;
+        default:
+            usage();
+            exit(-1);
+        }
+    }
+    if (optind != argc || msec == 0 || micro_state == 0) {
+        usage();
+        exit(-1);
+    }
+
+    if (check) {
+        exit((run_check() | check_splice()) ? -1 : 0);
+    }
+
+    simd_init();
+    if (kernel && set_kernel(kernel)) {
+        fprintf(stderr, "Unknown or unsupported kernel: %s\n", kernel);
+        exit(-1);
+    }
+    if (make_drive()) {
+        fprintf(stderr, "Unable to build the drive in memory\n");
+        exit(-1);
+    }
+
+    printf("Kernels: %s, %u ms per row\n", kernel_name(), msec);
+    printf("%-14s %-5s %-11s %10s %11s %12s\n", "predicate", "level",
+        "input", "blocks", "ns/block", "blocks/s");
+    for (level = 0; level < 3; level++) {
+        for (cx = 0; cx < N_INPUTS; cx++) {
+            time_row(PRED_CMP_IND, level, cx, msec);
+        }
+    }
+    for (cx = 0; cx < N_INPUTS; cx++) {
+        time_row(PRED_MAGIC, 0, cx, msec);
+    }
+    for (cx = 0; cx < N_INPUTS; cx++) {
+        time_row(PRED_USED, 0, cx, msec);
+    }
+    for (cx = 0; cx < N_INPUTS; cx++) {
+        time_row(PRED_FIND, 0, cx, msec);
+    }
+    /* Last, as it marks the blocks used: a direct block, then a 1x */
+    time_row(PRED_MARK, 0, IN_ZERO, msec);
+    time_row(PRED_MARK, 1, IN_IND, msec);
+
+    blkio_close(mpart.io);
+    free(mr->dev);
+    mr->dev = MAP_FAILED;
+    cleanup(mr);
+    exit(0);
+}
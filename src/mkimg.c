@@ -0,0 +1,421 @@
+#define _XOPEN_SOURCE 700
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "bmp.h"
+#include "ext.h"
+
+/* Block numbers listed by an indirect */
+#define PER_IND     (BYTES_PER_BLOCK / sizeof(uint32_t))
+/* Pixels in a row of every BMP, 3 bytes each so rows need no padding */
+#define BMP_WIDTH   (1024)
+#define BMP_ROW     (BMP_WIDTH * 3)
+#define BMP_HEAD    (sizeof(struct bmp_head_s) + sizeof(struct dib_head_s))
+
+uint8_t *img = 0;
+uint32_t nblocks = 0;
+/* Blocks used by the filesystem or taken by a planted file, 1 bit each */
+uint8_t *taken = 0;
+/* Where the next file goes when they aren't fragmented */
+uint32_t cursor = 0;
+int fragment = 0;
+uint64_t rand_state = 1;
+FILE *manifest = 0;
+
+void usage () {
+    printf("Usage: ./bmp_undelete_mkimg [-s MiB] [-n files] [-l KiB,...] "
+        "[-f] [-z percent]\n           [-r seed] image manifest\n");
+    printf("  -s MiB      size of the image (default 512)\n");
+    printf("  -n files    deleted BMP files to plant (default 32)\n");
+    printf("  -l KiB,...  sizes of the files, used in turn (default "
+        "30,1024,6144: direct\n              blocks only, a 1x indirect, "
+        "a 2x indirect)\n");
+    printf("  -f          fragment the files\n");
+    printf("  -z percent  fill this share of the other free blocks with "
+        "random noise\n              (default 0)\n");
+    printf("  -r seed     seed of the random layout and contents "
+        "(default 1)\n");
+    printf("The manifest lists where every planted file and indirect is, "
+        "for\n./bmp_undelete_bench. Needs mke2fs.\n");
+}
+
+/*
+ * Next number of the generator (xorshift64*), the same seed always makes
+ * the same image
+ */
+uint32_t next_rand () {
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return (uint32_t)((rand_state *
+        (((uint64_t)0x2545F491 << 32) | 0x4F6CDD1D)) >> 32);
+}
+
+/*
+ * Fills a buffer with random bytes
+ */
+void fill_rand (uint8_t *buf, size_t len) {
+    uint32_t word;
+    size_t cx;
+
+    for (cx = 0; cx < len; cx += 4) {
+        word = next_rand();
+        memcpy(buf + cx, &word, (len - cx < 4) ? len - cx : 4);
+    }
+}
+
+/*
+ * Makes an empty ext2 filesystem of the given size with mke2fs
+ * Return 0 if success, -1 if fail
+ */
+int make_fs (const char *path, uint64_t bytes) {
+    pid_t pid;
+    int fd;
+    int st;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, bytes)) {
+        return -1;
+    }
+    close(fd);
+
+    pid = fork();
+    if (pid < 0) {
+        return -1;
+    } else if (pid == 0) {
+        execlp("mke2fs", "mke2fs", "-q", "-F", "-t", "ext2", "-b", "4096",
+            "-g", "32768", "-m", "0", path, (char*)0);
+        _exit(127);
+    }
+    if (waitpid(pid, &st, 0) < 0 || !WIFEXITED(st) || WEXITSTATUS(st)) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Marks the blocks the filesystem uses as taken, blocks past the last one
+ * included
+ * Return 0 if success, -1 if fail
+ */
+int load_bitmaps () {
+    struct gd_s *gd;
+    uint8_t *bmp;
+    uint32_t ngroups = (nblocks + BLOCKS_PER_GROUP - 1) / BLOCKS_PER_GROUP;
+    uint32_t group;
+
+    taken = calloc((size_t)ngroups * BLOCKS_PER_GROUP / 8, 1);
+    if (!taken) {
+        return -1;
+    }
+    for (group = 0; group < ngroups; group++) {
+        gd = (struct gd_s*)(img + GD_OFF(group));
+        bmp = img + BLOCK_OFF((uint64_t)gd->bg_block_bitmap_lo);
+        memcpy(taken + (size_t)group * BLOCKS_PER_GROUP / 8, bmp,
+            BLOCKS_PER_GROUP / 8);
+    }
+    return 0;
+}
+
+/*
+ * Marks blocks as taken
+ */
+void take (uint32_t block, uint32_t count) {
+    for (; count > 0; block++, count--) {
+        *(taken + block / 8) |= 1 << (block % 8);
+    }
+}
+
+/*
+ * Finds count free blocks in a row, looking from start on, then from the
+ * beginning
+ * Return the first of them, 0 if there are none
+ */
+uint32_t free_run (uint32_t start, uint32_t count) {
+    uint32_t block = start;
+    uint32_t run = 0;
+    int wrapped = 0;
+
+    for (;;) {
+        if (block >= nblocks) {
+            if (wrapped) {
+                return 0;
+            }
+            wrapped = 1;
+            block = 0;
+            run = 0;
+        }
+        if (wrapped && block >= start + count) {
+            return 0;
+        }
+        run = (BMP_BIT(taken, block)) ? 0 : run + 1;
+        block++;
+        if (run == count) {
+            return block - count;
+        }
+    }
+}
+
+/*
+ * Takes free blocks in a row for part of a file, next to the last part
+ * unless the files are fragmented
+ * Return the first block, 0 if the image is full
+ */
+uint32_t place (uint32_t count) {
+    uint32_t block;
+
+    block = free_run((fragment) ? next_rand() % nblocks : cursor, count);
+    if (block != 0) {
+        take(block, count);
+        cursor = block + count;
+    }
+    return block;
+}
+
+/*
+ * Writes an indirect listing the given blocks
+ * Return the indirect's block, 0 if the image is full
+ */
+uint32_t write_ind (const uint32_t *list, uint32_t count, uint32_t level) {
+    uint32_t block = place(1);
+
+    if (block != 0) {
+        memset(img + BLOCK_OFF((uint64_t)block), 0, BYTES_PER_BLOCK);
+        memcpy(img + BLOCK_OFF((uint64_t)block), list,
+            count * sizeof(*list));
+        fprintf(manifest, "ind %u %u\n", level, block);
+    }
+    return block;
+}
+
+/*
+ * Plants a deleted BMP file of about the given size
+ * Its blocks are split into runs that only break where the recovery can
+ * follow them: after the first 12 blocks and the first set of 4 of the
+ * 1x indirect, on sets of 4 and never where an indirect starts
+ * Return the number of indirect levels it needs, -1 if fail
+ */
+int plant (uint32_t kib) {
+    struct bmp_head_s head;
+    struct dib_head_s dib;
+    uint32_t height = ((uint64_t)kib * 1024 - BMP_HEAD + BMP_ROW - 1) /
+        BMP_ROW;
+    uint32_t size = BMP_HEAD + height * BMP_ROW;
+    uint32_t count = (size + BYTES_PER_BLOCK - 1) / BYTES_PER_BLOCK;
+    uint32_t *list;
+    uint32_t ind1 [PER_IND];
+    uint32_t n_ind1;
+    uint32_t first;
+    uint32_t len;
+    uint32_t cx;
+    uint32_t cx2;
+    uint8_t *blk;
+
+    list = malloc(count * sizeof(*list));
+    if (!list) {
+        return -1;
+    }
+
+    /* Lay out the data blocks */
+    for (cx = 0; cx < count; cx += len) {
+        if (!fragment) {
+            len = count - cx;
+        } else if (cx == 0) {
+            len = 16 + 4 * (next_rand() % 16);
+        } else {
+            len = 4 * (1 + next_rand() % 64);
+        }
+        if (cx + len < count && (cx + len) % PER_IND == 12) {
+            len += 4;
+        }
+        len = (cx + len < count) ? len : count - cx;
+        first = place(len);
+        if (first == 0) {
+            free(list);
+            return -1;
+        }
+        if (cx == 0) {
+            fprintf(manifest, "bmp %u %u\n", first, size);
+        }
+        fprintf(manifest, "ext %u %u\n", first, len);
+        for (cx2 = 0; cx2 < len; cx2++) {
+            *(list + cx + cx2) = first + cx2;
+        }
+    }
+
+    /* Fill them in, the header goes on the first */
+    for (cx = 0; cx < count; cx++) {
+        blk = img + BLOCK_OFF((uint64_t)*(list + cx));
+        fill_rand(blk, BYTES_PER_BLOCK);
+        if ((cx + 1) * BYTES_PER_BLOCK > size) {
+            memset(blk + size % BYTES_PER_BLOCK, 0,
+                BYTES_PER_BLOCK - size % BYTES_PER_BLOCK);
+        }
+    }
+    memset(&head, 0, sizeof(head));
+    memcpy(head.bmp_magic, BMP_MAGIC, sizeof(head.bmp_magic));
+    head.bmp_file_size = size;
+    head.bmp_pixel_off = BMP_HEAD;
+    memset(&dib, 0, sizeof(dib));
+    dib.dib_size = sizeof(dib);
+    dib.dib_width = BMP_WIDTH;
+    dib.dib_height = height;
+    dib.dib_planes = 1;
+    dib.dib_bpp = 24;
+    dib.dib_image_size = height * BMP_ROW;
+    memcpy(img + BLOCK_OFF((uint64_t)*list), &head, sizeof(head));
+    memcpy(img + BLOCK_OFF((uint64_t)*list) + sizeof(head), &dib,
+        sizeof(dib));
+
+    /* Then the indirects, the 2x lists every 1x but the first */
+    n_ind1 = (count > 12) ? (count - 12 + PER_IND - 1) / PER_IND : 0;
+    for (cx = 0; cx < n_ind1; cx++) {
+        len = count - 12 - cx * PER_IND;
+        *(ind1 + cx) = write_ind(list + 12 + cx * PER_IND,
+            (len < PER_IND) ? len : PER_IND, 1);
+        if (*(ind1 + cx) == 0) {
+            free(list);
+            return -1;
+        }
+    }
+    if (n_ind1 > 1 && write_ind(ind1 + 1, n_ind1 - 1, 2) == 0) {
+        free(list);
+        return -1;
+    }
+
+    free(list);
+    return (n_ind1 > 1) ? 2 : (n_ind1 > 0) ? 1 : 0;
+}
+
+int main (int argc, char **argv) {
+    const char *sizes = "30,1024,6144";
+    const char *next;
+    uint32_t *kib = 0;
+    uint32_t n_sizes = 0;
+    uint64_t mib = 512;
+    uint32_t files = 32;
+    uint32_t noise = 0;
+    uint32_t levels [3] = { 0, 0, 0 };
+    uint32_t n_noise = 0;
+    uint32_t cx;
+    struct stat st;
+    int opt;
+    int fd;
+    int ret;
+
+    /* Parse the options */
+    while ((opt = getopt(argc, argv, "s:n:l:fz:r:")) != -1) {
+        switch (opt) {
+        case 's':
+            mib = strtoul(optarg, 0, 10);
+            break;
+        case 'n':
+            files = strtoul(optarg, 0, 10);
+            break;
+        case 'l':
+            sizes = optarg;
+            break;
+        case 'f':
+            fragment = 1;
+            break;
+        case 'z':
+            noise = strtoul(optarg, 0, 10);
+            break;
+        case 'r':
+            rand_state = strtoul(optarg, 0, 10);
+            break;
+        default:
+            usage();
+            exit(-1);
+        }
+    }
+    if (argc - optind != 2 || mib < 16 || noise > 100 || rand_state == 0) {
+        usage();
+        exit(-1);
+    }
+
+    /* Every size has to fit the 32 bit size field of a BMP */
+    kib = calloc(strlen(sizes) / 2 + 1, sizeof(*kib));
+    if (!kib) {
+        exit(-1);
+    }
+    for (next = sizes; *next; n_sizes++) {
+        *(kib + n_sizes) = strtoul(next, (char**)&next, 10);
+        if (*(kib + n_sizes) == 0 ||
+            *(kib + n_sizes) >= 4 * 1024 * 1024 || (*next && *next != ',')) {
+            usage();
+            exit(-1);
+        }
+        next += (*next == ',') ? 1 : 0;
+    }
+    if (n_sizes == 0) {
+        usage();
+        exit(-1);
+    }
+
+    /* Make the filesystem, then map it */
+    if (make_fs(*(argv + optind), mib * 1024 * 1024)) {
+        fprintf(stderr, "Unable to make the filesystem: %s\n",
+            *(argv + optind));
+        exit(-1);
+    }
+    fd = open(*(argv + optind), O_RDWR);
+    if (fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "Unable to open: %s\n", *(argv + optind));
+        exit(-1);
+    }
+    img = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (img == MAP_FAILED) {
+        fprintf(stderr, "Unable to mmap: %s\n", *(argv + optind));
+        exit(-1);
+    }
+    nblocks = ((struct sb_s*)(img + SB_OFF))->s_blocks_count_lo;
+    manifest = fopen(*(argv + optind + 1), "w");
+    if (!manifest || load_bitmaps()) {
+        fprintf(stderr, "Unable to start the manifest: %s\n",
+            *(argv + optind + 1));
+        exit(-1);
+    }
+
+    /* Plant the files, then scatter the noise over what is left */
+    for (cx = 0; cx < files; cx++) {
+        ret = plant(*(kib + cx % n_sizes));
+        if (ret < 0) {
+            fprintf(stderr, "The image is full after %u files\n", cx);
+            exit(-1);
+        }
+        (*(levels + ret))++;
+    }
+    for (cx = 0; noise > 0 && cx < nblocks; cx++) {
+        if (!BMP_BIT(taken, cx) && next_rand() % 100 < noise) {
+            fill_rand(img + BLOCK_OFF((uint64_t)cx), BYTES_PER_BLOCK);
+            n_noise++;
+        }
+    }
+
+    ret = (fclose(manifest) == 0 &&
+        msync(img, st.st_size, MS_SYNC) == 0) ? 0 : -1;
+    munmap(img, st.st_size);
+    close(fd);
+    free(taken);
+    free(kib);
+    if (ret) {
+        fprintf(stderr, "Unable to write the image or the manifest\n");
+        exit(-1);
+    }
+
+    printf("Planted %u files: %u with direct blocks only, %u with a 1x "
+        "indirect,\n%u with a 2x indirect, over %u noise blocks\n",
+        files, *levels, *(levels + 1), *(levels + 2), n_noise);
+    exit(0);
+}
@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/ioprio.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "pace.h"
+
+#define PACE_NSEC_PER_SEC   (1000000000UL)
+
+/* Unused time the bucket carries over, lets a few reads go back to back */
+#define PACE_BURST_NSEC     (100 * 1000 * 1000)
+
+/* Least time between changes to the share of the caps */
+#define PACE_ADJUST_NSEC    (100 * 1000 * 1000)
+
+/* Least latency taken as normal for a drive */
+#define PACE_LAT_MIN        (50 * 1000)
+
+/*
+ * What is normal for the drive closes this part of the gap to the smoothed
+ * latency at every change, a drive that stays busy is taken as it is
+ * after a few seconds
+ */
+#define PACE_LAT_DRIFT      (32)
+
+/* Least share of the caps the latency can back off to */
+#define PACE_SCALE_MIN      (PACE_SCALE / 16)
+
+/* CPU niceness of an idle thread */
+#define PACE_NICE           (19)
+
+/*
+ * Private method
+ * Reads the monotonic clock in nanoseconds
+ */
+uint64_t pace_clock () {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * PACE_NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Public method
+ * Sets up a pace with no caps
+ */
+void pace_init (struct pace_s *p) {
+    pthread_mutex_init(&p->lock, 0);
+    pace_set(p, 0, 0);
+}
+
+/*
+ * Public method
+ * Frees the pace's lock
+ */
+void pace_free (struct pace_s *p) {
+    pthread_mutex_destroy(&p->lock);
+}
+
+/*
+ * Public method
+ * Sets the caps, the bucket starts full and the latency is learned again
+ */
+void pace_set (struct pace_s *p, uint32_t mib_per_s, uint32_t iops) {
+    pthread_mutex_lock(&p->lock);
+    p->bytes_per_sec = (uint64_t)mib_per_s << 20;
+    p->iops = iops;
+    p->tat = 0;
+    p->scale = PACE_SCALE;
+    p->lat_avg = 0;
+    p->lat_base = 0;
+    p->adjusted = 0;
+    p->bytes = 0;
+    p->ops = 0;
+    pthread_mutex_unlock(&p->lock);
+}
+
+/*
+ * Public method
+ * Whether any cap is set
+ */
+int pace_on (const struct pace_s *p) {
+    return p->bytes_per_sec > 0 || p->iops > 0;
+}
+
+/*
+ * Public method
+ * Waits until a read of the given size may go
+ * Takes the read's cost out of the bucket, then sleeps off whatever it
+ * overdrew past the burst, outside the lock
+ */
+uint64_t pace_start (struct pace_s *p, uint64_t bytes) {
+    struct timespec until;
+    uint64_t now;
+    uint64_t cost = 0;
+    uint64_t wake;
+
+    pthread_mutex_lock(&p->lock);
+    now = pace_clock();
+    if (p->bytes_per_sec > 0) {
+        cost = bytes * PACE_NSEC_PER_SEC / p->bytes_per_sec;
+    }
+    if (p->iops > 0 && PACE_NSEC_PER_SEC / p->iops > cost) {
+        cost = PACE_NSEC_PER_SEC / p->iops;
+    }
+    cost = cost * PACE_SCALE / p->scale;
+    p->tat = ((p->tat > now) ? p->tat : now) + cost;
+    wake = p->tat;
+    p->bytes += bytes;
+    p->ops++;
+    pthread_mutex_unlock(&p->lock);
+
+    if (wake > now + PACE_BURST_NSEC) {
+        wake -= PACE_BURST_NSEC;
+        until.tv_sec = wake / PACE_NSEC_PER_SEC;
+        until.tv_nsec = wake % PACE_NSEC_PER_SEC;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, 0) ==
+            EINTR) {
+            /* Woken by a signal, the deadline still stands */
+        }
+        now = pace_clock();
+    }
+
+    return now;
+}
+
+/*
+ * Public method
+ * Tells the pace a read has finished
+ * Backs the caps off by a quarter while the smoothed latency is over
+ * twice what is normal for the drive, and gives back a sixteenth at a
+ * time once it is within half of it again
+ */
+void pace_done (struct pace_s *p, uint64_t started) {
+    uint64_t now = pace_clock();
+    uint64_t lat = now - started;
+
+    pthread_mutex_lock(&p->lock);
+    p->lat_avg = (p->lat_avg > 0) ? (p->lat_avg * 7 + lat) / 8 : lat;
+    if (p->lat_base == 0) {
+        p->lat_base = p->lat_avg;
+    }
+    if (now - p->adjusted >= PACE_ADJUST_NSEC) {
+        /* What is normal for the drive follows the latency, only slowly */
+        if (p->lat_avg > p->lat_base) {
+            p->lat_base += (p->lat_avg - p->lat_base) / PACE_LAT_DRIFT;
+        } else {
+            p->lat_base -= (p->lat_base - p->lat_avg) / PACE_LAT_DRIFT;
+        }
+        p->lat_base = (p->lat_base > PACE_LAT_MIN) ?
+            p->lat_base : PACE_LAT_MIN;
+        if (p->lat_avg > p->lat_base * 2) {
+            p->scale = (p->scale * 3 / 4 > PACE_SCALE_MIN) ?
+                p->scale * 3 / 4 : PACE_SCALE_MIN;
+        } else if (p->lat_avg * 2 < p->lat_base * 3) {
+            p->scale = (p->scale + PACE_SCALE / 16 < PACE_SCALE) ?
+                p->scale + PACE_SCALE / 16 : PACE_SCALE;
+        }
+        p->adjusted = now;
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+/*
+ * Public method
+ * Gets the reads let through so far and the share of the caps allowed
+ */
+void pace_snap (struct pace_s *p, uint64_t *bytes, uint64_t *ops,
+    uint32_t *scale) {
+    pthread_mutex_lock(&p->lock);
+    *bytes = p->bytes;
+    *ops = p->ops;
+    *scale = p->scale;
+    pthread_mutex_unlock(&p->lock);
+}
+
+/*
+ * Public method
+ * Moves the calling thread to the idle I/O class and the lowest CPU
+ * priority
+ * Linux keeps both per thread, so the rest of the process is left alone
+ * The idle class only counts with schedulers that know it (BFQ and
+ * mq-deadline), failures are ignored, the scan runs regardless
+ */
+void pace_idle (struct pace_prio_s *saved) {
+    saved->ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+    errno = 0;
+    saved->nice = getpriority(PRIO_PROCESS, 0);
+    if (errno) {
+        saved->nice = 0;
+    }
+
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+        IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0));
+    setpriority(PRIO_PROCESS, 0, PACE_NICE);
+}
+
+/*
+ * Public method
+ * Puts back the saved priorities
+ * Raising the CPU priority back needs CAP_SYS_NICE, which the recovery
+ * already runs with
+ */
+void pace_restore (const struct pace_prio_s *saved) {
+    if (saved->ioprio >= 0) {
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, saved->ioprio);
+    }
+    setpriority(PRIO_PROCESS, 0, saved->nice);
+}
+
+/*
+ * Public method
+ * Caps from a "MiB/s[,IOPS]" string, either can be left empty
+ */
+int pace_parse (const char *str, uint32_t *mib_per_s, uint32_t *iops) {
+    char *end;
+    unsigned long mib = 0;
+    unsigned long ops = 0;
+
+    if (*str != ',') {
+        mib = strtoul(str, &end, 10);
+        if (end == str) {
+            return -1;
+        }
+        str = end;
+    }
+    if (*str == ',') {
+        ops = strtoul(str + 1, &end, 10);
+        if (end == str + 1) {
+            return -1;
+        }
+        str = end;
+    }
+    if (*str || mib > 0xFFFFFFFFUL || ops > 0xFFFFFFFFUL ||
+        (mib == 0 && ops == 0)) {
+        return -1;
+    }
+
+    *mib_per_s = (uint32_t)mib;
+    *iops = (uint32_t)ops;
+    return 0;
+}
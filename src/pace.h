@@ -0,0 +1,85 @@
+#ifndef PACE_H_20261017_021407
+#define PACE_H_20261017_021407
+
+#include <pthread.h>
+#include <stdint.h>
+
+/* Share of the caps a full speed throttled scan gets */
+#define PACE_SCALE      (1024)
+
+/*
+ * Token bucket shared by the scan workers, holding their reads to a byte
+ * rate and a request rate
+ * Each read costs the longer of its share of the two, up to a short burst
+ * of unused time carries over
+ * When reads start taking longer than they did, the caps are backed off,
+ * and creep back up once the reads settle
+ */
+struct pace_s {
+    /* Caps, zero for none */
+    uint64_t bytes_per_sec;
+    uint32_t iops;
+    pthread_mutex_t lock;
+    /* When the bucket runs dry at the current pace, in nanoseconds */
+    uint64_t tat;
+    /* Share of the caps allowed for now, out of PACE_SCALE */
+    uint32_t scale;
+    /* Read latency, smoothed, and what is normal for the drive */
+    uint64_t lat_avg;
+    uint64_t lat_base;
+    uint64_t adjusted;
+    /* Reads let through so far */
+    uint64_t bytes;
+    uint64_t ops;
+};
+
+/* What a thread was running at before pace_idle() */
+struct pace_prio_s {
+    int ioprio;
+    int nice;
+};
+
+void pace_init (struct pace_s *p);
+void pace_free (struct pace_s *p);
+
+/*
+ * Sets the caps in MiB/s and reads per second, zero for no cap
+ * Both zero turns the pace off
+ */
+void pace_set (struct pace_s *p, uint32_t mib_per_s, uint32_t iops);
+
+/* Whether any cap is set */
+int pace_on (const struct pace_s *p);
+
+/*
+ * Waits until a read of the given size may go, safe from any thread
+ * Returns when it went, for pace_done()
+ */
+uint64_t pace_start (struct pace_s *p, uint64_t bytes);
+
+/* Tells the pace a read that went at the given time has finished */
+void pace_done (struct pace_s *p, uint64_t started);
+
+/*
+ * Gets the reads let through so far, and the share of the caps allowed
+ * for now out of PACE_SCALE
+ */
+void pace_snap (struct pace_s *p, uint64_t *bytes, uint64_t *ops,
+    uint32_t *scale);
+
+/*
+ * Moves the calling thread to the idle I/O class and the lowest CPU
+ * priority, saving what it had
+ */
+void pace_idle (struct pace_prio_s *saved);
+
+/* Puts back the priorities saved by pace_idle() */
+void pace_restore (const struct pace_prio_s *saved);
+
+/*
+ * Caps from a "MiB/s[,IOPS]" string
+ * Returns 0 if success, -1 if malformed or no cap is set
+ */
+int pace_parse (const char *str, uint32_t *mib_per_s, uint32_t *iops);
+
+#endif /* PACE_H_20261017_021407 */
@@ -0,0 +1,293 @@
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+
+#include "perf.h"
+
+/* Names of the counters and phases, as exported */
+const char *perf_count_names [] = {
+    "blocks_examined",  "blocks_skipped_used",
+    "cmp_ind_1x",       "cmp_ind_2x",       "cmp_ind_3x",
+    "found_bmp",        "found_ind_1x",     "found_ind_2x",
+    "found_ind_3x",
+    "bytes_read",       "files_recovered",
+    "find_next_ind_calls",  "blocks_marked_used"
+};
+const char *perf_count_help [] = {
+    "Blocks the scan read in and tested",
+    "Blocks the scan skipped because they are marked used",
+    "Indirect tests for a 1x indirect",
+    "Indirect tests for a 2x indirect",
+    "Indirect tests for a 3x indirect",
+    "BMP header candidates found",
+    "1x indirect candidates found",
+    "2x indirect candidates found",
+    "3x indirect candidates found",
+    "Bytes the scan read from the drive",
+    "Files recovered",
+    "Calls to find_next_ind, one per indirect level looked up",
+    "Blocks marked used, indirects and the blocks they list"
+};
+const char *perf_phase_names [] = {
+    "init",             "get_group_info",   "scan_journal",
+    "scan_inodes",      "estimate",         "scan",
+    "collect"
+};
+
+#define NSEC_PER_SEC    (1000000000UL)
+
+/*
+ * Private method
+ * Reads a clock in nanoseconds
+ */
+uint64_t perf_clock (clockid_t id) {
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Private method
+ * Gets the major page faults of the process so far
+ */
+uint64_t perf_faults () {
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru)) {
+        return 0;
+    }
+    return ru.ru_majflt;
+}
+
+/*
+ * Private method
+ * Writes a string with the quotes, backslashes and newlines escaped, as
+ * both JSON and Prometheus labels take them
+ */
+void put_escaped (FILE *f, const char *s) {
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', f);
+            fputc(*s, f);
+        } else if (*s == '\n') {
+            fputs("\\n", f);
+        } else {
+            fputc(*s, f);
+        }
+    }
+}
+
+/*
+ * Public method
+ * Adds to a counter, workers only need the sum so no ordering is needed
+ */
+void perf_add (struct perf_s *p, enum perf_count_e c, uint64_t n) {
+    __atomic_fetch_add(p->counts + c, n, __ATOMIC_RELAXED);
+}
+
+/*
+ * Public method
+ * Starts timing a phase, unless it is already running further up
+ */
+void perf_begin (struct perf_s *p, enum perf_phase_e ph) {
+    struct perf_phase_s *cur = p->phases + ph;
+
+    if (cur->depth > 0) {
+        __atomic_store_n(&cur->depth, cur->depth + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_store_n(&cur->wall_start, perf_clock(CLOCK_MONOTONIC),
+        __ATOMIC_RELAXED);
+    __atomic_store_n(&cur->cpu_start, perf_clock(CLOCK_PROCESS_CPUTIME_ID),
+        __ATOMIC_RELAXED);
+    __atomic_store_n(&cur->faults_start, perf_faults(), __ATOMIC_RELAXED);
+    /* Readers only look at the starts once they see the depth */
+    __atomic_store_n(&cur->depth, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Public method
+ * Stops timing a phase once its outermost call ends
+ * The phase stops counting as running before its totals go up, so a
+ * snapshot taken meanwhile can fall short but never counts it twice
+ */
+void perf_end (struct perf_s *p, enum perf_phase_e ph) {
+    struct perf_phase_s *cur = p->phases + ph;
+    uint64_t wall;
+    uint64_t cpu;
+    uint64_t faults;
+
+    if (cur->depth == 0) {
+        return;
+    } else if (cur->depth > 1) {
+        __atomic_store_n(&cur->depth, cur->depth - 1, __ATOMIC_RELAXED);
+        return;
+    }
+    wall = perf_clock(CLOCK_MONOTONIC);
+    cpu = perf_clock(CLOCK_PROCESS_CPUTIME_ID);
+    faults = perf_faults();
+    __atomic_store_n(&cur->depth, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&cur->calls, cur->calls + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&cur->wall, cur->wall + wall - cur->wall_start,
+        __ATOMIC_RELAXED);
+    __atomic_store_n(&cur->cpu, cur->cpu + cpu - cur->cpu_start,
+        __ATOMIC_RELAXED);
+    __atomic_store_n(&cur->faults, cur->faults + faults - cur->faults_start,
+        __ATOMIC_RELAXED);
+}
+
+/*
+ * Public method
+ * Copies every counter and phase, adding what running phases took so far
+ */
+void perf_snap (const struct perf_s *p, struct perf_s *out) {
+    const struct perf_phase_s *cur;
+    struct perf_phase_s *snap;
+    uint32_t cx;
+
+    memset(out, 0, sizeof(*out));
+    for (cx = 0; cx < PERF_NCOUNTS; cx++) {
+        *(out->counts + cx) = __atomic_load_n(p->counts + cx,
+            __ATOMIC_RELAXED);
+    }
+    for (cx = 0; cx < PERF_NPHASES; cx++) {
+        cur = p->phases + cx;
+        snap = out->phases + cx;
+        snap->calls = __atomic_load_n(&cur->calls, __ATOMIC_RELAXED);
+        snap->wall = __atomic_load_n(&cur->wall, __ATOMIC_RELAXED);
+        snap->cpu = __atomic_load_n(&cur->cpu, __ATOMIC_RELAXED);
+        snap->faults = __atomic_load_n(&cur->faults, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&cur->depth, __ATOMIC_ACQUIRE) > 0) {
+            snap->calls++;
+            snap->wall += perf_clock(CLOCK_MONOTONIC) -
+                __atomic_load_n(&cur->wall_start, __ATOMIC_RELAXED);
+            snap->cpu += perf_clock(CLOCK_PROCESS_CPUTIME_ID) -
+                __atomic_load_n(&cur->cpu_start, __ATOMIC_RELAXED);
+            snap->faults += perf_faults() -
+                __atomic_load_n(&cur->faults_start, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/*
+ * Public method
+ * Writes the snapshot of the counters and phases as a JSON object
+ * Times are in seconds
+ */
+int perf_json (const struct perf_s *p, const char *target, FILE *f,
+    int indent) {
+    struct perf_s snap;
+    const struct perf_phase_s *ph;
+    uint32_t cx;
+
+    perf_snap(p, &snap);
+    fprintf(f, "%*s{\n%*s\"target\": \"", indent, "", indent + 2, "");
+    put_escaped(f, target);
+    fprintf(f, "\",\n%*s\"counters\": {\n", indent + 2, "");
+    for (cx = 0; cx < PERF_NCOUNTS; cx++) {
+        fprintf(f, "%*s\"%s\": %lu%s\n", indent + 4, "",
+            *(perf_count_names + cx), (unsigned long)*(snap.counts + cx),
+            (cx + 1 < PERF_NCOUNTS) ? "," : "");
+    }
+    fprintf(f, "%*s},\n%*s\"phases\": {\n", indent + 2, "", indent + 2, "");
+    for (cx = 0; cx < PERF_NPHASES; cx++) {
+        ph = snap.phases + cx;
+        fprintf(f, "%*s\"%s\": { \"calls\": %lu, "
+            "\"wall_seconds\": %lu.%09lu, \"cpu_seconds\": %lu.%09lu, "
+            "\"major_faults\": %lu }%s\n", indent + 4, "",
+            *(perf_phase_names + cx), (unsigned long)ph->calls,
+            (unsigned long)(ph->wall / NSEC_PER_SEC),
+            (unsigned long)(ph->wall % NSEC_PER_SEC),
+            (unsigned long)(ph->cpu / NSEC_PER_SEC),
+            (unsigned long)(ph->cpu % NSEC_PER_SEC),
+            (unsigned long)ph->faults, (cx + 1 < PERF_NPHASES) ? "," : "");
+    }
+    fprintf(f, "%*s}\n%*s}", indent + 2, "", indent, "");
+
+    return (ferror(f)) ? -1 : 0;
+}
+
+/*
+ * Public method
+ * Rewrites the Prometheus text file, every sample is labelled with the
+ * target so several runs can be scraped side by side
+ */
+int perf_prom (const struct perf_s *p, const char *target, const char *path) {
+    const char *names [] = {
+        "calls_total", "wall_seconds_total", "cpu_seconds_total",
+        "major_faults_total"
+    };
+    const char *help [] = {
+        "Times the phase ran",
+        "Wall clock time spent in the phase",
+        "CPU time of the process during the phase",
+        "Major page faults of the process during the phase"
+    };
+    struct perf_s snap;
+    const struct perf_phase_s *ph;
+    uint64_t value;
+    uint32_t cx;
+    uint32_t cx2;
+    char *tmp;
+    FILE *f;
+    int ok;
+
+    tmp = calloc(strlen(path) + 5, sizeof(*tmp));
+    if (!tmp) {
+        return -1;
+    }
+    sprintf(tmp, "%s.tmp", path);
+    f = fopen(tmp, "w");
+    if (!f) {
+        free(tmp);
+        return -1;
+    }
+
+    perf_snap(p, &snap);
+    for (cx = 0; cx < PERF_NCOUNTS; cx++) {
+        fprintf(f, "# HELP bmp_undelete_%s_total %s\n"
+            "# TYPE bmp_undelete_%s_total counter\n"
+            "bmp_undelete_%s_total{target=\"", *(perf_count_names + cx),
+            *(perf_count_help + cx), *(perf_count_names + cx),
+            *(perf_count_names + cx));
+        put_escaped(f, target);
+        fprintf(f, "\"} %lu\n", (unsigned long)*(snap.counts + cx));
+    }
+    for (cx2 = 0; cx2 < 4; cx2++) {
+        fprintf(f, "# HELP bmp_undelete_phase_%s %s\n"
+            "# TYPE bmp_undelete_phase_%s counter\n", *(names + cx2),
+            *(help + cx2), *(names + cx2));
+        for (cx = 0; cx < PERF_NPHASES; cx++) {
+            ph = snap.phases + cx;
+            fprintf(f, "bmp_undelete_phase_%s{target=\"", *(names + cx2));
+            put_escaped(f, target);
+            fprintf(f, "\",phase=\"%s\"} ", *(perf_phase_names + cx));
+            if (cx2 == 0 || cx2 == 3) {
+                value = (cx2 == 0) ? ph->calls : ph->faults;
+                fprintf(f, "%lu\n", (unsigned long)value);
+            } else {
+                value = (cx2 == 1) ? ph->wall : ph->cpu;
+                fprintf(f, "%lu.%09lu\n",
+                    (unsigned long)(value / NSEC_PER_SEC),
+                    (unsigned long)(value % NSEC_PER_SEC));
+            }
+        }
+    }
+
+    ok = !ferror(f);
+    ok = (fclose(f) == 0) && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) {
+        unlink(tmp);
+    }
+    free(tmp);
+
+    return (ok) ? 0 : -1;
+}
@@ -0,0 +1,92 @@
+#ifndef PERF_H_20261017_003512
+#define PERF_H_20261017_003512
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Counters kept by a recovery
+ *
+ * PERF_BLOCKS_SEEN     blocks the scan read in and tested
+ * PERF_BLOCKS_USED     blocks the scan skipped because they are used
+ * PERF_CMP_IND1..3     indirect tests, by the level tested for, of the
+ *                      scanned blocks and of the blocks they list
+ * PERF_FOUND_BMP       BMP header candidates found
+ * PERF_FOUND_IND1..3   indirect candidates found, by level
+ * PERF_BYTES_READ      bytes the scan read from the drive
+ * PERF_FILES           files recovered
+ * PERF_FIND_IND        find_next_ind() calls, one per level looked up
+ * PERF_MARK_USED       blocks marked used, indirects and what they list
+ */
+enum perf_count_e {
+    PERF_BLOCKS_SEEN,   PERF_BLOCKS_USED,
+    PERF_CMP_IND1,      PERF_CMP_IND2,      PERF_CMP_IND3,
+    PERF_FOUND_BMP,     PERF_FOUND_IND1,    PERF_FOUND_IND2,
+    PERF_FOUND_IND3,
+    PERF_BYTES_READ,    PERF_FILES,
+    PERF_FIND_IND,      PERF_MARK_USED,
+    PERF_NCOUNTS
+};
+
+/* Timed steps of a recovery, a step can run inside another */
+enum perf_phase_e {
+    PERF_INIT,          PERF_GROUP_INFO,    PERF_JOURNAL,
+    PERF_ITABLE,        PERF_ESTIMATE,      PERF_SCAN,
+    PERF_COLLECT,
+    PERF_NPHASES
+};
+
+/*
+ * Times are in nanoseconds, CPU time and major faults are for the whole
+ * process, so they include the scan workers
+ * Recursive calls only count the outermost one
+ */
+struct perf_phase_s {
+    uint64_t calls;
+    uint64_t wall;
+    uint64_t cpu;
+    uint64_t faults;
+    /* Where the outermost running call started, depth 0 if none is */
+    uint32_t depth;
+    uint64_t wall_start;
+    uint64_t cpu_start;
+    uint64_t faults_start;
+};
+
+/*
+ * Counters can be added to from any thread, phases are only timed by the
+ * thread driving the recovery
+ * Both can be read from any thread through perf_snap()
+ */
+struct perf_s {
+    uint64_t counts [PERF_NCOUNTS];
+    struct perf_phase_s phases [PERF_NPHASES];
+};
+
+/* Adds to a counter, safe from any thread */
+void perf_add (struct perf_s *p, enum perf_count_e c, uint64_t n);
+
+void perf_begin (struct perf_s *p, enum perf_phase_e ph);
+void perf_end (struct perf_s *p, enum perf_phase_e ph);
+
+/*
+ * Copies the counters and phases, phases still running are counted up to
+ * now
+ */
+void perf_snap (const struct perf_s *p, struct perf_s *out);
+
+/*
+ * Writes a snapshot as a JSON object, indented by the given spaces
+ * Returns 0 if success, -1 if fail
+ */
+int perf_json (const struct perf_s *p, const char *target, FILE *f,
+    int indent);
+
+/*
+ * Rewrites the Prometheus text file at path with a snapshot
+ * Written to a temporary file first so scrapes never see a torn one
+ * Returns 0 if success, -1 if fail
+ */
+int perf_prom (const struct perf_s *p, const char *target, const char *path);
+
+#endif /* PERF_H_20261017_003512 */
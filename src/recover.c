@@ -1,117 +1,307 @@
+#define _XOPEN_SOURCE 700
+
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <linux/fs.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
+#include "blkio.h"
 #include "bmp.h"
+#include "cand.h"
 #include "ext.h"
+#include "jnl.h"
+#include "pace.h"
+#include "perf.h"
 #include "recover.h"
+#include "recover_int.h"
+#include "ring.h"
+#include "simd.h"
+#include "txn.h"
+
+/* The block predicate kernels are picked once for every recovery */
+pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+
+/* Checkpoint file header, followed by the candidate lists */
+#define CKPT_MAGIC  "BMPCKPT1"
+struct ckpt_head_s {
+    char magic [8];
+    uint8_t uuid [16];
+    uint32_t nblocks;
+    /* Every block before this has been scanned */
+    uint32_t next;
+    /* BMP headers, then 1x, 2x, 3x indirects */
+    uint32_t counts [4];
+};
 
-int devf = -1;
-size_t dev_size;
-uint8_t *dev = MAP_FAILED;
-uint32_t nblocks;
-uint32_t ngroups;
-struct sb_s *sb = 0;
-size_t ipg;
-size_t ipb;
-struct gd_s **gd = 0;
-uint8_t **block_bmps = 0;
-uint8_t **inode_bmps = 0;
-uint32_t *bmp_starts = 0;
-size_t n_bmp_starts = 0;
-uint32_t *indirects [3] = {
-    0, 0, 0
+/*
+ * What the 1x and 2x indirect tests made of each block, 2 bits per block
+ * IND_VALID_1X and IND_VALID_2X say nothing about the other test,
+ * IND_INVALID means both failed
+ */
+#define IND_UNKNOWN     (0)
+#define IND_VALID_1X    (1)
+#define IND_VALID_2X    (2)
+#define IND_INVALID     (3)
+
+/* What the scan made of a block, the indirects by their level */
+enum blk_class_e {
+    BLK_NONE, BLK_IND1, BLK_IND2, BLK_IND3, BLK_BMP
 };
-size_t n_indirects [3] = {
-    0, 0, 0
+
+/* Most events handed to status() at a time, and the pause between */
+#define REPORT_BATCH    (256)
+#define REPORT_NSEC     (10 * 1000 * 1000)
+
+/* Seconds between rewrites of the metrics file during a scan */
+#define METRICS_SEC     (1)
+
+/* Pause between looks at the page cache during a scan */
+#define CACHE_NSEC      (100 * 1000 * 1000)
+
+/* Seconds between reports of a throttled scan's rate */
+#define PACE_SEC        (5)
+
+/*
+ * A forecast samples runs of this many blocks, read in one request each,
+ * and no fewer runs than this, candidates come in clusters
+ */
+#define SAMPLE_BLOCKS   (BLKIO_WINDOW)
+#define SAMPLE_RUNS     (64)
+
+/*
+ * A cache neutral scan drops what it read in aligned spans of this many
+ * blocks, the page cache holds files in folios of up to 2 MiB and only
+ * lets go of whole ones
+ */
+#define DROP_BLOCKS     (2048)
+
+/* Patch file header, followed by the changed blocks */
+#define PATCH_MAGIC "BMPPATCH"
+struct patch_head_s {
+    char magic [8];
+    uint8_t uuid [16];
+    uint32_t nblocks;
+    uint32_t count;
 };
-struct inode_s *i = 0;
-uint32_t n_rec = 0;
-char target_name [100];
-
-/* Can be used by the client to access filesystem info */
-struct fs_info_s fs_info = {
-    (char*)0,
-    &nblocks,
-    &ngroups,
-    &ipg,
-    &ipb
+
+/*
+ * The groups of a round worth scanning, in block order
+ * Workers take them in the planned order, most free blocks first
+ */
+struct scan_plan_s {
+    struct recover_s *r;
+    struct scan_part_s *parts;
+    uint64_t *order;
+    uint32_t count;
+    uint32_t next;
 };
 
 /* 
- * Private method
- * Cleanup tasks run on program exit
+ * Public method
+ * Closes the drive and frees the recovery, changes not yet committed are
+ * dropped
  */
-void cleanup () {
+void cleanup (struct recover_s *r) {
     uint32_t cx;
 
-    status(CLEANUP);
+    if (!r) {
+        return;
+    }
+    status(r, CLEANUP);
 
     for (cx = 0; cx < 3; cx++) {
-        if ((indirects + cx)) {
-            free(*(indirects + cx));
-        }
+        cand_free(r->indirects + cx);
+        cand_map_free(r->ind_maps + cx);
     }
-    if (bmp_starts) {
-        free(bmp_starts);
+    cand_free(&r->bmp_starts);
+    cand_free(&r->pending);
+    /* Changes not yet committed are dropped */
+    txn_free(&r->txn);
+    jnl_free(&r->jnl);
+    if (r->ind_memo) {
+        free(r->ind_memo);
     }
-    if (inode_bmps) {
-        free(inode_bmps);
+    if (r->ckpt_path) {
+        free(r->ckpt_path);
     }
-    if (block_bmps) {
-        free(block_bmps);
+    if (r->patch_path) {
+        free(r->patch_path);
     }
-    if (gd) {
-        free(gd);
+    if (r->prom_path) {
+        free(r->prom_path);
     }
-    if (fs_info.name) {
-        free(fs_info.name);
+    if (r->inode_bmps) {
+        free(r->inode_bmps);
     }
-    if (dev != MAP_FAILED) {
-        munmap(dev, dev_size);
+    if (r->block_bmps) {
+        free(r->block_bmps);
     }
-    if (devf >= 0) {
-        close(devf);
+    if (r->gd) {
+        free(r->gd);
     }
-
-    sync();
+    if (r->info.name) {
+        free(r->info.name);
+    }
+    if (r->dev != MAP_FAILED) {
+        munmap(r->dev, r->dev_size);
+    }
+    if (r->devf >= 0) {
+        close(r->devf);
+    }
+    pthread_mutex_destroy(&r->prog_lock);
+    pace_free(&r->pace);
+    free(r);
 }
 
 /*
  * Private method
  * Go through every group and save information about them
+ * Return 0 if success, -1 if fail
  */
-void get_group_info () {
+int get_group_info (struct recover_s *r) {
     uint32_t cx;
 
+    perf_begin(&r->perf, PERF_GROUP_INFO);
+
     /* Allocate space for the group descriptor and bitmap pointers */
-    gd = calloc(ngroups, sizeof(*gd));
-    block_bmps = calloc(ngroups, sizeof(*block_bmps));
-    inode_bmps = calloc(ngroups, sizeof(*inode_bmps));
+    r->gd = calloc(r->ngroups, sizeof(*r->gd));
+    r->block_bmps = calloc(r->ngroups, sizeof(*r->block_bmps));
+    r->inode_bmps = calloc(r->ngroups, sizeof(*r->inode_bmps));
+    if (!r->gd || !r->block_bmps || !r->inode_bmps) {
+        perf_end(&r->perf, PERF_GROUP_INFO);
+        return -1;
+    }
 
     /* Parse the drive group by group */
-    status(GROUP_INFO);
-    for (cx = 0; cx < ngroups; cx++) {
-        status(GROUP_PROG, cx);
+    status(r, GROUP_INFO);
+    for (cx = 0; cx < r->ngroups; cx++) {
+        status(r, GROUP_PROG, cx);
 
         /* Get the group descriptor */
-        *(gd + cx) = (struct gd_s*)(dev + GD_OFF(cx));
+        *(r->gd + cx) = (struct gd_s*)(r->dev + GD_OFF(cx));
 
         /* Get the bitmaps */
-        *(block_bmps + cx) = (uint8_t*)
-            (dev + BLOCK_OFF((*(gd + cx))->bg_block_bitmap_lo));
-        *(inode_bmps + cx) = (uint8_t*)
-            (dev + BLOCK_OFF((*(gd + cx))->bg_inode_bitmap_lo));
+        *(r->block_bmps + cx) = (uint8_t*)
+            (r->dev + BLOCK_OFF((*(r->gd + cx))->bg_block_bitmap_lo));
+        *(r->inode_bmps + cx) = (uint8_t*)
+            (r->dev + BLOCK_OFF((*(r->gd + cx))->bg_inode_bitmap_lo));
+    }
+    status(r, DONE);
+    perf_end(&r->perf, PERF_GROUP_INFO);
+    return 0;
+}
+
+/*
+ * Private method
+ * Points the bitmaps of every group at the device mapping
+ */
+void point_bitmaps (struct recover_s *r) {
+    uint32_t cx;
+
+    for (cx = 0; cx < r->ngroups; cx++) {
+        *(r->block_bmps + cx) = (uint8_t*)
+            (r->dev + BLOCK_OFF((*(r->gd + cx))->bg_block_bitmap_lo));
+        *(r->inode_bmps + cx) = (uint8_t*)
+            (r->dev + BLOCK_OFF((*(r->gd + cx))->bg_inode_bitmap_lo));
+    }
+}
+
+/*
+ * Private method
+ * Records why the current operation failed, the first reason wins
+ * Workers can fail at the same time, so it is swapped in atomically
+ */
+void set_fail (struct recover_s *r, const char *msg) {
+    __sync_bool_compare_and_swap(&r->fail, (const char*)0, msg);
+}
+
+/*
+ * Private method
+ * Reads how much of the memory the page cache takes, from /proc/meminfo
+ * Return the size in bytes, 0 if unknown
+ */
+uint64_t page_cache () {
+    char line [128];
+    unsigned long kib = 0;
+    FILE *f;
+
+    f = fopen("/proc/meminfo", "r");
+    if (!f) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "Cached: %lu kB", &kib) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return (uint64_t)kib << 10;
+}
+
+/*
+ * Private method
+ * Takes a look at the page cache, keeping the most it held
+ * The reporter thread looks too, so the peak is raised atomically
+ */
+void sample_cache (struct recover_s *r) {
+    uint64_t now = page_cache();
+    uint64_t peak = __atomic_load_n(&r->cache_peak, __ATOMIC_RELAXED);
+
+    while (now > peak && !__atomic_compare_exchange_n(&r->cache_peak, &peak,
+        now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/*
+ * Private method
+ * Broadcasts the most the page cache held so far, and how much that is
+ * over what it held when the recovery began
+ */
+void report_cache (struct recover_s *r) {
+    uint64_t grown;
+
+    sample_cache(r);
+    grown = (r->cache_peak > r->cache_start) ?
+        r->cache_peak - r->cache_start : 0;
+    status(r, CACHE, (uint32_t)(r->cache_peak >> 20),
+        (uint32_t)(grown >> 20));
+}
+
+/*
+ * Private method
+ * Stops timing a phase, then rewrites the metrics file with its totals
+ */
+void end_phase (struct recover_s *r, enum perf_phase_e ph) {
+    perf_end(&r->perf, ph);
+    sample_cache(r);
+    if (r->prom_path) {
+        perf_prom(&r->perf, r->info.name, r->prom_path);
+    }
+}
+
+/*
+ * Private method
+ * Gets a metadata block to change, the change is held in the transaction
+ * until collect() commits it
+ * Returns 0 if out of memory
+ */
+uint8_t* meta_block (struct recover_s *r, uint32_t block) {
+    uint8_t *copy = txn_block(&r->txn, block);
+
+    if (!copy) {
+        set_fail(r, "Out of memory for the metadata changes!\n");
     }
-    status(DONE);
+    return copy;
 }
 
 /*
@@ -138,36 +328,86 @@ void set_bmp_bit (uint8_t *bmp, uint32_t bit) {
  * Test if a block is used
  * Return 1 if used, 0 otherwise
  */
-int is_block_used (uint32_t block) {
+int is_block_used (struct recover_s *r, uint32_t block) {
     uint32_t bgroup;
     uint32_t bindex;
     uint8_t *bmp;
 
     /* Test for out of bounds */
-    if (block >= nblocks) {
+    if (block >= r->nblocks) {
         return 0;
     }
 
     bgroup = block / BLOCKS_PER_GROUP;
     bindex = block % BLOCKS_PER_GROUP;
-    bmp = *(block_bmps + bgroup);
+    bmp = *(r->block_bmps + bgroup);
 
     return BMP_BIT(bmp, bindex);
 }
 
+/*
+ * Private method
+ * Find the first free block in [block, end)
+ * Reads the bitmaps 64 bits at a time, jumping over fully used words
+ * Bitmaps are little endian, so bit N of a word is block N of the word,
+ * big endian hosts swap each word before looking at it
+ * Return the free block number, end if there is none
+ */
+uint32_t next_free_block (struct recover_s *r, uint32_t block, uint32_t end) {
+    uint32_t bgroup;
+    uint32_t bindex;
+    const uint64_t *bmp;
+    uint64_t word;
+
+    while (block < end) {
+        bgroup = block / BLOCKS_PER_GROUP;
+        bindex = block % BLOCKS_PER_GROUP;
+
+        /* Blocks past the end of the drive have no bitmap */
+        if (bgroup >= r->ngroups) {
+            return end;
+        }
+        bmp = (const uint64_t*)*(r->block_bmps + bgroup);
+
+        /* Free blocks are the zero bits, ignore the ones before block */
+        word = *(bmp + bindex / 64);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        word = ~word & (~(uint64_t)0 << (bindex % 64));
+        if (word) {
+            block += __builtin_ctzll(word) - (bindex % 64);
+            return (block < end) ? block : end;
+        }
+        block += 64 - (bindex % 64);
+    }
+
+    return end;
+}
+
 /*
  * Private method
  * Mark a block as used in the bitmap, handles indirects
- * Returns the last direct block that was marked
+ * Returns the last direct block that was marked, 0 if out of memory
  */
-uint32_t mark_used (uint32_t block, uint32_t ind) {
+uint32_t mark_used (struct recover_s *r, uint32_t block, uint32_t ind) {
     uint32_t ret;
     uint32_t cx;
     uint32_t bgroup = block / BLOCKS_PER_GROUP;
     uint32_t bindex = block % BLOCKS_PER_GROUP;
-    uint8_t *bmp = *(block_bmps + bgroup);
+    uint8_t *bmp;
     uint32_t *blk;
 
+    /* Per block, too hot for a timer, the enclosing phase is timed */
+    perf_add(&r->perf, PERF_MARK_USED, 1);
+
+    /* Later reads of the bitmap see the change too */
+    bmp = meta_block(r, (*(r->gd + bgroup))->bg_block_bitmap_lo);
+    if (!bmp) {
+        return 0;
+    }
+    *(r->block_bmps + bgroup) = bmp;
+
     /* Mark the block, return if direct block */
     set_bmp_bit(bmp, bindex);
     if (ind == 0) {
@@ -175,49 +415,82 @@ uint32_t mark_used (uint32_t block, uint32_t ind) {
     }
 
     /* Handle indirects */
-    blk = (uint32_t*)(dev + BLOCK_OFF(block));
+    blk = (uint32_t*)(r->dev + BLOCK_OFF(block));
     for (cx = 0; cx < BYTES_PER_BLOCK / sizeof(*blk); cx++) {
         /* Only mark non-zero linked blocks */
         if (*(blk + cx) != 0) {
-            ret = mark_used(*(blk + cx), ind - 1);
+            ret = mark_used(r, *(blk + cx), ind - 1);
         }
     }
 
     return ret;
 }
 
+/*
+ * Private method
+ * Gets the first listed block of an indirect, the key it is indexed by
+ * The first listed block of a 2x or 3x indirect can be zero, skip it
+ */
+uint32_t ind_key (struct recover_s *r, uint32_t block, uint32_t ind) {
+    uint32_t *blk = (uint32_t*)(r->dev + BLOCK_OFF(block));
+
+    if (ind > 0 && *blk == 0) {
+        blk++;
+    }
+    return *blk;
+}
+
+/*
+ * Private method
+ * Indexes the indirects found since the last call by their first listed
+ * block
+ * Return 0 if success, -1 if fail
+ */
+int index_indirects (struct recover_s *r) {
+    uint32_t cx;
+    size_t cx2;
+
+    for (cx = 0; cx < 3; cx++) {
+        for (cx2 = (r->ind_maps + cx)->count;
+            cx2 < (r->indirects + cx)->count; cx2++) {
+            if (!cand_map_add(r->ind_maps + cx,
+                ind_key(r, cand_get(r->indirects + cx, cx2), cx))) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
 /*
  * Private method
  * Finds the indirect block that goes on from the last block
+ * 1x indirects must list the block after last first, 2x and 3x must list
+ * the indirect one level down that does
  * Return the block number if found, zero otherwise
  */
-uint32_t find_next_ind (uint32_t last, uint32_t ind) {
-    uint32_t cx;
+uint32_t find_next_ind (struct recover_s *r, uint32_t last, uint32_t ind) {
+    uint32_t key;
+    uint32_t pos;
     uint32_t bnum;
-    uint32_t *blk = 0;
 
-    /* Loop through all the indirects of a given type */
-    for (cx = 0; cx < *(n_indirects + ind); cx++) {
-        bnum = *(*(indirects + ind) + cx);
+    perf_add(&r->perf, PERF_FIND_IND, 1);
 
-        /* Skip used blocks */
-        if (!is_block_used(bnum)) {
-            blk = (uint32_t*)(dev + BLOCK_OFF(bnum));
+    if (ind == 0) {
+        key = last + 1;
+    } else {
+        key = find_next_ind(r, last, ind - 1);
+        if (key == 0) {
+            return 0;
+        }
+    }
 
-            /* 1x indirect, test if it starts after last block */
-            if (ind == 0 && *blk == last + 1) {
-                return bnum;
-            }
-            /* 2x and 3x indirect, test first listed block */
-            else if (ind == 1 || ind == 2) {
-                /* Ignore first listed if zero */
-                if (*blk == 0) {
-                    blk++;
-                }
-                if (find_next_ind(last, ind - 1) == *blk) {
-                    return bnum;
-                }
-            }
+    /* Take the earliest found unused one */
+    for (pos = cand_map_first(r->ind_maps + ind, key); pos;
+        pos = cand_map_next(r->ind_maps + ind, pos)) {
+        bnum = cand_get(r->indirects + ind, pos - 1);
+        if (!is_block_used(r, bnum)) {
+            return bnum;
         }
     }
 
@@ -229,17 +502,24 @@ uint32_t find_next_ind (uint32_t last, uint32_t ind) {
  * Actually does the attempt at reserving
  * Returns inode number if success, 0 if fail
  */
-uint32_t res_ino_helper (uint32_t inum) {
-    uint32_t igroup = (inum - 1) / ipg;
-    uint32_t iindex = (inum - 1) % ipg;
-    uint32_t ioff = iindex * sb->s_inode_size;
-    uint8_t *bmp = *(inode_bmps + igroup);
+uint32_t res_ino_helper (struct recover_s *r, uint32_t inum) {
+    uint32_t igroup = (inum - 1) / r->ipg;
+    uint32_t iindex = (inum - 1) % r->ipg;
+    uint32_t ioff = iindex * r->sb->s_inode_size;
+    uint8_t *bmp = *(r->inode_bmps + igroup);
+    uint8_t *table;
 
     /* Reserve the inode if it is free */
     if (BMP_BIT(bmp, iindex) == 0) {
+        bmp = meta_block(r, (*(r->gd + igroup))->bg_inode_bitmap_lo);
+        table = meta_block(r,
+            (*(r->gd + igroup))->bg_inode_table_lo + ioff / BYTES_PER_BLOCK);
+        if (!bmp || !table) {
+            return 0;
+        }
+        *(r->inode_bmps + igroup) = bmp;
         set_bmp_bit(bmp, iindex);
-        i = (struct inode_s*)(dev +
-            BLOCK_OFF((*(gd + igroup))->bg_inode_table_lo) + ioff);
+        r->ino = (struct inode_s*)(table + ioff % BYTES_PER_BLOCK);
         return inum;
     }
 
@@ -252,22 +532,23 @@ uint32_t res_ino_helper (uint32_t inum) {
  * Priority on 6969, 666, 420, then first available
  * Returns inode number if success, 0 if fail
  */
-uint32_t res_ino () {
+uint32_t res_ino (struct recover_s *r) {
     uint32_t ret;
     uint32_t cx;
 
     /* Attempt the priority inodes */
-    ret = res_ino_helper(6969);
+    ret = res_ino_helper(r, 6969);
     if (!ret) {
-        ret = res_ino_helper(666);
+        ret = res_ino_helper(r, 666);
     }
     if (!ret) {
-        ret = res_ino_helper(420);
+        ret = res_ino_helper(r, 420);
     }
 
     /* Get the first available inode if the above fail */
-    for (cx = sb->s_first_ino + 1; !ret && cx < sb->s_inodes_count; cx++) {
-        ret = res_ino_helper(cx);
+    for (cx = r->sb->s_first_ino + 1;
+        !ret && !r->fail && cx < r->sb->s_inodes_count; cx++) {
+        ret = res_ino_helper(r, cx);
     }
 
     return ret;
@@ -275,21 +556,79 @@ uint32_t res_ino () {
 
 /*
  * Private method
- * Test if a block is a potential BMP start block
- * Return similar to memcmp(3)
+ * Gets what is known about a block from the indirect tests
  */
-int cmp_bmp (uint32_t block) {
-    struct bmp_head_s *header;
+uint32_t memo_get (struct recover_s *r, uint32_t block) {
+    uint32_t word = *(volatile uint32_t*)(r->ind_memo + block / 16);
 
-    /* Test out of bounds */
-    if (block >= nblocks) {
+    return (word >> (block % 16 * 2)) & 3;
+}
+
+/*
+ * Private method
+ * Records what the indirect tests made of a block, if nothing is yet
+ * Workers can share a word, so it is swapped in atomically
+ */
+void memo_set (struct recover_s *r, uint32_t block, uint32_t state) {
+    uint32_t *word = r->ind_memo + block / 16;
+    uint32_t shift = block % 16 * 2;
+    uint32_t old;
+
+    do {
+        old = *(volatile uint32_t*)word;
+        if ((old >> shift) & 3) {
+            return;
+        }
+    } while (!__sync_bool_compare_and_swap(word, old, old | state << shift));
+}
+
+/*
+ * Private method
+ * Tests if a block has the shape of a 2x or 3x indirect: a run of in bounds
+ * block numbers followed by only zeros, the first listed block may be zero
+ * Return 0 if it does, nonzero if not
+ */
+int ptr_shape (struct recover_s *r, const uint32_t *blk) {
+    uint32_t cx = (*blk == 0) ? 1 : 0;
+
+    /* If first two are zero, invalid */
+    if (*(blk + cx) == 0) {
         return 1;
     }
+    /* Non-zero streak */
+    for (; cx < BYTES_PER_BLOCK / sizeof(*blk) && *(blk + cx) != 0; cx++) {
+        if (*(blk + cx) >= r->nblocks) {
+            return 1;
+        }
+    }
+    /* Zero spotted, only zeros may follow */
+    if (cx < BYTES_PER_BLOCK / sizeof(*blk)) {
+        return zero_tail(blk, cx);
+    }
+    return 0;
+}
+
+/* cmp_ind() and cmp_children() recurse into each other */
+int cmp_ind (struct recover_s *r, struct scan_part_s *part, uint32_t block,
+    uint32_t ind);
 
-    /* Get the block as a BMP file header */
-    header = (struct bmp_head_s*)(dev + BLOCK_OFF(block));
+/*
+ * Private method
+ * Tests if every block listed by a 2x or 3x indirect, already known to have
+ * the right shape, is a valid indirect with one level of indirection less
+ * Return 0 if they all are, nonzero if not
+ */
+int cmp_children (struct recover_s *r, struct scan_part_s *part,
+    const uint32_t *blk, uint32_t ind) {
+    uint32_t cx;
 
-    return memcmp(&(header->bmp_magic), BMP_MAGIC, 2);
+    for (cx = (*blk == 0) ? 1 : 0;
+        cx < BYTES_PER_BLOCK / sizeof(*blk) && *(blk + cx) != 0; cx++) {
+        if (cmp_ind(r, part, *(blk + cx), ind - 1)) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
 /*
@@ -298,114 +637,116 @@ int cmp_bmp (uint32_t block) {
  * Handles 1x, 2x, and 3x
  * Return 0 if potential indirect, nonzero if not
  */
-int cmp_ind (uint32_t block, uint32_t ind) {
-    int ret = 0;
-    uint32_t cx;
-    uint32_t cx2;
-    uint32_t *blk;
-    int zero = 0;
+int cmp_ind (struct recover_s *r, struct scan_part_s *part, uint32_t block,
+    uint32_t ind) {
+    const uint32_t *blk;
+    uint32_t state;
+    int ret;
+
+    (*(part->cmp_calls + ind))++;
 
     /* Test out of bounds */
-    if (block >= nblocks) {
+    if (block >= r->nblocks) {
         return 1;
     }
 
+    /* Blocks seen before, by the scan or from another parent */
+    state = memo_get(r, block);
+    if (state == IND_INVALID && ind < 2) {
+        return 1;
+    } else if ((state == IND_VALID_1X && ind == 0) ||
+        (state == IND_VALID_2X && ind == 1)) {
+        return 0;
+    }
+
     /* Get the block as an array of block numbers */
-    blk = (uint32_t*)(dev + BLOCK_OFF(block));
+    /* Each level of indirection reads into its own slot */
+    blk = (const uint32_t*)blkio_block(part->io, block, ind);
+    if (!blk) {
+        return 1;
+    }
 
     /* Handle 1x indirect */
     if (ind == 0) {
-        /* Test for increment or until zeros */
-        for (cx = 0; cx < BYTES_PER_BLOCK / sizeof(*blk); cx++) {
-            /* Test for only zeros at the end */
-            if (zero) {
-                if (*(blk + cx) != 0) {
-                    ret = 1;
-                    break;
-                }
-                continue;
-            }
-
-            /* Test if listing ends on first of a set of 4 */
-            if (cx % 4 == 0 && *(blk + cx) == 0) {
-                /* Begin tracking zeros unless very first entry */
-                if (cx != 0) {
-                    zero = 1;
-                    continue;
-                } else {
-                    ret = 1;
-                    break;
-                }
-            }
+        ret = ind1_check(blk);
+        /* Not a 2x either if the shape is wrong, no need to read further */
+        if (!ret) {
+            memo_set(r, block, IND_VALID_1X);
+        } else if (ptr_shape(r, blk)) {
+            memo_set(r, block, IND_INVALID);
+        }
+        return ret;
+    }
 
-            /* Test if chunks of 4 are consecutive or zero found */
-            for (cx2 = 1; cx2 < 4; cx2++) {
-                /* Test if next is zero */
-                if (*(blk + (cx + cx2)) == 0) {
-                    ret = 0;
-                    zero = 1;
-                    cx += cx2;
-                    break;
-                }
-
-                /* Test if next is cur + 1 */
-                if (*(blk + (cx + cx2)) == *(blk + (cx + cx2 - 1)) + 1) {
-                    ret = 0;
-                } else {
-                    ret = 1;
-                    break;
-                }
-            }
-            if (zero && !ret) {
-                continue;
-            } else if (ret) {
-                return ret;
-            } else {
-                /* No end cases found, continue to next group of 4 */
-                cx += 3;
-            }
+    /* Handle 2x and 3x indirect, the cheap shape test goes first */
+    ret = ptr_shape(r, blk) || cmp_children(r, part, blk, ind);
+    if (ind == 1) {
+        if (!ret) {
+            memo_set(r, block, IND_VALID_2X);
+        } else {
+            memo_set(r, block, (ind1_check(blk)) ? IND_INVALID : IND_VALID_1X);
         }
     }
+    return ret;
+}
 
-    /* Handle 2x and 3x indirect */
-    else if (ind == 1 || ind == 2) {
-        /* Test each listed block with one level of indirection less */
-        for (cx = 0; !ret && cx < BYTES_PER_BLOCK / sizeof(*blk); cx++) {
-            /* Skip if first listed block is zero */
-            if (cx == 0 && *blk == 0) {
-                /* If first two are zero, invalid */
-                if (*(blk + 1) == 0) {
-                    return 1;
-                }
-                continue;
-            }
-            /* If nonzero in zero streak, invalid */
-            else if (zero && *(blk + cx) != 0) {
-                return 1;
-            }
-            /* Non-zero streak */
-            else if (*(blk + cx) != 0) {
-                ret = ret || cmp_ind(*(blk + cx), ind - 1);
-            }
-            /* Zero spotted */
-            else {
-                zero = 1;
-                continue;
-            }
+/*
+ * Private method
+ * Classifies a block read in by the scan
+ * The cheap tests on the block itself run first, only blocks that have the
+ * shape of a 2x or 3x indirect have their listed blocks read in
+ * 3x wins over 2x, over 1x, over BMP header, as the separate tests did
+ */
+enum blk_class_e classify (struct recover_s *r, struct scan_part_s *part,
+    uint32_t block, const uint32_t *blk) {
+    uint32_t state;
+
+    /* Every class needs one of the first two entries set */
+    if (*blk == 0 && *(blk + 1) == 0) {
+        memo_set(r, block, IND_INVALID);
+        return BLK_NONE;
+    }
+
+    /* A parent may already have had this block tested as 2x */
+    /* Each test of the block itself counts as one at its level */
+    state = memo_get(r, block);
+    if (!ptr_shape(r, blk)) {
+        (*(part->cmp_calls + 2))++;
+        if (!cmp_children(r, part, blk, 2)) {
+            return BLK_IND3;
+        }
+        (*(part->cmp_calls + 1))++;
+        if (state == IND_VALID_2X ||
+            (state != IND_INVALID && !cmp_children(r, part, blk, 1))) {
+            memo_set(r, block, IND_VALID_2X);
+            return BLK_IND2;
+        }
+    }
+    /* Both need the first entry set */
+    if (*blk != 0) {
+        (*(part->cmp_calls))++;
+        if (!ind1_check(blk)) {
+            memo_set(r, block, IND_VALID_1X);
+            return BLK_IND1;
         }
     }
+    memo_set(r, block, IND_INVALID);
+    if (*blk != 0 && !magic_check((const uint8_t*)blk)) {
+        return BLK_BMP;
+    }
 
-    return ret;
+    return BLK_NONE;
 }
 
 /*
  * Private method
  * Populates the inode starting with the given block
+ * Return 0 if success, -1 if fail
  */
-void populate (uint32_t inum, uint32_t start) {
+int populate (struct recover_s *r, uint32_t inum, uint32_t start) {
     uint32_t cx;
     struct bmp_head_s *bmp_head = (struct bmp_head_s*)
-        (dev + BLOCK_OFF(start));
+        (r->dev + BLOCK_OFF(start));
     uint32_t size = bmp_head->bmp_file_size;
     uint32_t size_blocks = size / BYTES_PER_BLOCK;
     uint32_t *iblocks;
@@ -415,39 +756,42 @@ void populate (uint32_t inum, uint32_t start) {
     /* Ensure that overflow is accounted for */
     size_blocks += (size % BYTES_PER_BLOCK) ? 1 : 0;
 
-    status(POP, inum);
-    i->i_mode = MODE_777 | TYPE_REG;
-    i->i_size_lo = size;
-    i->i_links_count = 1;
-    iblocks = (uint32_t*)(i->i_block);
+    status(r, POP, inum);
+    r->ino->i_mode = MODE_777 | TYPE_REG;
+    r->ino->i_size_lo = size;
+    r->ino->i_links_count = 1;
+    iblocks = (uint32_t*)(r->ino->i_block);
     /* Populate direct blocks */
     for (cx = 0; cx < size_blocks && cx < 12; cx++) {
         bnum = start + cx;
         *(iblocks + cx) = bnum;
-        last = mark_used(bnum, 0);
+        last = mark_used(r, bnum, 0);
     }
-    status(POP_DIR, start, bnum);
+    status(r, POP_DIR, start, bnum);
     /* Populate indirect blocks */
     for (cx = 0; cx < 3; cx++) {
-        if (*(n_indirects + cx) > 0) {
+        if ((r->indirects + cx)->count > 0) {
             /* Find the indirect block that has the next block */
-            bnum = find_next_ind(last, cx);
+            bnum = find_next_ind(r, last, cx);
             if (bnum != 0) {
                 *(iblocks + SIN_IND + cx) = bnum;
-                status(POP_IND, cx + 1, bnum);
-                last = mark_used(bnum, cx + 1);
+                status(r, POP_IND, cx + 1, bnum);
+                last = mark_used(r, bnum, cx + 1);
                 continue;
             }
         }
     }
-    i->i_extra_isize = 32;
+    r->ino->i_extra_isize = 32;
+
+    return (r->fail) ? -1 : 0;
 }
 
 /*
  * Private method
  * Links the given inode to the root directory
+ * Return 0 if success, -1 if fail
  */
-void link (uint32_t inum) {
+int link (struct recover_s *r, uint32_t inum) {
     struct inode_s *root = 0;
     uint32_t root_bnum = 0;
     uint8_t *root_block = 0;
@@ -456,25 +800,28 @@ void link (uint32_t inum) {
     struct dir_ent_s *de = 0;
     int entered = 0;
 
-    status(LINK, inum);
+    status(r, LINK, inum);
 
     /* Get the root inode information */
-    root = (struct inode_s*)(dev +
-        BLOCK_OFF((*gd)->bg_inode_table_lo) +
-        ((ROOT_INODE - 1) * sb->s_inode_size));
+    root = (struct inode_s*)(r->dev +
+        BLOCK_OFF((*r->gd)->bg_inode_table_lo) +
+        ((ROOT_INODE - 1) * r->sb->s_inode_size));
     root_bnum = *((uint32_t*)(root->i_block));
-    root_block = (uint8_t*)(dev + BLOCK_OFF(root_bnum));
+    root_block = meta_block(r, root_bnum);
+    if (!root_block) {
+        return -1;
+    }
 
     /* Link to root */
-    memset(target_name, 0, sizeof(target_name));
-    sprintf(target_name, "recovered_%03u.bmp", n_rec);
+    memset(r->target_name, 0, sizeof(r->target_name));
+    sprintf(r->target_name, "recovered_%03u.bmp", r->n_rec);
     de = (struct dir_ent_s*)root_block;
     for (;;) {
         new_rec_len = sizeof(de->inode) +
             sizeof(de->rec_len) +
             sizeof(de->name_len) +
             sizeof(de->file_type) +
-            strlen(target_name);
+            strlen(r->target_name);
         real_rec_len = sizeof(de->inode) +
             sizeof(de->rec_len) +
             sizeof(de->name_len) +
@@ -499,8 +846,8 @@ void link (uint32_t inum) {
                 /* Build the directory entry */
                 de->inode = inum;
                 de->rec_len = new_rec_len;
-                de->name_len = strlen(target_name);
-                strncpy(de->name, target_name, de->name_len);
+                de->name_len = strlen(r->target_name);
+                strncpy(de->name, r->target_name, de->name_len);
 
                 entered = 1;
                 break;
@@ -512,170 +859,1822 @@ void link (uint32_t inum) {
         /* Get the next entry */
         de = (struct dir_ent_s*)((char*)de + de->rec_len);
     }
-    if (entered) {
-        status(RECOVERED, target_name);
-    } else {
-        status(ERROR, "Failed to link, exiting...\n");
-        exit(-1);
+    if (!entered) {
+        set_fail(r, "Failed to link, exiting...\n");
+        return -1;
     }
+    status(r, RECOVERED, r->target_name);
+    return 0;
 }
 
-/* 
- * Public method
- * Initialization tasks
+/*
+ * Private method
+ * Tests if enough files were recovered, or the one asked for was
+ * Return 1 if recovery should stop, 0 otherwise
  */
-void init (const char *fname) {
-    /* Register the exit handler */
-    if (atexit(cleanup)) {
-        status(ERROR, "Unable to register the exit handler!\n");
-        exit(-1);
-    }
-
-    /* Attempt to open the device */
-    devf = open(fname, O_RDWR);
-    if (devf < 0) {
-        status(ERROR, "Unable to open: %s\n", fname);
-        exit(-1);
-    }
-    
-    /* Get size of device */
-    if (ioctl(devf, BLKGETSIZE, &dev_size) == -1) {
-        status(ERROR, "Unable to get size of device: %s\n", fname);
-        exit(-1);
-    }
-    /* ioctl call gives number 512 byte sectors */
-    dev_size *= 512;
-
-    /* Attempt to mmap the device */
-    dev = mmap(0, dev_size, PROT_READ|PROT_WRITE, MAP_SHARED, devf, 0);
-    if (dev == MAP_FAILED) {
-        status(ERROR, "Unable to mmap device: %s\n", fname);
-        exit(-1);
-    }
-
-    /* Save the name in the info struct */
-    fs_info.name = calloc(strlen(fname) + 1, sizeof(*fname));
-    strcpy(fs_info.name, fname);
-
-    /* Calculate the number of blocks on the drive */
-    nblocks = dev_size / BYTES_PER_BLOCK;
-
-    /* Calculate the number of groups on the drive */
-    ngroups = dev_size / BYTES_PER_GROUP;
-
-    /* Get the superblock */
-    sb = (struct sb_s*)(dev + SB_OFF);
-
-    /* Get the number of inodes per group */
-    ipg = sb->s_inodes_per_group;
-
-    /* Calculate the number of inodes per block */
-    ipb = BYTES_PER_BLOCK / sb->s_inode_size;
+int stop_reached (struct recover_s *r) {
+    return r->stop_hit || (r->stop_files > 0 && r->n_rec >= r->stop_files);
+}
 
-    /* Get information about each group */
-    get_group_info();
-    if (!gd || !block_bmps || !inode_bmps) {
-        status(ERROR, "Error getting group information, exiting...\n");
-        exit(-1);
+/*
+ * Private method
+ * Counts a recovered file, noting if it is the one asked for
+ */
+void count_file (struct recover_s *r, uint32_t start) {
+    r->n_rec++;
+    perf_add(&r->perf, PERF_FILES, 1);
+    if (r->stop_block != 0 && start == r->stop_block) {
+        r->stop_hit = 1;
     }
 }
 
 /*
- * Public method
- * Scan the drive for all BMP header blocks and indirect blocks
- * Return 1 if success, 0 if fail
+ * Private method
+ * Follows the last listed entries of an indirect down to a direct block
+ * Return the last direct block it lists, 0 if it lists none
  */
-int scan () {
+uint32_t last_listed (struct recover_s *r, uint32_t block, uint32_t ind) {
+    const uint32_t *blk;
     uint32_t cx;
-    int cx2;
-    uint32_t percent;
-    uint32_t cur_percent;
 
-    /* Scan the drive for important blocks */
-    status(SCAN);
-    percent = 0;
-    for (cx = 0; cx < nblocks; cx++) {
-        cur_percent = cx * 100 / nblocks;
-
-        /* Skip blocks marked used */
-        if (is_block_used(cx)) {
-            goto skip_tests;
-        }
-        /* Test for indirect block */
-        /* Start at 3x, go down to 1x */
-        for (cx2 = 2; cx2 >= 0; cx2--) {
-            if (!cmp_ind(cx, cx2)) {
-                status(SCAN_IND, cx2 + 1, cx);
-                *(n_indirects + cx2) += 1;
-                *(indirects + cx2) = realloc(*(indirects + cx2),
-                    *(n_indirects + cx2) * sizeof(**(indirects + cx2)));
-                *(*(indirects + cx2) + *(n_indirects + cx2) - 1) = cx;
-                goto skip_tests;
-            }
+    while (ind > 0) {
+        blk = (const uint32_t*)(r->dev + BLOCK_OFF(block));
+        cx = BYTES_PER_BLOCK / sizeof(*blk);
+        while (cx > 0 && *(blk + cx - 1) == 0) {
+            cx--;
         }
-        /* Test for BMP header */
-        if (!cmp_bmp(cx)) {
-            status(SCAN_BMP, cx);
-            n_bmp_starts++;
-            bmp_starts = realloc(bmp_starts,
-                n_bmp_starts * sizeof(*bmp_starts));
-            *(bmp_starts + (n_bmp_starts - 1)) = cx;
-        }
-    skip_tests:
-        /* Broadcast percentage through disk */
-        if (cur_percent >= percent + 1) {
-            percent += 1;
-            status(SCAN_PROG, percent);
+        if (cx == 0) {
+            return 0;
         }
+        block = *(blk + cx - 1);
+        ind--;
     }
-    status(DONE);
-
-    /* Test if BMP start blocks gathered */
-    return (bmp_starts) ? 1 : 0;
+    return block;
 }
 
 /*
- * Public method
- * Builds the complete files out of the file shards
+ * Private method
+ * Tests if every indirect the file starting at the block needs has been
+ * found yet
+ * Return 1 if the file can be built, 0 otherwise
  */
-void collect () {
+int chain_found (struct recover_s *r, uint32_t start) {
+    struct bmp_head_s *bmp_head = (struct bmp_head_s*)
+        (r->dev + BLOCK_OFF(start));
+    uint32_t size = bmp_head->bmp_file_size;
+    uint32_t size_blocks = size / BYTES_PER_BLOCK;
+    uint32_t covered = 12;
+    uint32_t per = 1;
+    uint32_t last = start + 11;
+    uint32_t bnum;
     uint32_t cx;
 
-    status(COLLECT);
-    /* Go through every potential BMP header block found */
-    for (cx = 0; cx < n_bmp_starts; cx++) {
-        uint32_t inum;
-        uint32_t bnum = *(bmp_starts + cx);
-        struct bmp_head_s *bmp_head = (struct bmp_head_s*)
-            (dev + BLOCK_OFF(bnum));
-        uint32_t size = bmp_head->bmp_file_size;
-        uint32_t size_blocks = size / BYTES_PER_BLOCK;
-
-        /* Skip used blocks */
-        if (is_block_used(bnum)) {
-            continue;
-        }
+    /* Ensure that overflow is accounted for */
+    size_blocks += (size % BYTES_PER_BLOCK) ? 1 : 0;
 
-        /* Sanity check: needed inderect blocks are found */
-        status(SANITY, bnum);
-        if (size_blocks > 12 && !find_next_ind(bnum + 11, 0)) {
-            status(WARN, "Failed, skipping...");
-            continue;
+    for (cx = 0; cx < 3 && size_blocks > covered; cx++) {
+        bnum = find_next_ind(r, last, cx);
+        if (bnum == 0) {
+            return 0;
         }
+        per *= BYTES_PER_BLOCK / sizeof(uint32_t);
+        covered += per;
+        last = last_listed(r, bnum, cx + 1);
+    }
+    return 1;
+}
 
-        /* Try to reserve an inode*/
-        if (!(inum = res_ino())) {
-            status(ERROR, "Unable to reserve an inode, exiting...");
-            exit(-1);
-        }
-        status(INODE, inum);
+/*
+ * Private method
+ * Builds the file starting at the block into a new inode
+ * Return 1 if built, 0 if skipped, -1 if fail
+ */
+int build_file (struct recover_s *r, uint32_t bnum) {
+    uint32_t inum;
+    struct bmp_head_s *bmp_head = (struct bmp_head_s*)
+        (r->dev + BLOCK_OFF(bnum));
+    uint32_t size = bmp_head->bmp_file_size;
+    uint32_t size_blocks = size / BYTES_PER_BLOCK;
+
+    /* Skip used blocks, including ones claimed by earlier files */
+    if (is_block_used(r, bnum)) {
+        return 0;
+    }
+
+    /* Sanity check: needed inderect blocks are found */
+    status(r, SANITY, bnum);
+    if (size_blocks > 12 && !find_next_ind(r, bnum + 11, 0)) {
+        status(r, WARN, "Failed, skipping...");
+        return 0;
+    }
 
-        /* Populate the inode with required fields */
-        populate(inum, bnum);
+    /* Try to reserve an inode*/
+    if (!(inum = res_ino(r))) {
+        set_fail(r, "Unable to reserve an inode, exiting...");
+        return -1;
+    }
+    status(r, INODE, inum);
 
-        /* Link the inode to the root directory */
-        link(inum);
-        n_rec++;
+    /* Populate the inode, then link it to the root directory */
+    if (populate(r, inum, bnum) || link(r, inum)) {
+        return -1;
     }
-    status(DONE);
+    count_file(r, bnum);
+    return 1;
+}
+
+/*
+ * Private method
+ * Finds the group whose inode table holds the block
+ * Return the group number plus one, 0 if it isn't in an inode table
+ */
+uint32_t itable_group (struct recover_s *r, uint32_t block) {
+    uint32_t table_blocks = (r->ipg * r->sb->s_inode_size +
+        BYTES_PER_BLOCK - 1) / BYTES_PER_BLOCK;
+    uint32_t table;
+    uint32_t group;
+
+    for (group = 0; group < r->ngroups; group++) {
+        table = (*(r->gd + group))->bg_inode_table_lo;
+        if (block >= table && block < table + table_blocks) {
+            return group + 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Private method
+ * Gets a block as it was when journal transaction seq was logged, from
+ * the journal if it has a copy, otherwise from the drive
+ */
+const uint8_t* block_at (struct recover_s *r, uint32_t block, uint32_t seq) {
+    const struct jnl_copy_s *c = jnl_find(&r->jnl, block, seq);
+
+    return (c) ? c->data : r->dev + BLOCK_OFF(block);
+}
+
+/*
+ * Private method
+ * Walks the blocks listed by a deleted inode, up to need data blocks
+ * Every block walked must still be free, and nothing may be listed past
+ * the end of the file
+ * Return 0 if the blocks can be taken back, -1 otherwise
+ */
+int map_free (struct recover_s *r, uint32_t block, uint32_t ind,
+    uint32_t *need, uint32_t seq) {
+    const uint32_t *blk;
+    uint32_t cx;
+
+    if (*need == 0) {
+        return (block == 0) ? 0 : -1;
+    }
+    if (block >= r->nblocks || is_block_used(r, block)) {
+        return -1;
+    }
+    if (ind == 0) {
+        (*need)--;
+        return 0;
+    }
+
+    blk = (const uint32_t*)block_at(r, block, seq);
+    for (cx = 0; cx < BYTES_PER_BLOCK / sizeof(*blk); cx++) {
+        if (map_free(r, *(blk + cx), ind - 1, need, seq)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Private method
+ * Marks the blocks listed by an inode as used, putting back the indirects
+ * the journal has older copies of
+ * Return 0 if success, -1 if fail
+ */
+int take_map (struct recover_s *r, uint32_t block, uint32_t ind,
+    uint32_t seq) {
+    const uint32_t *blk;
+    uint8_t *copy;
+    uint32_t cx;
+
+    if (!mark_used(r, block, 0)) {
+        return -1;
+    }
+    if (ind == 0) {
+        return 0;
+    }
+
+    blk = (const uint32_t*)block_at(r, block, seq);
+    if ((const uint8_t*)blk != r->dev + BLOCK_OFF(block)) {
+        copy = meta_block(r, block);
+        if (!copy) {
+            return -1;
+        }
+        memcpy(copy, blk, BYTES_PER_BLOCK);
+    }
+    for (cx = 0; cx < BYTES_PER_BLOCK / sizeof(*blk); cx++) {
+        if (*(blk + cx) != 0 && take_map(r, *(blk + cx), ind - 1, seq)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Private method
+ * Takes back a deleted inode as given, with the blocks it lists as of
+ * journal transaction seq
+ * ext2 can clear the size on delete, the BMP header gives it
+ * Return 1 if taken back, 0 if its blocks were reused, -1 if fail
+ */
+int revive (struct recover_s *r, uint32_t inum, const struct inode_s *ino,
+    uint32_t seq) {
+    const uint32_t *listed = (const uint32_t*)(ino->i_block);
+    struct bmp_head_s *bmp_head = (struct bmp_head_s*)
+        (r->dev + BLOCK_OFF(*listed));
+    uint32_t size = bmp_head->bmp_file_size;
+    uint32_t need = size / BYTES_PER_BLOCK;
+    uint32_t *iblocks;
+    uint32_t cx;
+
+    /* Ensure that overflow is accounted for */
+    need += (size % BYTES_PER_BLOCK) ? 1 : 0;
+
+    /* The whole file must still be there */
+    for (cx = 0; cx <= TRI_IND; cx++) {
+        if (map_free(r, *(listed + cx),
+            (cx < SIN_IND) ? 0 : cx - SIN_IND + 1, &need, seq)) {
+            return 0;
+        }
+    }
+    if (need > 0) {
+        return 0;
+    }
+
+    /* Keep the inode number it had */
+    if (!res_ino_helper(r, inum)) {
+        return -1;
+    }
+    status(r, INODE, inum);
+
+    status(r, POP, inum);
+    memcpy(r->ino, ino, r->sb->s_inode_size);
+    r->ino->i_size_lo = size;
+    r->ino->i_size_high = 0;
+    r->ino->i_dtime = 0;
+    r->ino->i_links_count = 1;
+    iblocks = (uint32_t*)(r->ino->i_block);
+    for (cx = 0; cx < SIN_IND && *(iblocks + cx) != 0; cx++) {
+        if (take_map(r, *(iblocks + cx), 0, seq)) {
+            return -1;
+        }
+    }
+    status(r, POP_DIR, *iblocks, *(iblocks + cx - 1));
+    for (cx = 0; cx < 3; cx++) {
+        if (*(iblocks + SIN_IND + cx) != 0) {
+            status(r, POP_IND, cx + 1, *(iblocks + SIN_IND + cx));
+            if (take_map(r, *(iblocks + SIN_IND + cx), cx + 1, seq)) {
+                return -1;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/* 
+ * Public method
+ * Opens the drive for a recovery, read-only if the changes go to the
+ * patch file instead, a null patch writes them to the drive
+ * Returns the recovery, 0 if fail
+ */
+struct recover_s* init (const char *fname, const char *patch) {
+    struct recover_s *r;
+    struct stat st;
+
+    /* Pick the block predicate kernels for this CPU */
+    pthread_once(&simd_once, simd_init);
+
+    /* Every store starts out empty */
+    r = calloc(1, sizeof(*r));
+    if (!r) {
+        status(0, ERROR, "Out of memory for the recovery of: %s\n", fname);
+        return 0;
+    }
+    perf_begin(&r->perf, PERF_INIT);
+    r->devf = -1;
+    r->dev = MAP_FAILED;
+    r->scan_threads = 1;
+    r->scan_backend = BLKIO_MMAP;
+    r->ckpt_groups = CKPT_GROUPS;
+    r->scan_fd = -1;
+    r->cache_start = page_cache();
+    r->cache_peak = r->cache_start;
+    pthread_mutex_init(&r->prog_lock, 0);
+    pace_init(&r->pace);
+    r->info.nblocks = &r->nblocks;
+    r->info.ngroups = &r->ngroups;
+    r->info.ipg = &r->ipg;
+    r->info.ipb = &r->ipb;
+    r->info.bmp_starts = &r->bmp_starts;
+    r->info.indirects = r->indirects;
+    r->info.n_rec = &r->n_rec;
+    r->info.scan_bytes = &r->scan_bytes;
+    r->info.scan_msec = &r->scan_msec;
+    r->info.perf = &r->perf;
+
+    /* Save the names, the patch decides how the drive is opened */
+    r->info.name = calloc(strlen(fname) + 1, sizeof(*fname));
+    if (patch) {
+        r->patch_path = calloc(strlen(patch) + 1, sizeof(*patch));
+    }
+    if (!r->info.name || (patch && !r->patch_path)) {
+        status(r, ERROR, "Out of memory for the recovery of: %s\n", fname);
+        goto fail;
+    }
+    strcpy(r->info.name, fname);
+    if (patch) {
+        strcpy(r->patch_path, patch);
+    }
+
+    /* Attempt to open the device, read-only if the changes go to a patch */
+    r->devf = open(fname, (r->patch_path) ? O_RDONLY : O_RDWR);
+    if (r->devf < 0) {
+        status(r, ERROR, "Unable to open: %s\n", fname);
+        goto fail;
+    }
+
+    /* Get size of device, or of the image if it is a regular file */
+    if (fstat(r->devf, &st) == -1) {
+        status(r, ERROR, "Unable to stat: %s\n", fname);
+        goto fail;
+    }
+    if (S_ISREG(st.st_mode)) {
+        r->dev_size = st.st_size;
+    } else if (ioctl(r->devf, BLKGETSIZE, &r->dev_size) == -1) {
+        status(r, ERROR, "Unable to get size of device: %s\n", fname);
+        goto fail;
+    } else {
+        /* ioctl call gives number 512 byte sectors */
+        r->dev_size *= 512;
+    }
+    if (r->dev_size < BYTES_PER_BLOCK) {
+        status(r, ERROR, "Too small to hold a filesystem: %s\n", fname);
+        goto fail;
+    }
+
+    /* Attempt to mmap the device */
+    r->dev = mmap(0, r->dev_size,
+        (r->patch_path) ? PROT_READ : PROT_READ|PROT_WRITE,
+        MAP_SHARED, r->devf, 0);
+    if (r->dev == MAP_FAILED) {
+        status(r, ERROR, "Unable to mmap device: %s\n", fname);
+        goto fail;
+    }
+
+    /* Get the superblock */
+    r->sb = (struct sb_s*)(r->dev + SB_OFF);
+
+    /* Calculate the number of blocks on the drive */
+    /* Images can be padded past the end of the filesystem */
+    r->nblocks = r->dev_size / BYTES_PER_BLOCK;
+    if (r->sb->s_blocks_count_lo > 0 &&
+        r->sb->s_blocks_count_lo < r->nblocks) {
+        r->nblocks = r->sb->s_blocks_count_lo;
+    }
+
+    /* Calculate the number of groups on the drive, the last may be partial */
+    r->ngroups = (r->nblocks + BLOCKS_PER_GROUP - 1) / BLOCKS_PER_GROUP;
+
+    /* Get the number of inodes per group */
+    r->ipg = r->sb->s_inodes_per_group;
+
+    /* Calculate the number of inodes per block */
+    r->ipb = BYTES_PER_BLOCK / r->sb->s_inode_size;
+
+    /* Hold back metadata changes until they are committed */
+    txn_init(&r->txn, r->devf, r->dev);
+
+    /* Get information about each group */
+    if (get_group_info(r)) {
+        status(r, ERROR, "Error getting group information, exiting...\n");
+        goto fail;
+    }
+
+    perf_end(&r->perf, PERF_INIT);
+    return r;
+
+fail:
+    cleanup(r);
+    return 0;
+}
+
+/*
+ * Public method
+ * Gets the filesystem info of the recovery for the client
+ */
+const struct fs_info_s* fs_info (const struct recover_s *r) {
+    return &r->info;
+}
+
+/*
+ * Private method
+ * Queues a scan event for the reporter thread, never waits on the display
+ */
+void post (struct recover_s *r, enum status_code_e sl, uint32_t arg1,
+    uint32_t arg2) {
+    ring_push(&r->events, sl, arg1, arg2);
+}
+
+/*
+ * Private method
+ * Broadcasts the rate a throttled scan actually got since the last time,
+ * and the share of the caps it is held to
+ */
+void report_pace (struct recover_s *r, struct timespec *since,
+    uint64_t *bytes, uint64_t *ops) {
+    struct timespec now;
+    uint64_t msec;
+    uint64_t new_bytes;
+    uint64_t new_ops;
+    uint32_t scale;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    msec = (now.tv_sec - since->tv_sec) * 1000 +
+        (now.tv_nsec - since->tv_nsec) / 1000000;
+    msec = (msec > 0) ? msec : 1;
+    pace_snap(&r->pace, &new_bytes, &new_ops, &scale);
+    status(r, SCAN_PACE,
+        (uint32_t)((((new_bytes - *bytes) >> 10) * 1000 / msec) >> 10),
+        (uint32_t)((new_ops - *ops) * 1000 / msec),
+        scale * 100 / PACE_SCALE);
+    *since = now;
+    *bytes = new_bytes;
+    *ops = new_ops;
+}
+
+/*
+ * Private method
+ * Reporter thread, hands the queued events to status() in batches
+ * SCAN_BATCH follows each batch so the client can redraw once per batch
+ * It also keeps an eye on the page cache while the workers fill it, and
+ * on the rate of a throttled scan
+ */
+void* report_events (void *arg) {
+    struct recover_s *r = (struct recover_s*)arg;
+    struct event_s ev;
+    struct timespec pause;
+    struct timespec now;
+    struct timespec written;
+    struct timespec sampled;
+    struct timespec paced;
+    uint64_t pace_bytes;
+    uint64_t pace_ops;
+    uint32_t scale;
+    uint32_t n;
+    int stop;
+
+    pause.tv_sec = 0;
+    pause.tv_nsec = REPORT_NSEC;
+    clock_gettime(CLOCK_MONOTONIC, &written);
+    sampled = written;
+    paced = written;
+    pace_snap(&r->pace, &pace_bytes, &pace_ops, &scale);
+    for (;;) {
+        /* Read before draining, so the last drain sees every event */
+        stop = __atomic_load_n(&r->reporter_stop, __ATOMIC_ACQUIRE);
+        for (n = 0; n < REPORT_BATCH && ring_pop(&r->events, &ev); n++) {
+            if (ev.code == SCAN_IND) {
+                status(r, SCAN_IND, (int)ev.arg1, ev.arg2);
+            } else {
+                status(r, ev.code, ev.arg1);
+            }
+        }
+        if (n > 0) {
+            status(r, SCAN_BATCH);
+        }
+
+        /* Keep the metrics file current while the scan runs */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (r->prom_path && now.tv_sec - written.tv_sec >= METRICS_SEC) {
+            perf_prom(&r->perf, r->info.name, r->prom_path);
+            written = now;
+        }
+        if ((now.tv_sec - sampled.tv_sec) * 1000000000L +
+            (now.tv_nsec - sampled.tv_nsec) >= CACHE_NSEC) {
+            sample_cache(r);
+            sampled = now;
+        }
+        if (pace_on(&r->pace) && now.tv_sec - paced.tv_sec >= PACE_SEC) {
+            report_pace(r, &paced, &pace_bytes, &pace_ops);
+        }
+        if (n < REPORT_BATCH) {
+            if (stop) {
+                break;
+            }
+            nanosleep(&pause, 0);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Private method
+ * Starts the reporter thread, from then on only it calls status()
+ * until stop_reporter()
+ * Return 0 if success, -1 if fail
+ */
+int start_reporter (struct recover_s *r) {
+    __atomic_store_n(&r->reporter_stop, 0, __ATOMIC_RELEASE);
+    if (pthread_create(&r->reporter, 0, report_events, r)) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Private method
+ * Waits for the reporter thread to hand over every queued event and stop
+ */
+void stop_reporter (struct recover_s *r) {
+    uint32_t dropped;
+
+    __atomic_store_n(&r->reporter_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(r->reporter, 0);
+
+    dropped = __atomic_exchange_n(&r->events.dropped, 0, __ATOMIC_RELAXED);
+    if (dropped > 0) {
+        status(r, WARN, "%u scan events weren't shown, "
+            "the display fell behind\n", dropped);
+    }
+}
+
+/*
+ * Private method
+ * Adds the blocks scanned by a worker to the total, broadcasts the
+ * percentage through the disk
+ */
+void scan_progress (struct recover_s *r, uint32_t count) {
+    uint32_t cur_percent;
+
+    pthread_mutex_lock(&r->prog_lock);
+    r->scan_done += count;
+    cur_percent = (r->scan_total > 0) ?
+        (uint32_t)((uint64_t)r->scan_done * 100 / r->scan_total) : 100;
+    while (cur_percent >= r->scan_percent + 1) {
+        r->scan_percent += 1;
+        post(r, SCAN_PROG, r->scan_percent, 0);
+    }
+    pthread_mutex_unlock(&r->prog_lock);
+}
+
+/*
+ * Private method
+ * Steps the xorshift generator that places the samples of a forecast
+ */
+uint32_t sample_rand (uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/*
+ * Private method
+ * Reads the blocks [first, last) for a forecast and classifies the free
+ * ones as the scan would
+ * counts holds the free blocks classified, then the 1x, 2x, 3x indirects
+ * and BMP headers found, in the order of enum blk_class_e
+ * Return 0 if success, -1 if fail
+ */
+int sample_run (struct recover_s *r, struct scan_part_s *part,
+    uint32_t first, uint32_t last, uint64_t *counts) {
+    uint32_t cx;
+    const uint32_t *blk;
+    enum blk_class_e class;
+
+    /* One read for the run, nothing read ahead past it */
+    part->io = blkio_open(BLKIO_PREAD, r->devf, r->dev, first, last);
+    if (!part->io) {
+        return -1;
+    }
+    if (pace_on(&r->pace)) {
+        blkio_pace(part->io, &r->pace);
+    }
+
+    for (cx = next_free_block(r, first, last); cx < last;
+        cx = next_free_block(r, cx + 1, last)) {
+        blk = (const uint32_t*)blkio_stream(part->io, cx);
+        if (!blk) {
+            continue;
+        }
+        (*counts)++;
+        class = classify(r, part, cx, blk);
+        if (class != BLK_NONE) {
+            (*(counts + class))++;
+        }
+    }
+    if (r->cache_neutral) {
+        blkio_drop(part->io, first, last);
+    }
+
+    part->bytes += blkio_bytes(part->io);
+    blkio_close(part->io);
+    part->io = 0;
+    return 0;
+}
+
+/*
+ * Private method
+ * Drops the blocks of a part from where the last drop ended up to the
+ * given one, then reads the candidates among them back in on their own,
+ * collect() needs them again
+ */
+void drop_scanned (struct scan_part_s *part, uint32_t to) {
+    const struct cand_s *found;
+    size_t *pos;
+    uint32_t cx;
+
+    blkio_drop(part->io, part->dropped, to);
+    for (cx = 0; cx < 4; cx++) {
+        found = (cx == 0) ? &part->bmp_starts : part->indirects + cx - 1;
+        for (pos = part->kept + cx;
+            *pos < found->count && cand_get(found, *pos) < to; (*pos)++) {
+            blkio_keep(part->io, cand_get(found, *pos));
+        }
+    }
+    part->dropped = to;
+}
+
+/*
+ * Private method
+ * Closes the descriptor for direct reads, if the scan opened one
+ */
+void close_scan_fd (struct recover_s *r) {
+    if (r->scan_fd >= 0) {
+        close(r->scan_fd);
+        r->scan_fd = -1;
+    }
+}
+
+/*
+ * Private method
+ * Scans a group of the drive
+ * Candidates are kept in the part's own lists
+ * A cache neutral scan drops the group from the page cache behind it, the
+ * mapping reads ahead only for the group while the worker is in it
+ */
+void scan_part (struct recover_s *r, struct scan_part_s *part) {
+    uint32_t cx;
+    const uint32_t *blk;
+    enum blk_class_e class;
+    uint32_t reported = part->first;
+    uint32_t visited = 0;
+    uint32_t seen = 0;
+
+    /* Each worker streams its own range */
+    part->io = blkio_open(r->scan_backend,
+        (r->scan_fd >= 0) ? r->scan_fd : r->devf, r->dev,
+        part->first, part->last);
+    if (!part->io) {
+        set_fail(r, "Unable to open a block stream!\n");
+        return;
+    }
+    if (pace_on(&r->pace)) {
+        blkio_pace(part->io, &r->pace);
+    }
+    part->backend = blkio_backend(part->io);
+    part->dropped = part->first;
+    if (r->cache_neutral && part->backend == BLKIO_MMAP) {
+        posix_madvise(r->dev + BLOCK_OFF((size_t)part->first),
+            BLOCK_OFF((size_t)(part->last - part->first)),
+            POSIX_MADV_SEQUENTIAL);
+    }
+
+    /* Only visit blocks marked free */
+    for (cx = next_free_block(r, part->first, part->last);
+        cx < part->last;
+        cx = next_free_block(r, cx + 1, part->last)) {
+        /* Report progress in chunks to keep the lock quiet */
+        if (cx - reported >= BLOCKS_PER_GROUP / 8) {
+            scan_progress(r, cx - reported);
+            reported = cx;
+        }
+
+        if (r->cache_neutral && cx / DROP_BLOCKS * DROP_BLOCKS >
+            part->dropped) {
+            drop_scanned(part, cx / DROP_BLOCKS * DROP_BLOCKS);
+        }
+
+        /* Read the block in, skip it if unreadable */
+        visited++;
+        blk = (const uint32_t*)blkio_stream(part->io, cx);
+        if (!blk) {
+            continue;
+        }
+        seen++;
+
+        class = classify(r, part, cx, blk);
+        if (class == BLK_IND1 || class == BLK_IND2 || class == BLK_IND3) {
+            post(r, SCAN_IND, class, cx);
+            if (!cand_push(part->indirects + class - 1, cx)) {
+                set_fail(r, "Out of memory for candidates!\n");
+                break;
+            }
+        } else if (class == BLK_BMP) {
+            post(r, SCAN_BMP, cx, 0);
+            if (!cand_push(&part->bmp_starts, cx)) {
+                set_fail(r, "Out of memory for candidates!\n");
+                break;
+            }
+        }
+    }
+    if (r->cache_neutral) {
+        drop_scanned(part, part->last);
+        if (part->backend == BLKIO_MMAP) {
+            posix_madvise(r->dev + BLOCK_OFF((size_t)part->first),
+                BLOCK_OFF((size_t)(part->last - part->first)),
+                POSIX_MADV_RANDOM);
+            /* The last read ahead went on past the group */
+            posix_fadvise(r->devf, (off_t)BLOCK_OFF((uint64_t)part->last),
+                BLOCK_OFF((off_t)DROP_BLOCKS), POSIX_FADV_DONTNEED);
+        }
+    }
+    scan_progress(r, part->last - reported);
+
+    part->bytes = blkio_bytes(part->io);
+    blkio_close(part->io);
+
+    /* Once per group, so the workers don't fight over the counters */
+    perf_add(&r->perf, PERF_BLOCKS_SEEN, seen);
+    perf_add(&r->perf, PERF_BLOCKS_USED, part->last - part->first - visited);
+    perf_add(&r->perf, PERF_BYTES_READ, part->bytes);
+    perf_add(&r->perf, PERF_FOUND_BMP, part->bmp_starts.count);
+    for (cx = 0; cx < 3; cx++) {
+        perf_add(&r->perf, PERF_CMP_IND1 + cx, *(part->cmp_calls + cx));
+        perf_add(&r->perf, PERF_FOUND_IND1 + cx,
+            (part->indirects + cx)->count);
+    }
+}
+
+/*
+ * Private method
+ * Scans groups of the plan until there are none left
+ * Under a throttle the worker drops to idle priority while it scans, it
+ * may be the thread driving the recovery
+ */
+void* scan_worker (void *arg) {
+    struct scan_plan_s *plan = (struct scan_plan_s*)arg;
+    struct pace_prio_s prio;
+    int throttled = pace_on(&plan->r->pace);
+    uint32_t pos;
+
+    if (throttled) {
+        pace_idle(&prio);
+    }
+    for (;;) {
+        pos = __atomic_fetch_add(&plan->next, 1, __ATOMIC_RELAXED);
+        if (pos >= plan->count || plan->r->fail) {
+            break;
+        }
+        scan_part(plan->r, plan->parts +
+            (uint32_t)(*(plan->order + pos) & 0xFFFFFFFF));
+    }
+    if (throttled) {
+        pace_restore(&prio);
+    }
+
+    return 0;
+}
+
+/*
+ * Private method
+ * Saves the candidates found before the given block to the checkpoint file
+ * Written to a temporary file first so a crash never leaves a torn one
+ * Return 0 if success, -1 if fail
+ */
+int ckpt_save (struct recover_s *r, uint32_t next) {
+    struct ckpt_head_s head;
+    char *tmp;
+    FILE *f;
+    int cx;
+    int ok;
+
+    tmp = calloc(strlen(r->ckpt_path) + 5, sizeof(*tmp));
+    if (!tmp) {
+        return -1;
+    }
+    sprintf(tmp, "%s.tmp", r->ckpt_path);
+
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, CKPT_MAGIC, sizeof(head.magic));
+    memcpy(head.uuid, r->sb->s_uuid, sizeof(head.uuid));
+    head.nblocks = r->nblocks;
+    head.next = next;
+    *head.counts = r->bmp_starts.count;
+    for (cx = 0; cx < 3; cx++) {
+        *(head.counts + cx + 1) = (r->indirects + cx)->count;
+    }
+
+    f = fopen(tmp, "wb");
+    if (!f) {
+        free(tmp);
+        return -1;
+    }
+    ok = fwrite(&head, sizeof(head), 1, f) == 1;
+    ok = ok && cand_write(&r->bmp_starts, f);
+    for (cx = 0; cx < 3; cx++) {
+        ok = ok && cand_write(r->indirects + cx, f);
+    }
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = (fclose(f) == 0) && ok;
+    ok = ok && rename(tmp, r->ckpt_path) == 0;
+    if (!ok) {
+        unlink(tmp);
+    }
+    free(tmp);
+
+    if (!ok) {
+        return -1;
+    }
+    post(r, SCAN_CKPT, next, 0);
+    return 0;
+}
+
+/*
+ * Private method
+ * Loads the candidates from the checkpoint file if it matches the drive
+ * Returns the block to continue scanning from, 0 if nothing was loaded
+ */
+uint32_t ckpt_load (struct recover_s *r) {
+    struct ckpt_head_s head;
+    FILE *f;
+    int cx;
+    int ok;
+
+    f = fopen(r->ckpt_path, "rb");
+    if (!f) {
+        status(r, WARN, "No checkpoint at %s, starting from the beginning\n",
+            r->ckpt_path);
+        return 0;
+    }
+
+    /* The checkpoint must be for this filesystem, at its current size */
+    if (fread(&head, sizeof(head), 1, f) != 1 ||
+        memcmp(head.magic, CKPT_MAGIC, sizeof(head.magic)) ||
+        memcmp(head.uuid, r->sb->s_uuid, sizeof(head.uuid)) ||
+        head.nblocks != r->nblocks || head.next > r->nblocks ||
+        (head.next % BLOCKS_PER_GROUP && head.next != r->nblocks)) {
+        fclose(f);
+        status(r, WARN, "Checkpoint %s doesn't match the drive, "
+            "starting from the beginning\n", r->ckpt_path);
+        return 0;
+    }
+
+    ok = cand_read(&r->bmp_starts, f, *head.counts);
+    for (cx = 0; cx < 3; cx++) {
+        ok = ok && cand_read(r->indirects + cx, f, *(head.counts + cx + 1));
+    }
+    fclose(f);
+    if (!ok) {
+        cand_free(&r->bmp_starts);
+        for (cx = 0; cx < 3; cx++) {
+            cand_free(r->indirects + cx);
+        }
+        status(r, WARN, "Checkpoint %s is truncated, "
+            "starting from the beginning\n", r->ckpt_path);
+        return 0;
+    }
+
+    status(r, SCAN_RESUME, head.next);
+    return head.next;
+}
+
+/*
+ * Private method
+ * Saves the metadata changes to the patch file instead of the drive
+ * Return 0 if success, -1 if fail
+ */
+int patch_save (struct recover_s *r) {
+    struct patch_head_s head;
+    FILE *f;
+    int ok;
+
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, PATCH_MAGIC, sizeof(head.magic));
+    memcpy(head.uuid, r->sb->s_uuid, sizeof(head.uuid));
+    head.nblocks = r->nblocks;
+    head.count = r->txn.count;
+
+    f = fopen(r->patch_path, "wb");
+    if (!f) {
+        return -1;
+    }
+    ok = fwrite(&head, sizeof(head), 1, f) == 1;
+    ok = ok && !txn_save(&r->txn, f);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) {
+        return -1;
+    }
+
+    status(r, PATCH, head.count);
+    return 0;
+}
+
+/*
+ * Private method
+ * Orders the plan by its sort keys for qsort(3)
+ */
+int cmp_order (const void *a, const void *b) {
+    uint64_t ka = *(const uint64_t*)a;
+    uint64_t kb = *(const uint64_t*)b;
+
+    return (ka > kb) - (ka < kb);
+}
+
+/*
+ * Private method
+ * Counts the blocks of a group the scan has to go through
+ * Groups with no free blocks have nothing deleted in them, and groups
+ * whose blocks were never initialized never held any data
+ */
+uint32_t group_blocks (struct recover_s *r, uint32_t group) {
+    const struct gd_s *gd = *(r->gd + group);
+    uint32_t first = group * BLOCKS_PER_GROUP;
+
+    if (gd->bg_free_blocks_count_lo == 0 ||
+        (gd->bg_flags & BG_BLOCK_UNINIT)) {
+        return 0;
+    }
+    return (r->nblocks - first < BLOCKS_PER_GROUP) ?
+        r->nblocks - first : BLOCKS_PER_GROUP;
+}
+
+/*
+ * Private method
+ * Scans the groups in [first, last) worth scanning, split across the
+ * workers, then merges their results in block order onto the end of the
+ * candidate lists
+ * Failures are left in the recovery for scan() to report
+ * Returns the number of bytes read
+ */
+uint64_t scan_round (struct recover_s *r, uint32_t first, uint32_t last,
+    enum blkio_backend_e *backend) {
+    uint32_t cx;
+    uint32_t cx2;
+    uint32_t group;
+    uint32_t nthreads;
+    uint32_t nstarted;
+    struct scan_plan_s plan;
+    pthread_t *threads = 0;
+    uint64_t bytes = 0;
+
+    memset(&plan, 0, sizeof(plan));
+    plan.r = r;
+    plan.parts = calloc(last - first, sizeof(*plan.parts));
+    plan.order = calloc(last - first, sizeof(*plan.order));
+    if (!plan.parts || !plan.order) {
+        free(plan.parts);
+        free(plan.order);
+        set_fail(r, "Unable to allocate the scan plan!\n");
+        return 0;
+    }
+
+    /* Most free blocks first, ties in block order */
+    for (group = first; group < last; group++) {
+        if (group_blocks(r, group) == 0) {
+            continue;
+        }
+        (plan.parts + plan.count)->first = group * BLOCKS_PER_GROUP;
+        (plan.parts + plan.count)->last = group * BLOCKS_PER_GROUP +
+            group_blocks(r, group);
+        *(plan.order + plan.count) = ((uint64_t)(BLOCKS_PER_GROUP -
+            (*(r->gd + group))->bg_free_blocks_count_lo) << 32) | plan.count;
+        plan.count++;
+    }
+    qsort(plan.order, plan.count, sizeof(*plan.order), cmp_order);
+
+    /* Never more workers than groups */
+    nthreads = (r->scan_threads < plan.count) ? r->scan_threads : plan.count;
+    if (nthreads <= 1) {
+        scan_worker(&plan);
+    } else {
+        threads = calloc(nthreads, sizeof(*threads));
+        if (!threads) {
+            set_fail(r, "Unable to allocate the scan workers!\n");
+            nthreads = 0;
+        }
+        for (nstarted = 0; nstarted < nthreads; nstarted++) {
+            if (pthread_create(threads + nstarted, 0, scan_worker, &plan)) {
+                set_fail(r, "Unable to start a scan worker!\n");
+                break;
+            }
+        }
+        for (cx = 0; cx < nstarted; cx++) {
+            pthread_join(*(threads + cx), 0);
+        }
+        free(threads);
+    }
+
+    /* Merge the results in block order, full chunks are handed over */
+    for (cx = 0; cx < plan.count; cx++) {
+        bytes += (plan.parts + cx)->bytes;
+        if (!cand_splice(&r->bmp_starts, &(plan.parts + cx)->bmp_starts)) {
+            set_fail(r, "Out of memory for candidates!\n");
+        }
+        for (cx2 = 0; cx2 < 3; cx2++) {
+            if (!cand_splice(r->indirects + cx2,
+                (plan.parts + cx)->indirects + cx2)) {
+                set_fail(r, "Out of memory for candidates!\n");
+            }
+        }
+    }
+
+    /* Whatever a failed merge left behind */
+    for (cx = 0; cx < plan.count; cx++) {
+        cand_free(&(plan.parts + cx)->bmp_starts);
+        for (cx2 = 0; cx2 < 3; cx2++) {
+            cand_free((plan.parts + cx)->indirects + cx2);
+        }
+    }
+    if (plan.count > 0) {
+        *backend = (plan.parts + (uint32_t)*plan.order)->backend;
+    }
+    free(plan.parts);
+    free(plan.order);
+
+    return bytes;
+}
+
+/*
+ * Private method
+ * Adds up the blocks the scan goes through in the groups [first, last),
+ * and the free blocks it reads among them
+ * Returns the number of groups that will be scanned
+ */
+uint32_t plan_groups (struct recover_s *r, uint32_t first, uint32_t last,
+    uint32_t *blocks, uint32_t *free_blocks) {
+    uint32_t group;
+    uint32_t n = 0;
+
+    for (group = first; group < last; group++) {
+        if (group_blocks(r, group) > 0) {
+            *blocks += group_blocks(r, group);
+            *free_blocks += (*(r->gd + group))->bg_free_blocks_count_lo;
+            n++;
+        }
+    }
+    return n;
+}
+
+/*
+ * Private method
+ * Bytes the scan's backend reads to go through the planned blocks: the
+ * mapping only faults in the free ones, the others read every window
+ */
+uint64_t plan_bytes (struct recover_s *r, uint32_t blocks,
+    uint32_t free_blocks) {
+    return BLOCK_OFF((uint64_t)((r->scan_backend == BLKIO_MMAP) ?
+        free_blocks : blocks));
+}
+
+/*
+ * Private method
+ * Builds the files whose chains are complete with what was found so far,
+ * then writes them out so they can be used before the scan ends
+ * The reporter is paused meanwhile
+ * Return 0 if success, -1 if fail
+ */
+int stream_files (struct recover_s *r) {
+    struct cand_s waiting = CAND_EMPTY;
+    uint32_t bnum;
+    uint64_t bytes;
+    uint64_t pages;
+    size_t cx;
+    int built = 0;
+    int ret = 0;
+
+    if (index_indirects(r)) {
+        set_fail(r, "Out of memory for candidates!\n");
+        return -1;
+    }
+    stop_reporter(r);
+
+    /* Retry the ones still waiting, then the newly found ones */
+    for (cx = 0; !stop_reached(r) &&
+        cx < r->pending.count + r->bmp_starts.count - r->stream_pos; cx++) {
+        bnum = (cx < r->pending.count) ? cand_get(&r->pending, cx) :
+            cand_get(&r->bmp_starts,
+            r->stream_pos + cx - r->pending.count);
+        if (is_block_used(r, bnum)) {
+            continue;
+        }
+        if (!chain_found(r, bnum)) {
+            if (!cand_push(&waiting, bnum)) {
+                set_fail(r, "Out of memory for candidates!\n");
+                break;
+            }
+            continue;
+        }
+        ret = build_file(r, bnum);
+        if (ret < 0) {
+            break;
+        }
+        built += ret;
+    }
+    r->stream_pos = r->bmp_starts.count;
+    cand_free(&r->pending);
+    r->pending = waiting;
+
+    /* Write the files out, unless they go to the patch file */
+    if (!r->fail && built > 0 && !r->patch_path) {
+        if (txn_commit(&r->txn, &bytes, &pages)) {
+            /* The bitmaps still point into the copies */
+            txn_free(&r->txn);
+            point_bitmaps(r);
+            set_fail(r, "Unable to write the changes to the drive!\n");
+        } else {
+            point_bitmaps(r);
+            status(r, COMMIT, (uint32_t)bytes, (uint32_t)pages);
+        }
+    }
+
+    if (start_reporter(r)) {
+        set_fail(r, "Unable to start the reporter thread!\n");
+    }
+    return (r->fail) ? -1 : 0;
+}
+
+/*
+ * Public method
+ * Sets the number of worker threads used by scan()
+ */
+void set_scan_threads (struct recover_s *r, uint32_t n) {
+    r->scan_threads = (n > 0) ? n : 1;
+}
+
+/*
+ * Public method
+ * Sets the block access backend used by scan()
+ */
+void set_scan_backend (struct recover_s *r, enum blkio_backend_e backend) {
+    r->scan_backend = backend;
+}
+
+/*
+ * Public method
+ * Sets the file scan() checkpoints to every given number of groups
+ * A null path turns checkpoints off, as does running out of memory
+ * Return 0 if success, -1 if fail
+ */
+int set_checkpoint (struct recover_s *r, const char *path, uint32_t groups) {
+    if (r->ckpt_path) {
+        free(r->ckpt_path);
+        r->ckpt_path = 0;
+    }
+    r->ckpt_groups = (groups > 0) ? groups : CKPT_GROUPS;
+    if (!path) {
+        return 0;
+    }
+    r->ckpt_path = calloc(strlen(path) + 1, sizeof(*r->ckpt_path));
+    if (!r->ckpt_path) {
+        status(r, ERROR, "Out of memory for the checkpoint path!\n");
+        return -1;
+    }
+    strcpy(r->ckpt_path, path);
+    return 0;
+}
+
+/*
+ * Public method
+ * Sets the Prometheus text file the metrics are rewritten to during the
+ * recovery, it is written right away so a bad path shows up early
+ * A null path stops the rewrites
+ * Return 0 if success, -1 if fail
+ */
+int set_metrics (struct recover_s *r, const char *path) {
+    if (r->prom_path) {
+        free(r->prom_path);
+        r->prom_path = 0;
+    }
+    if (!path) {
+        return 0;
+    }
+    r->prom_path = calloc(strlen(path) + 1, sizeof(*r->prom_path));
+    if (!r->prom_path) {
+        return -1;
+    }
+    strcpy(r->prom_path, path);
+    return perf_prom(&r->perf, r->info.name, r->prom_path);
+}
+
+/*
+ * Public method
+ * Sets whether scan() continues from the checkpoint file
+ */
+void set_resume (struct recover_s *r, int resume) {
+    r->ckpt_resume = resume;
+}
+
+/*
+ * Public method
+ * Sets whether scan() builds files as soon as their chains are complete
+ * The drive is then scanned in rounds of the checkpoint groups
+ */
+void set_stream (struct recover_s *r, int stream) {
+    r->stream = stream;
+}
+
+/*
+ * Public method
+ * Stops the recovery after the given number of files, or after the file
+ * starting at the given block, zero for either means no limit
+ */
+void set_stop (struct recover_s *r, uint32_t files, uint32_t block) {
+    r->stop_files = files;
+    r->stop_block = block;
+}
+
+/*
+ * Public method
+ * Sets whether the recovery keeps out of the page cache, so the other
+ * users of the machine keep theirs
+ * The scan drops what it read as it goes, or with the pread and uring
+ * backends reads around the cache altogether, and nothing else reads
+ * ahead of what it needs
+ */
+void set_cache_neutral (struct recover_s *r, int on) {
+    r->cache_neutral = on;
+    posix_madvise(r->dev, r->dev_size,
+        (on) ? POSIX_MADV_RANDOM : POSIX_MADV_NORMAL);
+    posix_fadvise(r->devf, 0, 0,
+        (on) ? POSIX_FADV_RANDOM : POSIX_FADV_NORMAL);
+}
+
+/*
+ * Public method
+ * Holds scan() to the given MiB/s and reads per second, zero for no cap,
+ * both zero for a scan at full speed
+ * A throttled scan runs its workers at idle I/O and CPU priority, and
+ * backs off further while the drive is slow to answer
+ */
+void set_throttle (struct recover_s *r, uint32_t mib_per_s, uint32_t iops) {
+    pace_set(&r->pace, mib_per_s, iops);
+}
+
+/*
+ * Public method
+ * Forecasts what scan() will find and how long it will take, by sampling
+ * the groups it would read
+ * permille / 1000 of the blocks the scan goes through are read, at least
+ * SAMPLE_RUNS runs of up to SAMPLE_BLOCKS spread evenly over the groups
+ * worth scanning, each at a random place in its stretch
+ * The free blocks among them are classified as the scan would, and the
+ * counts scaled up to all the free blocks the scan reads
+ * The runs are read with pread(2) one at a time whatever the backend, so
+ * nothing is read ahead past them, the time they took scaled up to the
+ * blocks the scan goes through is the ETA for a single worker
+ * Return 0 if success, -1 if fail
+ */
+int estimate (struct recover_s *r, uint32_t permille) {
+    struct scan_part_s part;
+    struct timespec start;
+    struct timespec end;
+    uint64_t counts [5];
+    uint64_t covered = 0;
+    uint64_t msec;
+    uint64_t scan_read;
+    uint32_t planned = 0;
+    uint32_t free_blocks = 0;
+    uint32_t seed = 2463534242UL;
+    uint32_t group;
+    uint32_t first;
+    uint32_t len;
+    uint32_t runs;
+    uint32_t stride;
+    uint32_t span;
+    uint32_t run = 0;
+    /*
+     * Where the next run starts, and where the group starts, counted in the
+     * blocks the scan goes through
+     */
+    uint32_t next;
+    uint32_t base = 0;
+    uint32_t from;
+    uint32_t to;
+    uint32_t cx;
+
+    perf_begin(&r->perf, PERF_ESTIMATE);
+    permille = (permille < 1) ? 1 : (permille > 1000) ? 1000 : permille;
+    status(r, ESTIMATE, permille);
+
+    /* The indirect tests share what they learn, as in the scan */
+    r->ind_memo = calloc(((size_t)r->nblocks + 15) / 16,
+        sizeof(*r->ind_memo));
+    if (!r->ind_memo) {
+        status(r, ERROR, "Unable to allocate the indirect test results!\n");
+        end_phase(r, PERF_ESTIMATE);
+        return -1;
+    }
+    memset(&part, 0, sizeof(part));
+    memset(counts, 0, sizeof(counts));
+    plan_groups(r, 0, r->ngroups, &planned, &free_blocks);
+
+    /* A run per stretch, they only touch when every block is read */
+    runs = ((uint64_t)planned * permille / 1000 + SAMPLE_BLOCKS - 1) /
+        SAMPLE_BLOCKS;
+    runs = (runs > SAMPLE_RUNS) ? runs : SAMPLE_RUNS;
+    stride = (planned / runs > 0) ? planned / runs : 1;
+    span = (stride < SAMPLE_BLOCKS) ? stride : SAMPLE_BLOCKS;
+    next = (stride > span) ? sample_rand(&seed) % (stride - span + 1) : 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (group = 0; group < r->ngroups && run < runs; group++) {
+        len = group_blocks(r, group);
+        if (len == 0) {
+            continue;
+        }
+        first = group * BLOCKS_PER_GROUP;
+
+        /* Runs that start in the group, cut short at its end */
+        while (run < runs && next < base + len) {
+            from = first + (next - base);
+            to = (from + span < first + len) ? from + span : first + len;
+            if (sample_run(r, &part, from, to, counts)) {
+                free(r->ind_memo);
+                r->ind_memo = 0;
+                status(r, ERROR, "Unable to open a block stream!\n");
+                end_phase(r, PERF_ESTIMATE);
+                return -1;
+            }
+            covered += to - from;
+            run++;
+            next = run * stride + ((stride > span) ?
+                sample_rand(&seed) % (stride - span + 1) : 0);
+        }
+        base += len;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(r->ind_memo);
+    r->ind_memo = 0;
+
+    msec = (end.tv_sec - start.tv_sec) * 1000 +
+        (end.tv_nsec - start.tv_nsec) / 1000000;
+    msec = (msec > 0) ? msec : 1;
+    covered = (covered > 0) ? covered : 1;
+    status(r, EST_SAMPLE, (uint32_t)*counts, free_blocks);
+
+    /* Scale the finds up from the free blocks sampled to all of them */
+    for (cx = 1; cx < 5; cx++) {
+        *(counts + cx) = (*counts > 0) ?
+            *(counts + cx) * free_blocks / *counts : 0;
+    }
+    status(r, EST_CAND, (uint32_t)*(counts + BLK_BMP),
+        (uint32_t)*(counts + BLK_IND1), (uint32_t)*(counts + BLK_IND2),
+        (uint32_t)*(counts + BLK_IND3));
+
+    scan_read = plan_bytes(r, planned, free_blocks);
+    status(r, EST_TIME, (uint32_t)(scan_read >> 20),
+        (uint32_t)(((part.bytes >> 10) * 1000 / msec) >> 10),
+        (uint32_t)(msec * planned / covered / 1000));
+    status(r, DONE);
+
+    end_phase(r, PERF_ESTIMATE);
+    return 0;
+}
+
+/*
+ * Public method
+ * Scan the drive for all BMP header blocks and indirect blocks
+ * Groups with no free blocks or uninitialized blocks are skipped, workers
+ * take the others one at a time, the ones with the most free blocks first
+ * The results are merged in block order
+ * With a checkpoint file the drive is scanned in rounds of groups, saving
+ * the results after each round
+ * When streaming, files are built after each round, and the scan ends
+ * early once enough are recovered
+ * Return 1 if BMP header blocks were found, 0 if none, -1 if fail
+ */
+int scan (struct recover_s *r) {
+    uint32_t cx;
+    uint32_t group;
+    uint32_t round;
+    uint32_t next = 0;
+    uint32_t ckpt_fails = 0;
+    uint32_t planned = 0;
+    uint32_t done = 0;
+    uint32_t free_blocks = 0;
+    uint32_t done_free = 0;
+    uint32_t n_groups;
+    enum blkio_backend_e backend = r->scan_backend;
+    struct timespec start;
+    struct timespec end;
+    uint64_t bytes = 0;
+    uint64_t msec;
+
+    perf_begin(&r->perf, PERF_SCAN);
+
+    /* Nothing left to look for */
+    r->fail = 0;
+    if (stop_reached(r)) {
+        end_phase(r, PERF_SCAN);
+        return 0;
+    }
+
+    /* Drop the results of any earlier scan */
+    r->stream_pos = 0;
+    cand_free(&r->pending);
+    cand_free(&r->bmp_starts);
+    for (cx = 0; cx < 3; cx++) {
+        cand_free(r->indirects + cx);
+        cand_map_free(r->ind_maps + cx);
+    }
+
+    /* Nothing is known about any block yet */
+    r->ind_memo = calloc(((size_t)r->nblocks + 15) / 16,
+        sizeof(*r->ind_memo));
+    if (!r->ind_memo) {
+        status(r, ERROR, "Unable to allocate the indirect test results!\n");
+        end_phase(r, PERF_SCAN);
+        return -1;
+    }
+
+    /* Scan the drive for important blocks */
+    status(r, SCAN);
+    if (r->ckpt_path && r->ckpt_resume) {
+        next = ckpt_load(r);
+    }
+
+    /* Plan out what is left to read */
+    group = next / BLOCKS_PER_GROUP;
+    n_groups = plan_groups(r, group, r->ngroups, &planned, &free_blocks);
+    status(r, SCAN_PLAN, (uint32_t)(plan_bytes(r, planned, free_blocks) >> 20),
+        free_blocks, n_groups, r->ngroups - group - n_groups);
+
+    /* Read around the page cache if the backend and the device can */
+    if (r->cache_neutral && r->scan_backend != BLKIO_MMAP) {
+        r->scan_fd = blkio_direct(r->info.name);
+        if (r->scan_fd < 0) {
+            status(r, WARN, "Direct reads not supported, dropping the "
+                "scanned blocks from the page cache instead\n");
+        }
+    }
+
+    /* Events from the workers are shown by the reporter thread */
+    if (ring_init(&r->events)) {
+        set_fail(r, "Unable to allocate the event ring!\n");
+    } else if (start_reporter(r)) {
+        ring_free(&r->events);
+        set_fail(r, "Unable to start the reporter thread!\n");
+    }
+    if (r->fail) {
+        free(r->ind_memo);
+        r->ind_memo = 0;
+        close_scan_fd(r);
+        status(r, ERROR, "%s", r->fail);
+        end_phase(r, PERF_SCAN);
+        return -1;
+    }
+    r->scan_done = 0;
+    r->scan_percent = 0;
+    plan_groups(r, 0, next / BLOCKS_PER_GROUP, &done, &done_free);
+    r->scan_total = done + planned;
+    scan_progress(r, done);
+
+    round = (r->ckpt_path || r->stream) ? r->ckpt_groups : r->ngroups;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (group = next / BLOCKS_PER_GROUP; !r->fail && !stop_reached(r) &&
+        group < r->ngroups; group += round) {
+        next = (r->ngroups - group > round) ? group + round : r->ngroups;
+        bytes += scan_round(r, group, next, &backend);
+        /* Only the reporter may call status() until the scan ends */
+        if (!r->fail && r->ckpt_path && ckpt_save(r, (next < r->ngroups) ?
+            next * BLOCKS_PER_GROUP : r->nblocks)) {
+            ckpt_fails++;
+        }
+        if (!r->fail && r->stream) {
+            stream_files(r);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stop_reporter(r);
+    ring_free(&r->events);
+    free(r->ind_memo);
+    r->ind_memo = 0;
+    close_scan_fd(r);
+    cand_free(&r->pending);
+    if (ckpt_fails > 0) {
+        status(r, WARN, "Unable to write checkpoint %u times: %s\n",
+            ckpt_fails, r->ckpt_path);
+    }
+    if (!r->fail && index_indirects(r)) {
+        set_fail(r, "Out of memory for candidates!\n");
+    }
+    if (r->fail) {
+        status(r, ERROR, "%s", r->fail);
+        end_phase(r, PERF_SCAN);
+        return -1;
+    }
+
+    /* Broadcast the throughput of the backend */
+    msec = (end.tv_sec - start.tv_sec) * 1000 +
+        (end.tv_nsec - start.tv_nsec) / 1000000;
+    msec = (msec > 0) ? msec : 1;
+    r->scan_bytes = bytes;
+    r->scan_msec = msec;
+    status(r, SCAN_RATE, blkio_name(backend), (uint32_t)(bytes >> 20),
+        (uint32_t)(((bytes >> 10) * 1000 / msec) >> 10));
+    report_cache(r);
+    status(r, DONE);
+
+    /* Test if BMP start blocks gathered */
+    end_phase(r, PERF_SCAN);
+    return (r->bmp_starts.count > 0) ? 1 : 0;
+}
+
+/*
+ * Public method
+ * Looks through the ext3 journal for copies of inode table blocks from
+ * before a BMP file was deleted, and takes the file back as the newest
+ * copy had it, with the indirects as they were logged by then
+ * Nothing is done if the filesystem has no journal
+ * Return the number of files taken back, -1 if fail
+ */
+int scan_journal (struct recover_s *r) {
+    const struct jnl_copy_s *c;
+    const struct inode_s *ino;
+    uint8_t *tried;
+    uint32_t jnum = r->sb->s_journal_num;
+    uint32_t group;
+    uint32_t slot;
+    uint32_t index;
+    uint32_t inum;
+    uint32_t first;
+    size_t cx;
+    int found = 0;
+    int ret;
+
+    perf_begin(&r->perf, PERF_JOURNAL);
+
+    if (!(r->sb->s_feature_compat & COMPAT_JOURNAL) || jnum == 0 ||
+        jnum > r->sb->s_inodes_count) {
+        end_phase(r, PERF_JOURNAL);
+        return 0;
+    }
+
+    r->fail = 0;
+    status(r, JOURNAL);
+    ino = (const struct inode_s*)(r->dev + BLOCK_OFF((*(r->gd +
+        (jnum - 1) / r->ipg))->bg_inode_table_lo) +
+        ((jnum - 1) % r->ipg) * r->sb->s_inode_size);
+    if (jnl_load(&r->jnl, r->dev, r->nblocks, ino)) {
+        jnl_free(&r->jnl);
+        status(r, WARN, "Unable to read the journal, skipping...\n");
+        end_phase(r, PERF_JOURNAL);
+        return 0;
+    }
+
+    /* Only the newest copy of an inode from before the delete is used */
+    tried = calloc(r->sb->s_inodes_count / 8 + 1, sizeof(*tried));
+    if (!tried) {
+        set_fail(r, "Unable to allocate the journal inode map!\n");
+    }
+    for (cx = r->jnl.count; !r->fail && !stop_reached(r) && cx > 0; cx--) {
+        c = r->jnl.copies + cx - 1;
+        group = itable_group(r, c->block);
+        if (group-- == 0) {
+            continue;
+        }
+        index = (c->block - (*(r->gd + group))->bg_inode_table_lo) *
+            r->ipb;
+        for (slot = 0; !r->fail && !stop_reached(r) && slot < r->ipb &&
+            index + slot < r->ipg; slot++) {
+            ino = (const struct inode_s*)(c->data +
+                slot * r->sb->s_inode_size);
+            inum = group * r->ipg + index + slot + 1;
+            first = *(const uint32_t*)(ino->i_block);
+
+            /* Live regular files then, deleted now, on a BMP header */
+            if (inum < r->sb->s_first_ino || BMP_BIT(tried, inum - 1) ||
+                BMP_BIT(*(r->inode_bmps + group), index + slot) ||
+                ino->i_dtime != 0 || ino->i_links_count == 0 ||
+                (ino->i_mode & TYPE_MASK) != TYPE_REG ||
+                (ino->i_flags & FLAG_EXTENTS) ||
+                first == 0 || first >= r->nblocks ||
+                is_block_used(r, first) ||
+                magic_check(r->dev + BLOCK_OFF(first))) {
+                continue;
+            }
+            set_bmp_bit(tried, inum - 1);
+            status(r, JOURNAL_BMP, inum, c->seq);
+
+            ret = revive(r, inum, ino, c->seq);
+            if (ret == 0) {
+                status(r, WARN, "Blocks reused, skipping...\n");
+            } else if (ret < 0 || link(r, inum)) {
+                break;
+            } else {
+                count_file(r, first);
+                found++;
+            }
+        }
+    }
+    free(tried);
+    jnl_free(&r->jnl);
+    if (r->fail) {
+        txn_free(&r->txn);
+        point_bitmaps(r);
+        status(r, ERROR, "%s", r->fail);
+        end_phase(r, PERF_JOURNAL);
+        return -1;
+    }
+    status(r, DONE);
+
+    end_phase(r, PERF_JOURNAL);
+    return found;
+}
+
+/*
+ * Public method
+ * Looks through the inode tables for deleted BMP files whose blocks are
+ * all still free, and takes them back as they were
+ * Their blocks are marked used, so a scan() after it skips them
+ * The changes are kept until collect()
+ * Return the number of files taken back, -1 if fail
+ */
+int scan_inodes (struct recover_s *r) {
+    uint32_t group;
+    uint32_t cx;
+    uint32_t inum;
+    uint32_t first;
+    const uint8_t *table;
+    const struct inode_s *ino;
+    int found = 0;
+    int ret;
+
+    perf_begin(&r->perf, PERF_ITABLE);
+
+    r->fail = 0;
+    status(r, ITABLE);
+    for (group = 0; !r->fail && !stop_reached(r) && group < r->ngroups;
+        group++) {
+        table = r->dev + BLOCK_OFF((*(r->gd + group))->bg_inode_table_lo);
+        for (cx = 0; !r->fail && !stop_reached(r) && cx < r->ipg; cx++) {
+            inum = group * r->ipg + cx + 1;
+            ino = (const struct inode_s*)(table + cx * r->sb->s_inode_size);
+            first = *(const uint32_t*)(ino->i_block);
+
+            /* Deleted regular files starting on a free BMP header block */
+            if (inum < r->sb->s_first_ino ||
+                BMP_BIT(*(r->inode_bmps + group), cx) ||
+                ino->i_dtime == 0 || ino->i_links_count != 0 ||
+                (ino->i_mode & TYPE_MASK) != TYPE_REG ||
+                (ino->i_flags & FLAG_EXTENTS) ||
+                first == 0 || first >= r->nblocks ||
+                is_block_used(r, first) ||
+                magic_check(r->dev + BLOCK_OFF(first))) {
+                continue;
+            }
+            status(r, ITABLE_BMP, inum, first);
+
+            ret = revive(r, inum, ino, 0);
+            if (ret == 0) {
+                status(r, WARN, "Blocks reused, skipping...\n");
+            } else if (ret < 0 || link(r, inum)) {
+                break;
+            } else {
+                count_file(r, first);
+                found++;
+            }
+        }
+    }
+    if (r->fail) {
+        txn_free(&r->txn);
+        point_bitmaps(r);
+        status(r, ERROR, "%s", r->fail);
+        end_phase(r, PERF_ITABLE);
+        return -1;
+    }
+    status(r, DONE);
+
+    end_phase(r, PERF_ITABLE);
+    return found;
+}
+
+/*
+ * Public method
+ * Builds the complete files out of the file shards
+ * If anything fails none of the changes are kept
+ * Return 0 if success, -1 if fail
+ */
+int collect (struct recover_s *r) {
+    uint32_t cx;
+    uint64_t bytes;
+    uint64_t pages;
+
+    perf_begin(&r->perf, PERF_COLLECT);
+
+    r->fail = 0;
+    status(r, COLLECT);
+    /* Go through every potential BMP header block found */
+    for (cx = 0; !stop_reached(r) && cx < r->bmp_starts.count; cx++) {
+        if (build_file(r, cand_get(&r->bmp_starts, cx)) < 0) {
+            break;
+        }
+    }
+    if (r->fail) {
+        txn_free(&r->txn);
+        point_bitmaps(r);
+        status(r, ERROR, "%s", r->fail);
+        end_phase(r, PERF_COLLECT);
+        return -1;
+    }
+
+    /* Keep the drive untouched, the patch can be applied later */
+    if (r->patch_path) {
+        if (patch_save(r)) {
+            status(r, ERROR, "Unable to save the patch: %s!\n",
+                r->patch_path);
+            end_phase(r, PERF_COLLECT);
+            return -1;
+        }
+        report_cache(r);
+        status(r, DONE);
+        end_phase(r, PERF_COLLECT);
+        return 0;
+    }
+
+    /* Write every change out in one ordered pass */
+    if (txn_commit(&r->txn, &bytes, &pages)) {
+        /* The bitmaps still point into the copies */
+        txn_free(&r->txn);
+        point_bitmaps(r);
+        status(r, ERROR, "Unable to write the changes to %s!\n",
+            r->info.name);
+        end_phase(r, PERF_COLLECT);
+        return -1;
+    }
+    point_bitmaps(r);
+    status(r, COMMIT, (uint32_t)bytes, (uint32_t)pages);
+    report_cache(r);
+    status(r, DONE);
+    end_phase(r, PERF_COLLECT);
+    return 0;
+}
+
+/*
+ * Public method
+ * Writes the changes saved in a patch file to the drive
+ * Refuses if the patch is for another filesystem, or if any block it
+ * changes was changed on the drive since the patch was made
+ * Return 0 if success, -1 if fail
+ */
+int apply_patch (struct recover_s *r, const char *path) {
+    struct patch_head_s head;
+    FILE *f;
+    uint64_t bytes;
+    uint64_t pages;
+    uint32_t stale;
+
+    status(r, APPLY);
+    f = fopen(path, "rb");
+    if (!f) {
+        status(r, ERROR, "Unable to open the patch: %s\n", path);
+        return -1;
+    }
+    if (fread(&head, sizeof(head), 1, f) != 1 ||
+        memcmp(head.magic, PATCH_MAGIC, sizeof(head.magic)) ||
+        memcmp(head.uuid, r->sb->s_uuid, sizeof(head.uuid)) ||
+        head.nblocks != r->nblocks) {
+        fclose(f);
+        status(r, ERROR, "Patch %s is not for this filesystem!\n", path);
+        return -1;
+    }
+    if (txn_load(&r->txn, f, head.count, r->nblocks)) {
+        fclose(f);
+        txn_free(&r->txn);
+        status(r, ERROR, "Unable to read the patch: %s\n", path);
+        return -1;
+    }
+    fclose(f);
+
+    stale = txn_stale(&r->txn);
+    if (stale > 0) {
+        txn_free(&r->txn);
+        status(r, ERROR, "%u blocks changed since the patch was made, "
+            "not applying!\n", stale);
+        return -1;
+    }
+
+    if (txn_commit(&r->txn, &bytes, &pages)) {
+        txn_free(&r->txn);
+        status(r, ERROR, "Unable to write the changes to %s!\n",
+            r->info.name);
+        return -1;
+    }
+    status(r, COMMIT, (uint32_t)bytes, (uint32_t)pages);
+    status(r, DONE);
+    return 0;
 }
@@ -3,15 +3,31 @@
 
 #include <stdint.h>
 
+#include "blkio.h"
+#include "cand.h"
+#include "perf.h"
+
 struct fs_info_s {
     char *name;
     const uint32_t *nblocks;
     const uint32_t *ngroups;
     const size_t *ipg;
     const size_t *ipb;
+    /* Candidates found by the last scan, in block order */
+    const struct cand_s *bmp_starts;
+    /* 1x, 2x, 3x indirects */
+    const struct cand_s *indirects;
+    /* Files recovered so far */
+    const uint32_t *n_rec;
+    /* Bytes read and milliseconds taken by the last scan */
+    const uint64_t *scan_bytes;
+    const uint64_t *scan_msec;
+    /* Counters and phase timers, read them through perf_snap() */
+    const struct perf_s *perf;
 };
 
-extern struct fs_info_s fs_info;
+/* One drive being recovered, any number can be open at once */
+struct recover_s;
 
 /*
  * Status codes Meaning                                 Args
@@ -24,13 +40,44 @@ extern struct fs_info_s fs_info;
  * POP_IND      populated ind block                     level(u32), bnum(u32)
  * LINK         started linking inode to root           inum(u32)
  * RECOVERED    file sucessfully linked                 name(char*)
+ * ESTIMATE     started sampling a scan forecast        permille(u32)
+ * EST_SAMPLE   free blocks sampled, out of all those   sampled(u32),
+ *              the scan reads                          free(u32)
+ * EST_CAND     candidates the scan should find         bmp(u32), ind1(u32),
+ *                                                      ind2(u32), ind3(u32)
+ * EST_TIME     expected scan read, sampled throughput, mib(u32),
+ *              and time to read it with one worker     mib_per_s(u32),
+ *                                                      eta_sec(u32)
  * SCAN         started drive scan                      ---
+ * SCAN_PLAN    groups planned for the scan, what the   mib(u32),
+ *              backend reads and the free blocks       free(u32),
+ *              among it                                groups(u32),
+ *                                                      skipped(u32)
  * SCAN_IND     found potential ind block               level(int), bnum(u32)
  * SCAN_BMP     found potential bmp header              bnum(u32)
  * SCAN_PROG    percentage through disk (1% interval)   percent(u32)
+ * SCAN_RATE    scan throughput                         backend(char*),
+ *                                                      mib(u32),
+ *                                                      mib_per_s(u32)
+ * SCAN_PACE    throttled scan rate, and the share of   mib_per_s(u32),
+ *              the caps it is held to                  iops(u32),
+ *                                                      percent(u32)
+ * SCAN_CKPT    checkpoint written                      next(u32)
+ * SCAN_RESUME  resumed from checkpoint                 next(u32)
+ * SCAN_BATCH   end of a batch of scan events           ---
+ * ITABLE       started inode table scan                ---
+ * ITABLE_BMP   found deleted bmp inode                 inum(u32), bnum(u32)
+ * JOURNAL      started journal scan                    ---
+ * JOURNAL_BMP  found bmp inode copy in the journal     inum(u32), seq(u32)
  * COLLECT      started collecting files                ---
  * SANITY       running sanity check                    bnum(u32)
  * INODE        inode reserved                          inum(u32)
+ * COMMIT       changes written to the drive            bytes(u32),
+ *                                                      pages(u32)
+ * PATCH        changes saved to the patch file         blocks(u32)
+ * APPLY        started applying a patch file           ---
+ * CACHE        page cache peak, and growth since init  peak_mib(u32),
+ *                                                      grown_mib(u32)
  * DONE         operation complete                      ---
  * ERROR        fatal error                             format(char*), ...
  * WARN         warning                                 format(char*), ...
@@ -42,35 +89,128 @@ enum status_code_e {
     GROUP_INFO, GROUP_PROG,
     POP,        POP_DIR,    POP_IND,
     LINK,       RECOVERED,
-    SCAN,       SCAN_IND,   SCAN_BMP,   SCAN_PROG,
-    COLLECT,    SANITY,     INODE,
+    ESTIMATE,   EST_SAMPLE, EST_CAND,   EST_TIME,
+    SCAN,       SCAN_PLAN,  SCAN_IND,   SCAN_BMP,   SCAN_PROG,
+                SCAN_RATE,  SCAN_PACE,  SCAN_CKPT,  SCAN_RESUME,
+                SCAN_BATCH,
+    ITABLE,     ITABLE_BMP,
+    JOURNAL,    JOURNAL_BMP,
+    COLLECT,    SANITY,     INODE,      COMMIT,     PATCH,
+    APPLY,      CACHE,
     /* General method done code */
     DONE,
     /* Error codes */
     ERROR,      WARN
 };
 
-/* THIS MUST BE IMPLEMENTED ON THE CLIENT */
-void status (enum status_code_e sl, ...);
+/*
+ * THIS MUST BE IMPLEMENTED ON THE CLIENT
+ * r is the recovery the status is about, null if there is none yet
+ * During a scan, SCAN_IND, SCAN_BMP, SCAN_PROG, SCAN_PACE, SCAN_CKPT and
+ * SCAN_BATCH come from its reporter thread, never at the same time as
+ * other calls about the same recovery
+ */
+void status (struct recover_s *r, enum status_code_e sl, ...);
 
 /*
- * Private methods:
- * void cleanup ()
- * void get_group_info ()
+ * Private methods, those the microbenchmark times are declared in
+ * recover_int.h:
+ * int get_group_info (struct recover_s *r)
+ * void point_bitmaps (struct recover_s *r)
+ * void set_fail (struct recover_s *r, const char *msg)
+ * uint64_t page_cache ()
+ * void sample_cache (struct recover_s *r)
+ * void report_cache (struct recover_s *r)
+ * void end_phase (struct recover_s *r, enum perf_phase_e ph)
+ * uint8_t* meta_block (struct recover_s *r, uint32_t block)
  * void set_bmp_bit (uint8_t *bmp, uint32_t bit)
- * int is_block_used (uint32_t block)
- * uint32_t mark_used (uint32_t block, uint32_t ind)
- * uint32_t find_next_ind (uint32_t last, uint32_t ind)
- * uint32_t res_ino_helper (uint32_t inum)
- * uint32_t res_ino ()
- * int cmp_bmp (uint32_t block)
- * int cmp_ind (uint32_t block, uint32_t ind)
- * void populate (uint32_t inum)
- * void link (uint32_t inum)
+ * int is_block_used (struct recover_s *r, uint32_t block)
+ * uint32_t next_free_block (struct recover_s *r, uint32_t block,
+ *     uint32_t end)
+ * uint32_t mark_used (struct recover_s *r, uint32_t block, uint32_t ind)
+ * uint32_t ind_key (struct recover_s *r, uint32_t block, uint32_t ind)
+ * int index_indirects (struct recover_s *r)
+ * uint32_t find_next_ind (struct recover_s *r, uint32_t last, uint32_t ind)
+ * uint32_t res_ino_helper (struct recover_s *r, uint32_t inum)
+ * uint32_t res_ino (struct recover_s *r)
+ * uint32_t memo_get (struct recover_s *r, uint32_t block)
+ * void memo_set (struct recover_s *r, uint32_t block, uint32_t state)
+ * int ptr_shape (struct recover_s *r, const uint32_t *blk)
+ * int cmp_children (struct recover_s *r, struct scan_part_s *part,
+ *     const uint32_t *blk, uint32_t ind)
+ * int cmp_ind (struct recover_s *r, struct scan_part_s *part,
+ *     uint32_t block, uint32_t ind)
+ * enum blk_class_e classify (struct recover_s *r, struct scan_part_s *part,
+ *     uint32_t block, const uint32_t *blk)
+ * int populate (struct recover_s *r, uint32_t inum, uint32_t start)
+ * int link (struct recover_s *r, uint32_t inum)
+ * int stop_reached (struct recover_s *r)
+ * void count_file (struct recover_s *r, uint32_t start)
+ * uint32_t last_listed (struct recover_s *r, uint32_t block, uint32_t ind)
+ * int chain_found (struct recover_s *r, uint32_t start)
+ * int build_file (struct recover_s *r, uint32_t bnum)
+ * uint32_t itable_group (struct recover_s *r, uint32_t block)
+ * const uint8_t* block_at (struct recover_s *r, uint32_t block, uint32_t seq)
+ * int map_free (struct recover_s *r, uint32_t block, uint32_t ind,
+ *     uint32_t *need, uint32_t seq)
+ * int take_map (struct recover_s *r, uint32_t block, uint32_t ind,
+ *     uint32_t seq)
+ * int revive (struct recover_s *r, uint32_t inum, const struct inode_s *ino,
+ *     uint32_t seq)
+ * void post (struct recover_s *r, enum status_code_e sl, uint32_t arg1,
+ *     uint32_t arg2)
+ * void report_pace (struct recover_s *r, struct timespec *since,
+ *     uint64_t *bytes, uint64_t *ops)
+ * void* report_events (void *arg)
+ * int start_reporter (struct recover_s *r)
+ * void stop_reporter (struct recover_s *r)
+ * void scan_progress (struct recover_s *r, uint32_t count)
+ * uint32_t sample_rand (uint32_t *state)
+ * int sample_run (struct recover_s *r, struct scan_part_s *part,
+ *     uint32_t first, uint32_t last, uint64_t *counts)
+ * void drop_scanned (struct scan_part_s *part, uint32_t to)
+ * void close_scan_fd (struct recover_s *r)
+ * void scan_part (struct recover_s *r, struct scan_part_s *part)
+ * void* scan_worker (void *arg)
+ * int ckpt_save (struct recover_s *r, uint32_t next)
+ * uint32_t ckpt_load (struct recover_s *r)
+ * int patch_save (struct recover_s *r)
+ * int cmp_order (const void *a, const void *b)
+ * uint32_t group_blocks (struct recover_s *r, uint32_t group)
+ * uint64_t scan_round (struct recover_s *r, uint32_t first, uint32_t last,
+ *     enum blkio_backend_e *backend)
+ * uint32_t plan_groups (struct recover_s *r, uint32_t first, uint32_t last,
+ *     uint32_t *blocks, uint32_t *free_blocks)
+ * uint64_t plan_bytes (struct recover_s *r, uint32_t blocks,
+ *     uint32_t free_blocks)
+ * int stream_files (struct recover_s *r)
  */
 
-void init (const char *fname);
-int scan ();
-void collect ();
+/* Default number of groups scanned between checkpoints */
+#define CKPT_GROUPS (16)
+
+/*
+ * Failures are sent as ERROR and returned, the recovery stays usable
+ * until cleanup()
+ */
+struct recover_s* init (const char *fname, const char *patch);
+void cleanup (struct recover_s *r);
+const struct fs_info_s* fs_info (const struct recover_s *r);
+void set_scan_threads (struct recover_s *r, uint32_t n);
+void set_scan_backend (struct recover_s *r, enum blkio_backend_e backend);
+int set_checkpoint (struct recover_s *r, const char *path,
+    uint32_t groups);
+void set_resume (struct recover_s *r, int resume);
+int set_metrics (struct recover_s *r, const char *path);
+void set_stream (struct recover_s *r, int stream);
+void set_stop (struct recover_s *r, uint32_t files, uint32_t block);
+void set_cache_neutral (struct recover_s *r, int on);
+void set_throttle (struct recover_s *r, uint32_t mib_per_s, uint32_t iops);
+int estimate (struct recover_s *r, uint32_t permille);
+int scan (struct recover_s *r);
+int scan_journal (struct recover_s *r);
+int scan_inodes (struct recover_s *r);
+int collect (struct recover_s *r);
+int apply_patch (struct recover_s *r, const char *path);
 
 #endif /* RECOVER_H_20191111_183020 */
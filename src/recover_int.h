@@ -0,0 +1,128 @@
+#ifndef RECOVER_INT_H_20261017_093512
+#define RECOVER_INT_H_20261017_093512
+
+/*
+ * Internals of recover.c shared with the microbenchmark, which times the
+ * block predicates on their own over a drive it builds in memory
+ * Clients only get the opaque struct recover_s from recover.h
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "blkio.h"
+#include "cand.h"
+#include "ext.h"
+#include "jnl.h"
+#include "pace.h"
+#include "perf.h"
+#include "recover.h"
+#include "ring.h"
+#include "txn.h"
+
+/* Everything known about one drive being recovered */
+struct recover_s {
+    int devf;
+    size_t dev_size;
+    uint8_t *dev;
+    uint32_t nblocks;
+    uint32_t ngroups;
+    struct sb_s *sb;
+    size_t ipg;
+    size_t ipb;
+    struct gd_s **gd;
+    uint8_t **block_bmps;
+    uint8_t **inode_bmps;
+    struct cand_s bmp_starts;
+    struct cand_s indirects [3];
+    /* Indirects by their first listed block */
+    struct cand_map_s ind_maps [3];
+    struct inode_s *ino;
+    /* Metadata changes made by collect(), written out when it finishes */
+    struct txn_s txn;
+    /* In read-only mode the changes are saved here instead */
+    char *patch_path;
+    uint32_t n_rec;
+    char target_name [100];
+    uint32_t scan_threads;
+    enum blkio_backend_e scan_backend;
+    uint32_t scan_done;
+    uint32_t scan_total;
+    uint32_t scan_percent;
+    uint64_t scan_bytes;
+    uint64_t scan_msec;
+    pthread_mutex_t prog_lock;
+    /* Scan events waiting for the reporter thread */
+    struct ring_s events;
+    pthread_t reporter;
+    int reporter_stop;
+    char *ckpt_path;
+    uint32_t ckpt_groups;
+    int ckpt_resume;
+    /* What the indirect tests made of each block, see below */
+    uint32_t *ind_memo;
+    /* Copies logged by the ext3 journal, only held by scan_journal() */
+    struct jnl_s jnl;
+    /* Build files during the scan, stop once enough are recovered */
+    int stream;
+    uint32_t stop_files;
+    uint32_t stop_block;
+    int stop_hit;
+    /* Candidates the stream has gone through, and those still waiting */
+    size_t stream_pos;
+    struct cand_s pending;
+    /* Counters and phase timers, rewritten to prom_path as they go */
+    struct perf_s perf;
+    char *prom_path;
+    /*
+     * Keep the scan from filling the page cache: read around it, or drop
+     * what was read once it is behind the cursor
+     */
+    int cache_neutral;
+    int scan_fd;
+    /* Page cache of the whole system when the recovery began, and at most */
+    uint64_t cache_start;
+    uint64_t cache_peak;
+    /* Caps on the scan's reads, its workers run at idle priority under them */
+    struct pace_s pace;
+    /* Can be used by the client to access filesystem info */
+    struct fs_info_s info;
+    /* First failure of a scan worker, reported once they are all done */
+    const char *fail;
+};
+
+/* A group of the drive, scanned by whichever worker takes it first */
+struct scan_part_s {
+    uint32_t first;
+    uint32_t last;
+    struct blkio_s *io;
+    uint64_t bytes;
+    enum blkio_backend_e backend;
+    /*
+     * Indirect tests run by the worker, by the level tested for: the ones
+     * classify() runs on a block itself and the ones cmp_ind() runs on the
+     * blocks a 2x or 3x lists, memo hits included
+     * Blocks the shape tests rule out first are not counted
+     */
+    uint64_t cmp_calls [3];
+    struct cand_s bmp_starts;
+    struct cand_s indirects [3];
+    /*
+     * For a cache neutral scan, every block before this is dropped, and
+     * the candidates read back in, by list
+     */
+    uint32_t dropped;
+    size_t kept [4];
+};
+
+/* The block predicates, see recover.c */
+void point_bitmaps (struct recover_s *r);
+void set_bmp_bit (uint8_t *bmp, uint32_t bit);
+int is_block_used (struct recover_s *r, uint32_t block);
+uint32_t mark_used (struct recover_s *r, uint32_t block, uint32_t ind);
+int index_indirects (struct recover_s *r);
+uint32_t find_next_ind (struct recover_s *r, uint32_t last, uint32_t ind);
+int cmp_ind (struct recover_s *r, struct scan_part_s *part,
+    uint32_t block, uint32_t ind);
+
+#endif /* RECOVER_INT_H_20261017_093512 */
@@ -0,0 +1,84 @@
+#include <stdlib.h>
+
+#include "ring.h"
+
+/*
+ * Public method
+ * Sets up an empty ring, every slot free for the push of its index
+ */
+int ring_init (struct ring_s *r) {
+    uint32_t cx;
+
+    r->slots = malloc(RING_SIZE * sizeof(*r->slots));
+    if (!r->slots) {
+        return -1;
+    }
+    for (cx = 0; cx < RING_SIZE; cx++) {
+        (r->slots + cx)->seq = cx;
+    }
+    r->head = 0;
+    r->tail = 0;
+    r->dropped = 0;
+    return 0;
+}
+
+/*
+ * Public method
+ * Claims the next slot with a compare-and-swap on the head, fills it in,
+ * then hands it to the consumer through its sequence number
+ */
+int ring_push (struct ring_s *r, uint32_t code, uint32_t arg1, uint32_t arg2) {
+    struct ring_slot_s *slot;
+    uint32_t pos;
+    int32_t dif;
+
+    pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = r->slots + (pos & (RING_SIZE - 1));
+        dif = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 0,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            /* Still holds an event from a lap ago, full */
+            __atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        } else {
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->ev.code = code;
+    slot->ev.arg1 = arg1;
+    slot->ev.arg2 = arg2;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Public method
+ * Takes the event at the tail if its producer has finished with it
+ */
+int ring_pop (struct ring_s *r, struct event_s *ev) {
+    struct ring_slot_s *slot = r->slots + (r->tail & (RING_SIZE - 1));
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != r->tail + 1) {
+        return 0;
+    }
+    *ev = slot->ev;
+    /* Free for the push one lap ahead */
+    __atomic_store_n(&slot->seq, r->tail + RING_SIZE, __ATOMIC_RELEASE);
+    r->tail++;
+    return 1;
+}
+
+/*
+ * Public method
+ * Releases the slots
+ */
+void ring_free (struct ring_s *r) {
+    free(r->slots);
+    r->slots = 0;
+}
@@ -0,0 +1,56 @@
+#ifndef RING_H_20261017_001204
+#define RING_H_20261017_001204
+
+#include <stdint.h>
+
+/* A status broadcast with only number arguments, small enough to queue */
+struct event_s {
+    uint32_t code;
+    uint32_t arg1;
+    uint32_t arg2;
+};
+
+#define RING_SIZE   (65536)
+
+struct ring_slot_s {
+    uint32_t seq;
+    struct event_s ev;
+};
+
+/*
+ * Bounded queue of events, any number of threads push, one thread pops
+ * Pushing never blocks or takes a lock, a full ring drops the event
+ * Each slot's sequence number says whose turn it is (Vyukov's scheme)
+ */
+struct ring_s {
+    struct ring_slot_s *slots;
+    /* Keep the producer and consumer ends on their own cache lines */
+    uint8_t pad1 [64];
+    uint32_t head;
+    uint8_t pad2 [64];
+    uint32_t tail;
+    uint8_t pad3 [64];
+    uint32_t dropped;
+};
+
+/*
+ * Sets up an empty ring
+ * Returns 0 if success, -1 if out of memory
+ */
+int ring_init (struct ring_s *r);
+
+/*
+ * Queues an event, safe from any thread
+ * Returns 0 if success, -1 if the ring was full and the event dropped
+ */
+int ring_push (struct ring_s *r, uint32_t code, uint32_t arg1, uint32_t arg2);
+
+/*
+ * Takes the oldest event off the ring, only ever from one thread
+ * Returns 1 if an event was taken, 0 if the ring is empty
+ */
+int ring_pop (struct ring_s *r, struct event_s *ev);
+
+void ring_free (struct ring_s *r);
+
+#endif /* RING_H_20261017_001204 */
@@ -0,0 +1,228 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "bmp.h"
+#include "ext.h"
+#include "simd.h"
+
+#define ENTRIES     (BYTES_PER_BLOCK / sizeof(uint32_t))
+
+int (*ind1_check) (const uint32_t *blk) = ind1_check_scalar;
+int (*zero_tail) (const uint32_t *blk, uint32_t from) = zero_tail_scalar;
+
+/*
+ * Test if a block is a potential 1x indirect, one entry at a time
+ * Entries come in sets of 4 consecutive block numbers, the listing may end
+ * anywhere after the first entry and is followed by only zeros
+ * Return 0 if potential indirect, 1 if not
+ */
+int ind1_check_scalar (const uint32_t *blk) {
+    uint32_t cx;
+    uint32_t cx2;
+
+    /* The listing can't be empty */
+    if (*blk == 0) {
+        return 1;
+    }
+
+    for (cx = 0; cx < ENTRIES; cx += 4) {
+        /* Test if listing ends on first of a set of 4 */
+        if (*(blk + cx) == 0) {
+            return zero_tail_scalar(blk, cx + 1);
+        }
+
+        /* Test if chunks of 4 are consecutive or zero found */
+        for (cx2 = 1; cx2 < 4; cx2++) {
+            if (*(blk + (cx + cx2)) == 0) {
+                return zero_tail_scalar(blk, cx + cx2 + 1);
+            }
+            if (*(blk + (cx + cx2)) != *(blk + (cx + cx2 - 1)) + 1) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Test if every entry from the given one on is zero
+ * Return 0 if only zeros, 1 if not
+ */
+int zero_tail_scalar (const uint32_t *blk, uint32_t from) {
+    uint32_t cx;
+
+    for (cx = from; cx < ENTRIES; cx++) {
+        if (*(blk + cx) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * SSE2 version of zero_tail
+ * OR the tail together 16 bytes at a time and test once
+ */
+__attribute__((target("sse2")))
+int zero_tail_sse2 (const uint32_t *blk, uint32_t from) {
+    __m128i acc = _mm_setzero_si128();
+
+    /* Step up to a multiple of 4 entries */
+    for (; from < ENTRIES && from % 4 != 0; from++) {
+        if (*(blk + from) != 0) {
+            return 1;
+        }
+    }
+    for (; from < ENTRIES; from += 4) {
+        acc = _mm_or_si128(acc,
+            _mm_loadu_si128((const __m128i*)(blk + from)));
+    }
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128()))
+        != 0xFFFF;
+}
+
+/*
+ * SSE2 version of ind1_check
+ * One vector holds a set of 4, shifting it up one entry lines each entry
+ * up with the one before it
+ */
+__attribute__((target("sse2")))
+int ind1_check_sse2 (const uint32_t *blk) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi32(1);
+    __m128i v;
+    __m128i z;
+    __m128i ok;
+    uint32_t cx;
+    int nonzero;
+
+    if (*blk == 0) {
+        return 1;
+    }
+
+    for (cx = 0; cx < ENTRIES; cx += 4) {
+        v = _mm_loadu_si128((const __m128i*)(blk + cx));
+        z = _mm_cmpeq_epi32(v, zero);
+        nonzero = ~_mm_movemask_ps(_mm_castsi128_ps(z)) & 0x0F;
+
+        /* Every entry but the first is the previous plus one, or zero */
+        ok = _mm_or_si128(z,
+            _mm_cmpeq_epi32(v, _mm_add_epi32(_mm_slli_si128(v, 4), one)));
+        if ((_mm_movemask_ps(_mm_castsi128_ps(ok)) & 0x0E) != 0x0E) {
+            return 1;
+        }
+
+        /* Listing ended, the non-zero entries must come first */
+        if (nonzero != 0x0F) {
+            if (nonzero & (nonzero + 1)) {
+                return 1;
+            }
+            return zero_tail_sse2(blk, cx + 4);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * AVX2 version of zero_tail
+ */
+__attribute__((target("avx2")))
+int zero_tail_avx2 (const uint32_t *blk, uint32_t from) {
+    __m256i acc = _mm256_setzero_si256();
+
+    /* Step up to a multiple of 8 entries */
+    for (; from < ENTRIES && from % 8 != 0; from++) {
+        if (*(blk + from) != 0) {
+            return 1;
+        }
+    }
+    for (; from < ENTRIES; from += 8) {
+        acc = _mm256_or_si256(acc,
+            _mm256_loadu_si256((const __m256i*)(blk + from)));
+    }
+
+    return !_mm256_testz_si256(acc, acc);
+}
+
+/*
+ * AVX2 version of ind1_check
+ * Two sets of 4 per vector, the byte shift stays within each 128 bit lane
+ * so it never carries between sets
+ */
+__attribute__((target("avx2")))
+int ind1_check_avx2 (const uint32_t *blk) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+    __m256i v;
+    __m256i z;
+    __m256i ok;
+    uint32_t cx;
+    int nonzero;
+
+    if (*blk == 0) {
+        return 1;
+    }
+
+    for (cx = 0; cx < ENTRIES; cx += 8) {
+        v = _mm256_loadu_si256((const __m256i*)(blk + cx));
+        z = _mm256_cmpeq_epi32(v, zero);
+        nonzero = ~_mm256_movemask_ps(_mm256_castsi256_ps(z)) & 0xFF;
+
+        /* Every entry but the first of a set is the previous plus one */
+        ok = _mm256_or_si256(z, _mm256_cmpeq_epi32(v,
+            _mm256_add_epi32(_mm256_slli_si256(v, 4), one)));
+        if ((_mm256_movemask_ps(_mm256_castsi256_ps(ok)) & 0xEE) != 0xEE) {
+            return 1;
+        }
+
+        /* Listing ended, the non-zero entries must come first */
+        if (nonzero != 0xFF) {
+            if (nonzero & (nonzero + 1)) {
+                return 1;
+            }
+            return zero_tail_avx2(blk, cx + 8);
+        }
+    }
+
+    return 0;
+}
+#endif
+
+/*
+ * Test if a block starts with the BMP magic
+ * Only two bytes, a single 16 bit compare beats any vector setup
+ * Return 0 if it does, nonzero otherwise
+ */
+int magic_check (const uint8_t *blk) {
+    uint16_t head;
+    uint16_t magic;
+
+    memcpy(&head, blk, sizeof(head));
+    memcpy(&magic, BMP_MAGIC, sizeof(magic));
+
+    return head != magic;
+}
+
+/*
+ * Pick the kernels for the running CPU
+ */
+void simd_init () {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        ind1_check = ind1_check_avx2;
+        zero_tail = zero_tail_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        ind1_check = ind1_check_sse2;
+        zero_tail = zero_tail_sse2;
+    }
+#endif
+}
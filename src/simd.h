@@ -0,0 +1,36 @@
+#ifndef SIMD_H_20261016_141502
+#define SIMD_H_20261016_141502
+
+#include <stdint.h>
+
+/*
+ * Block predicate kernels
+ * Each takes a block as an array of block numbers (or raw bytes)
+ * Return 0 if the block matches, nonzero if not
+ *
+ * ind1_check   block is a potential 1x indirect
+ * zero_tail    entries from the given index to the end are all zero
+ * magic_check  block starts with the BMP magic
+ *
+ * The _scalar, _sse2, and _avx2 versions all give the same answer, the
+ * function pointers are set to the fastest one the CPU supports
+ */
+
+extern int (*ind1_check) (const uint32_t *blk);
+extern int (*zero_tail) (const uint32_t *blk, uint32_t from);
+
+int ind1_check_scalar (const uint32_t *blk);
+int zero_tail_scalar (const uint32_t *blk, uint32_t from);
+#if defined(__x86_64__) || defined(__i386__)
+int ind1_check_sse2 (const uint32_t *blk);
+int zero_tail_sse2 (const uint32_t *blk, uint32_t from);
+int ind1_check_avx2 (const uint32_t *blk);
+int zero_tail_avx2 (const uint32_t *blk, uint32_t from);
+#endif
+
+int magic_check (const uint8_t *blk);
+
+/* Pick the kernels for the running CPU */
+void simd_init ();
+
+#endif /* SIMD_H_20261016_141502 */
@@ -30,6 +30,18 @@
 
 #define DT_BLK      6
 
+#define OPT_THREADS 0
+#define OPT_CKPT    1
+#define OPT_GROUPS  2
+#define OPT_RESUME  3
+#define OPT_PATCH   4
+#define OPT_CACHE   5
+#define OPT_PACE    6
+#define OPT_FCAST   7
+#define N_OPTIONS   8
+#define OPT_LEN     64
+#define PATH_LEN    256
+
 struct win_s {
     WINDOW *win;
     chtype *title;
@@ -62,11 +74,6 @@ struct prog_win_s {
     int cur_y;
 };
 
-struct pot_block_s {
-    uint32_t *blocks;
-    uint32_t count;
-};
-
 struct file_info_s {
     char *name;
     uint32_t inum;
@@ -81,14 +88,28 @@ struct win_s err;
 struct win_s err_shadow;
 struct win_s blk_dev;
 struct win_s blk_dev_shadow;
+struct win_s opts;
+struct win_s opts_shadow;
+struct win_s prompt;
+struct win_s prompt_shadow;
+struct win_s fcast;
+struct win_s fcast_shadow;
+struct win_s quit;
+struct win_s quit_shadow;
 struct prog_win_s prog;
 struct prog_win_s prog_shadow;
 
-struct pot_block_s pots [4] = {
-    { (uint32_t*)0, 0 },
-    { (uint32_t*)0, 0 },
-    { (uint32_t*)0, 0 },
-    { (uint32_t*)0, 0 }
+/*
+ * Forecast of the scan: free blocks sampled and all of them, the BMP, 1x,
+ * 2x, 3x blocks expected, the MiB to read, the sampled MiB/s, and seconds
+ */
+uint32_t fcast_sample [2];
+uint32_t fcast_pots [4];
+uint32_t fcast_time [3];
+
+/* Live counts of the potential BMP, 1x, 2x, 3x blocks during a scan */
+uint32_t pots [4] = {
+    0, 0, 0, 0
 };
 
 /*
@@ -106,6 +127,23 @@ int n_block_devices = 0;
 int block_dev_choice = -1;
 int file_count = 0;
 struct file_info_s *files = 0;
+/* File being rebuilt, listed once it is recovered */
+struct file_info_s cur_file;
+/* Files recovered since the changes were last written out */
+int files_pending = 0;
+/* The drive being recovered, 0 until one is selected */
+struct recover_s *rec = 0;
+uint32_t opt_threads = 1;
+char opt_ckpt [PATH_LEN] = "";
+uint32_t opt_groups = CKPT_GROUPS;
+int opt_resume = 0;
+int opt_cache = 0;
+/* Caps on the scan's reads, zero for none */
+uint32_t opt_pace_mib = 0;
+uint32_t opt_pace_iops = 0;
+/* Per mille of the drive sampled to forecast the scan, zero for none */
+uint32_t opt_fcast = 1;
+char opt_patch [PATH_LEN] = "";
 
 /*
  * Turns a char* into a chtype*
@@ -219,7 +257,7 @@ void create_error (enum status_code_e s, const char *fmt, va_list ap) {
  * Update the progress display
  */
 void update_progress (int new_p) {
-    char percent_prog_str [6];
+    char percent_prog_str [7];
     /* Draw the shadow */
     wborder(prog_shadow.win,
         SHADOW, SHADOW, SHADOW, SHADOW,
@@ -236,8 +274,13 @@ void update_progress (int new_p) {
         prog.percent = new_p;
         prog.bar_w += 1;
         /* Update the increment threshold */
-        prog.segment_inc = (100 - new_p) /
-            (prog.text_w - (2 + 6 + 3 + prog.bar_w));
+        /* The bar can fill up early on narrow windows, eg short paths */
+        if (prog.text_w > 2 + 6 + 3 + prog.bar_w) {
+            prog.segment_inc = (100 - new_p) /
+                (prog.text_w - (2 + 6 + 3 + prog.bar_w));
+        } else {
+            prog.segment_inc = 100;
+        }
     }
     /* Create the percent string */
     sprintf(percent_prog_str, "% 3d%% ", new_p);
@@ -304,7 +347,7 @@ void setup_scan_progress () {
     const char *scan_msg_p1 = "Scan of ";
     const char *scan_msg_p2 = " in progress...";
     char *scan_msg_str = calloc(strlen(scan_msg_p1) + strlen(scan_msg_p2) +
-        strlen(fs_info.name) + 1, sizeof(*scan_msg_str));
+        strlen(fs_info(rec)->name) + 1, sizeof(*scan_msg_str));
     char *bar_perim_top_str;
     char *bar_perim_bot_str;
     unsigned int x;
@@ -317,7 +360,7 @@ void setup_scan_progress () {
     unsigned int bar_len;
 
     if (!scan_msg_str) {
-        status(ERROR, "Calloc failed on scan_msg_str");
+        status(0, ERROR, "Calloc failed on scan_msg_str");
         exit(-1);
     }
     
@@ -375,7 +418,7 @@ void setup_scan_progress () {
     prog.title = strchtype(prog.title, title, prog.title_len);
     /* Build the message that goes abve the progress bar */
     prog.scan_msg_len = sprintf(scan_msg_str, "%s%s%s",
-        scan_msg_p1, fs_info.name, scan_msg_p2);
+        scan_msg_p1, fs_info(rec)->name, scan_msg_p2);
     prog.scan_msg = strchtype(prog.scan_msg, scan_msg_str, prog.scan_msg_len);
     prog.percent_prog = strchtype(prog.percent_prog, "  0% ", 5);
 
@@ -400,16 +443,16 @@ void log_potential_blocks () {
     /* Print the statistics so far */
     mvwprintw(op.win, y + 1, 1,
         "Number of potential 3x indirect blocks found: %u",
-        (pots + 3)->count);
+        *(pots + 3));
     mvwprintw(op.win, y + 2, 1,
         "Number of potential 2x indirect blocks found: %u",
-        (pots + 2)->count);
+        *(pots + 2));
     mvwprintw(op.win, y + 3, 1,
         "Number of potential 1x indirect blocks found: %u",
-        (pots + 1)->count);
+        *(pots + 1));
     mvwprintw(op.win, y + 4, 1,
         "Number of potential BMP blocks found: %u",
-        (pots + 0)->count);
+        *(pots + 0));
     wmove(op.win, y, x);
 
     /* Schedule it to be shown */
@@ -422,15 +465,16 @@ void log_potential_blocks () {
 void display_scan_results () {
     uint32_t cx;
     uint32_t cx2;
+    const struct fs_info_s *info = fs_info(rec);
 
     werase(op.win);
 
     /* List potential BMP header blocks */
     wmove(op.win, 1, 1);
     wprintw(op.win, "Potential BMP Headers");
-    for (cx = 0; cx < pots->count; cx++) {
+    for (cx = 0; cx < info->bmp_starts->count; cx++) {
         wmove(op.win, cx + 2, 1);
-        wprintw(op.win, "%u", *(pots->blocks + cx));
+        wprintw(op.win, "%u", cand_get(info->bmp_starts, cx));
     }
 
     /* List potential indirect blocks */
@@ -438,9 +482,9 @@ void display_scan_results () {
         wmove(op.win, 1, op.text_w * cx / 4);
         wprintw(op.win, "Potential %ux Indirects", cx);
 
-        for (cx2 = 0; cx2 < (pots + cx)->count; cx2++) {
+        for (cx2 = 0; cx2 < (info->indirects + cx - 1)->count; cx2++) {
             wmove(op.win, cx2 + 2, op.text_w * cx / 4);
-            wprintw(op.win, "%u", *((pots + cx)->blocks + cx2));
+            wprintw(op.win, "%u", cand_get(info->indirects + cx - 1, cx2));
         }
     }
 }
@@ -506,7 +550,7 @@ void display_recovery_results () {
 /* 
  * Recieve the broadcasted status
  */
-void status (enum status_code_e sl, ...) {
+void status (struct recover_s *r, enum status_code_e sl, ...) {
     va_list ap;
     int y;
     int x;
@@ -514,10 +558,12 @@ void status (enum status_code_e sl, ...) {
     uint32_t var2;
     uint32_t var3;
     char *var4;
+    uint32_t var5;
 
     switch (sl) {
     /* Handle methods */
     case CLEANUP:
+    case APPLY:
         break;
 
     case GROUP_INFO:
@@ -559,9 +605,9 @@ void status (enum status_code_e sl, ...) {
         var3 = va_arg(ap, uint32_t);
         va_end(ap);
 
-        /* Put the direct blocks into the proper entry in the array */
-        (files + file_count - 1)->first_dir = var2;
-        (files + file_count - 1)->last_dir = var3;
+        /* Put the direct blocks into the file being rebuilt */
+        cur_file.first_dir = var2;
+        cur_file.last_dir = var3;
 
         getyx(op.win, y, x);
         if (y > op.text_h) {
@@ -581,8 +627,8 @@ void status (enum status_code_e sl, ...) {
         var3 = va_arg(ap, uint32_t);
         va_end(ap);
 
-        /* Put the indirect block into the proper entry in the array */
-        *((files + file_count - 1)->indirs + var2 - 1) = var3;
+        /* Put the indirect block into the file being rebuilt */
+        *(cur_file.indirs + var2 - 1) = var3;
 
         getyx(op.win, y, x);
         if (y > op.text_h) {
@@ -619,11 +665,15 @@ void status (enum status_code_e sl, ...) {
         var4 = va_arg(ap, char*);
         va_end(ap);
 
-        /* Put the file name into the proper entry in the array */
+        /* List the file, whichever pass rebuilt it */
+        file_count++;
+        files = realloc(files, file_count * sizeof(*files));
+        *(files + file_count - 1) = cur_file;
         (files + file_count - 1)->name =
             calloc(strlen(var4) + 1,
                 sizeof(*((files + file_count - 1)->name)));
         strcpy((files + file_count - 1)->name, var4);
+        files_pending++;
 
         getyx(op.win, y, x);
         if (y > op.text_h) {
@@ -637,13 +687,75 @@ void status (enum status_code_e sl, ...) {
         wnoutrefresh(op.win);
         break;
 
+    case ESTIMATE:
+        va_start(ap, sl);
+        var2 = va_arg(ap, uint32_t);
+        va_end(ap);
+
+        werase(op.win);
+        /* Set up border */
+        wborder(op.win,
+            /* Left, right, top, bottom sides */
+            BOX_VER, BOX_VER, BOX_HOR, BOX_HOR,
+            BOX_TL, BOX_TR, BOX_BL, BOX_BR);
+
+        /* Draw title */
+        mvwaddchstr(op.win, 0, 1, op.title);
+        mvwprintw(op.win, 1, 1,
+            "Sampling %u per mille of the drive to forecast the scan...",
+            var2);
+        wmove(op.win, 2, 1);
+        wnoutrefresh(op.win);
+        break;
+    case EST_SAMPLE:
+        va_start(ap, sl);
+        for (var1 = 0; var1 < 2; var1++) {
+            *(fcast_sample + var1) = va_arg(ap, uint32_t);
+        }
+        va_end(ap);
+        break;
+    case EST_CAND:
+        va_start(ap, sl);
+        for (var1 = 0; var1 < 4; var1++) {
+            *(fcast_pots + var1) = va_arg(ap, uint32_t);
+        }
+        va_end(ap);
+        break;
+    case EST_TIME:
+        va_start(ap, sl);
+        for (var1 = 0; var1 < 3; var1++) {
+            *(fcast_time + var1) = va_arg(ap, uint32_t);
+        }
+        va_end(ap);
+        break;
+
     case SCAN:
         drive_scanned = 1;
+        memset(pots, 0, sizeof(pots));
         setup_scan_progress();
         log_potential_blocks();
         wnoutrefresh(prog_shadow.win);
         wnoutrefresh(prog.win);
         break;
+    case SCAN_PLAN:
+        va_start(ap, sl);
+        /*
+         * Extract the MiB to read, the free blocks, the groups scanned
+         * and skipped
+         */
+        var2 = va_arg(ap, uint32_t);
+        var3 = va_arg(ap, uint32_t);
+        var1 = va_arg(ap, uint32_t);
+        var5 = va_arg(ap, uint32_t);
+        va_end(ap);
+
+        getyx(op.win, y, x);
+        mvwprintw(op.win, y + 7, 1,
+            "Reading %u MiB for %u free blocks in %u groups, skipping %u "
+            "groups", var2, var3, var1, var5);
+        wmove(op.win, y, x);
+        wnoutrefresh(op.win);
+        break;
     case SCAN_IND:
         va_start(ap, sl);
         /* Extract the indirect level and block number */
@@ -651,11 +763,8 @@ void status (enum status_code_e sl, ...) {
         var2 = va_arg(ap, uint32_t);
         va_end(ap);
 
-        /* Track the newcomer */
-        (pots + var1)->count += 1;
-        (pots + var1)->blocks = realloc((pots + var1)->blocks,
-            (pots + var1)->count * sizeof(*(pots + var1)->blocks));
-        *((pots + var1)->blocks + (pots + var1)->count - 1) = var2;
+        /* Count the newcomer, the blocks are kept by the scan */
+        *(pots + var1) += 1;
 
         log_potential_blocks();
         wnoutrefresh(prog_shadow.win);
@@ -667,11 +776,8 @@ void status (enum status_code_e sl, ...) {
         var2 = va_arg(ap, uint32_t);
         va_end(ap);
 
-        /* Track the newcomer */
-        pots->count += 1;
-        pots->blocks = realloc(pots->blocks,
-            pots->count * sizeof(*pots->blocks));
-        *(pots->blocks + pots->count - 1) = var2;
+        /* Count the newcomer, the blocks are kept by the scan */
+        *pots += 1;
 
         log_potential_blocks();
         wnoutrefresh(prog_shadow.win);
@@ -683,6 +789,138 @@ void status (enum status_code_e sl, ...) {
         va_end(ap);
         update_progress(var2);
         break;
+    case SCAN_RATE:
+        va_start(ap, sl);
+        /* Extract the backend, amount read, and speed */
+        var4 = va_arg(ap, char*);
+        var2 = va_arg(ap, uint32_t);
+        var3 = va_arg(ap, uint32_t);
+        va_end(ap);
+
+        getyx(op.win, y, x);
+        mvwprintw(op.win, y + 6, 1,
+            "Scanned with %s: %u MiB read at %u MiB/s", var4, var2, var3);
+        wmove(op.win, y, x);
+        wnoutrefresh(op.win);
+        break;
+    case SCAN_PACE:
+        va_start(ap, sl);
+        /* Extract the rate, reads per second, and share of the caps */
+        var2 = va_arg(ap, uint32_t);
+        var3 = va_arg(ap, uint32_t);
+        var1 = va_arg(ap, uint32_t);
+        va_end(ap);
+
+        getyx(op.win, y, x);
+        wmove(op.win, y + 9, 1);
+        wclrtoeol(op.win);
+        wprintw(op.win, "Throttled to %u MiB/s, %u reads/s, at %u%% of "
+            "the caps", var2, var3, var1);
+        wmove(op.win, y, x);
+        wnoutrefresh(op.win);
+        break;
+    case SCAN_CKPT:
+        va_start(ap, sl);
+        var2 = va_arg(ap, uint32_t);
+        va_end(ap);
+
+        getyx(op.win, y, x);
+        wmove(op.win, y + 5, 1);
+        wclrtoeol(op.win);
+        wprintw(op.win, "Checkpoint saved, next block %u", var2);
+        wmove(op.win, y, x);
+        wnoutrefresh(op.win);
+        wnoutrefresh(prog_shadow.win);
+        wnoutrefresh(prog.win);
+        break;
+    case SCAN_RESUME:
+        va_start(ap, sl);
+        var2 = va_arg(ap, uint32_t);
+        va_end(ap);
+
+        /* Pick up the counts of the blocks loaded from the checkpoint */
+        *pots = fs_info(r)->bmp_starts->count;
+        for (var1 = 1; var1 <= 3; var1++) {
+            *(pots + var1) = (fs_info(r)->indirects + var1 - 1)->count;
+        }
+
+        getyx(op.win, y, x);
+        mvwprintw(op.win, y + 5, 1, "Resuming scan from block %u", var2);
+        wmove(op.win, y, x);
+        log_potential_blocks();
+        wnoutrefresh(prog_shadow.win);
+        wnoutrefresh(prog.win);
+        break;
+    case SCAN_BATCH:
+        /* The batch is drawn, show it */
+        doupdate();
+        break;
+
+    case ITABLE:
+        werase(op.win);
+        /* Set up border */
+        wborder(op.win,
+            /* Left, right, top, bottom sides */
+            BOX_VER, BOX_VER, BOX_HOR, BOX_HOR,
+            BOX_TL, BOX_TR, BOX_BL, BOX_BR);
+
+        /* Draw title */
+        mvwaddchstr(op.win, 0, 1, op.title);
+        mvwprintw(op.win, 1, 1, "Looking through the inode tables...");
+        wmove(op.win, 2, 1);
+        wnoutrefresh(op.win);
+        break;
+    case ITABLE_BMP:
+        va_start(ap, sl);
+        /* Extract the inode and block number */
+        var2 = va_arg(ap, uint32_t);
+        var3 = va_arg(ap, uint32_t);
+        va_end(ap);
+
+        getyx(op.win, y, x);
+        if (y > op.text_h) {
+            y--;
+            scroll(op.win);
+            wmove(op.win, y, x);
+        }
+        wprintw(op.win, "Deleted BMP inode %u at block %u", var2, var3);
+        y++;
+        wmove(op.win, y, x);
+        wnoutrefresh(op.win);
+        break;
+
+    case JOURNAL:
+        werase(op.win);
+        /* Set up border */
+        wborder(op.win,
+            /* Left, right, top, bottom sides */
+            BOX_VER, BOX_VER, BOX_HOR, BOX_HOR,
+            BOX_TL, BOX_TR, BOX_BL, BOX_BR);
+
+        /* Draw title */
+        mvwaddchstr(op.win, 0, 1, op.title);
+        mvwprintw(op.win, 1, 1, "Looking through the journal...");
+        wmove(op.win, 2, 1);
+        wnoutrefresh(op.win);
+        break;
+    case JOURNAL_BMP:
+        va_start(ap, sl);
+        /* Extract the inode number and transaction */
+        var2 = va_arg(ap, uint32_t);
+        var3 = va_arg(ap, uint32_t);
+        va_end(ap);
+
+        getyx(op.win, y, x);
+        if (y > op.text_h) {
+            y--;
+            scroll(op.win);
+            wmove(op.win, y, x);
+        }
+        wprintw(op.win, "BMP inode %u in journal transaction %u", var2, var3);
+        y++;
+        wmove(op.win, y, x);
+        wnoutrefresh(op.win);
+        break;
 
     case COLLECT:
         files_rebuilt = 1;
@@ -722,14 +960,9 @@ void status (enum status_code_e sl, ...) {
         var2 = va_arg(ap, uint32_t);
         va_end(ap);
 
-        /* Add an entry into the file array */
-        file_count++;
-        files = realloc(files, file_count * sizeof(*files));
-        (files + file_count - 1)->inum = var2;
-        /* Ensure the indirs are set to 0 */
-        memset((files + file_count - 1)->indirs,
-            0,
-            3 * sizeof(*((files + file_count - 1)->indirs)));
+        /* Start a new file, the indirs are all 0 */
+        memset(&cur_file, 0, sizeof(cur_file));
+        cur_file.inum = var2;
 
         getyx(op.win, y, x);
         if (y > op.text_h) {
@@ -742,6 +975,71 @@ void status (enum status_code_e sl, ...) {
         wmove(op.win, y, x);
         wnoutrefresh(op.win);
         break;
+    case COMMIT:
+        va_start(ap, sl);
+        /* Extract the amount written */
+        var2 = va_arg(ap, uint32_t);
+        var3 = va_arg(ap, uint32_t);
+        va_end(ap);
+        files_pending = 0;
+
+        getyx(op.win, y, x);
+        if (y > op.text_h) {
+            y--;
+            scroll(op.win);
+            wmove(op.win, y, x);
+        }
+        wprintw(op.win, "Wrote %u bytes in %u pages to the drive", var2, var3);
+        y++;
+        wmove(op.win, y, x);
+        wnoutrefresh(op.win);
+        break;
+    case PATCH:
+        va_start(ap, sl);
+        /* Extract the number of changed blocks */
+        var2 = va_arg(ap, uint32_t);
+        va_end(ap);
+        files_pending = 0;
+
+        getyx(op.win, y, x);
+        if (y > op.text_h) {
+            y--;
+            scroll(op.win);
+            wmove(op.win, y, x);
+        }
+        wprintw(op.win, "Saved %u changed blocks to %s", var2, opt_patch);
+        y++;
+        wmove(op.win, y, x);
+        wnoutrefresh(op.win);
+        break;
+    case CACHE:
+        va_start(ap, sl);
+        /* Extract the page cache peak and how much it grew */
+        var2 = va_arg(ap, uint32_t);
+        var3 = va_arg(ap, uint32_t);
+        va_end(ap);
+
+        getyx(op.win, y, x);
+        /* Under the scan results, or next in the file recovery log */
+        if (files_rebuilt != 1) {
+            mvwprintw(op.win, y + 8, 1,
+                "Page cache peaked at %u MiB, %u MiB over the start",
+                var2, var3);
+            wmove(op.win, y, x);
+            wnoutrefresh(op.win);
+            break;
+        }
+        if (y > op.text_h) {
+            y--;
+            scroll(op.win);
+            wmove(op.win, y, x);
+        }
+        wprintw(op.win, "Page cache peaked at %u MiB, %u MiB over the start",
+            var2, var3);
+        y++;
+        wmove(op.win, y, x);
+        wnoutrefresh(op.win);
+        break;
 
     case DONE:
         if (drive_selected == 1) {
@@ -750,6 +1048,11 @@ void status (enum status_code_e sl, ...) {
             close_win(blk_dev_shadow.win);
         } else if (drive_scanned == 1) {
             drive_scanned = 2;
+            /* Events may have been dropped, count what the scan kept */
+            *pots = fs_info(r)->bmp_starts->count;
+            for (var1 = 1; var1 <= 3; var1++) {
+                *(pots + var1) = (fs_info(r)->indirects + var1 - 1)->count;
+            }
             close_win(prog.win);
             close_win(prog_shadow.win);
         } else if (files_rebuilt == 1) {
@@ -776,7 +1079,120 @@ void status (enum status_code_e sl, ...) {
         break;
     }
 
+    /* Scan events are shown once per batch, at SCAN_BATCH */
+    if (sl != SCAN_IND && sl != SCAN_BMP && sl != SCAN_PROG &&
+        sl != SCAN_BATCH) {
+        doupdate();
+    }
+}
+
+/*
+ * Popup asking the user to type in a value
+ * Return 1 if something was entered, 0 otherwise
+ */
+int prompt_popup (const char *title, const char *msg, char *buf, int len) {
+    chtype *message = 0;
+    int x;
+    int y;
+    int width;
+    int height = 6;
+
+    prompt.title_len = strlen(title);
+    prompt.title = strchtype(prompt.title, title, prompt.title_len);
+    message = strchtype(message, msg, strlen(msg));
+
+    /* Center the popup */
+    width = COLS / 2;
+    prompt.text_w = width - 2;
+    prompt.text_h = height - 2;
+    x = (COLS - width) / 2;
+    y = (LINES - height) / 2;
+
+    /* Setup shadow */
+    prompt_shadow.win = newwin(height, width, y, x + 1);
+    wborder(prompt_shadow.win,
+        SHADOW, SHADOW, SHADOW, SHADOW,
+        SHADOW, SHADOW, SHADOW, SHADOW);
+
+    /* Setup popup */
+    prompt.win = newwin(height, width, y - 1, x);
+    move_to(&prompt, 2, 1);
+    waddchstr(prompt.win, message);
+    wborder(prompt.win,
+        /* Left, right, top, bottom sides */
+        BOX_VER, BOX_VER, BOX_HOR, BOX_HOR,
+        BOX_TL, BOX_TR, BOX_BL, BOX_BR);
+    move_to(&prompt, 1, 0);
+    waddchstr(prompt.win, prompt.title);
+    wbkgd(prompt.win, A_REVERSE);
+    move_to(&prompt, 2, 3);
+    wchgat(prompt.win, prompt.text_w - 3, A_NORMAL, 0, NULL);
+
+    wnoutrefresh(prompt_shadow.win);
+    wnoutrefresh(prompt.win);
     doupdate();
+
+    /* Read the value */
+    memset(buf, 0, len);
+    echo();
+    curs_set(CURS_VIS);
+    mvwgetnstr(prompt.win, 3, 2, buf, len - 1);
+    curs_set(CURS_HID);
+    noecho();
+
+    close_win(prompt.win);
+    close_win(prompt_shadow.win);
+    prompt.win = 0;
+    prompt_shadow.win = 0;
+    free(message);
+
+    return (strlen(buf) > 0) ? 1 : 0;
+}
+
+/*
+ * Drops the list of recovered files
+ */
+void clear_files () {
+    int cx;
+
+    for (cx = 0; cx < file_count; cx++) {
+        if ((files + cx)->name) {
+            free((files + cx)->name);
+        }
+    }
+    if (files) {
+        free(files);
+    }
+    files = 0;
+    file_count = 0;
+    files_pending = 0;
+}
+
+/*
+ * Starts the recovery of the drive with the options set so far
+ * The results of any earlier drive are dropped
+ */
+void open_drive (const char *path) {
+    cleanup(rec);
+    clear_files();
+    drive_scanned = 0;
+    files_rebuilt = 0;
+    rec = init(path, (*opt_patch) ? opt_patch : 0);
+    if (!rec) {
+        /* Back to no drive, the list is still up */
+        drive_selected = 0;
+        close_win(blk_dev.win);
+        close_win(blk_dev_shadow.win);
+        return;
+    }
+    set_scan_threads(rec, opt_threads);
+    /* Out of memory was shown, checkpoints are off */
+    if (set_checkpoint(rec, (*opt_ckpt) ? opt_ckpt : 0, opt_groups)) {
+        *opt_ckpt = 0;
+    }
+    set_resume(rec, opt_resume);
+    set_cache_neutral(rec, opt_cache);
+    set_throttle(rec, opt_pace_mib, opt_pace_iops);
 }
 
 /*
@@ -797,6 +1213,7 @@ void block_dev_popup () {
     unsigned int width;
     int height;
     attr_t attr = A_REVERSE;
+    char path [PATH_LEN];
 
     inst1 = strchtype(inst1, inst1_str, strlen(inst1_str));
     inst2 = strchtype(inst2, inst2_str, strlen(inst2_str));
@@ -900,8 +1317,425 @@ void block_dev_popup () {
         }
     }
 select:
+    /* The last entry lets the user type in any path, eg a disk image */
+    if (cx == n_block_devices - 1) {
+        if (!prompt_popup("Image Path", "Path to device or image file:",
+            path, sizeof(path))) {
+            return;
+        }
+        open_drive(path);
+        return;
+    }
+
     /* Initialize the recovery with the selected device */
-    init(*(block_devices_str + cx));
+    open_drive(*(block_devices_str + cx));
+}
+
+/*
+ * Writes the option and its current value into buf
+ */
+void describe_option (int opt, char *buf) {
+    switch (opt) {
+    case OPT_THREADS:
+        sprintf(buf, "Scan threads: %u", opt_threads);
+        break;
+    case OPT_CKPT:
+        sprintf(buf, "Checkpoint file: %.*s",
+            OPT_LEN - 18, (*opt_ckpt) ? opt_ckpt : "[none]");
+        break;
+    case OPT_GROUPS:
+        sprintf(buf, "Groups between checkpoints: %u", opt_groups);
+        break;
+    case OPT_RESUME:
+        sprintf(buf, "Resume from checkpoint: %s", (opt_resume) ? "yes" : "no");
+        break;
+    case OPT_PATCH:
+        sprintf(buf, "Read-only, save changes to: %.*s",
+            OPT_LEN - 30, (*opt_patch) ? opt_patch : "[no, write them]");
+        break;
+    case OPT_CACHE:
+        sprintf(buf, "Keep the scan out of the page cache: %s",
+            (opt_cache) ? "yes" : "no");
+        break;
+    case OPT_PACE:
+        if (opt_pace_mib == 0 && opt_pace_iops == 0) {
+            sprintf(buf, "Throttle the scan: no");
+        } else {
+            sprintf(buf, "Throttle: %u MiB/s, %u IOPS (0 = no cap)",
+                opt_pace_mib, opt_pace_iops);
+        }
+        break;
+    case OPT_FCAST:
+        if (opt_fcast == 0) {
+            sprintf(buf, "Forecast the scan first: no");
+        } else {
+            sprintf(buf, "Forecast the scan first: sample %u per mille",
+                opt_fcast);
+        }
+        break;
+    }
+}
+
+/*
+ * Ask for a new value for the option
+ */
+void edit_option (int opt) {
+    char value [OPT_LEN];
+    long num;
+
+    switch (opt) {
+    case OPT_THREADS:
+        if (prompt_popup("Scan Threads", "Number of scan threads:",
+            value, sizeof(value))) {
+            num = strtol(value, 0, 10);
+            if (num < 1) {
+                status(rec, WARN, "Invalid thread count: %s", value);
+            } else {
+                opt_threads = num;
+                if (rec) {
+                    set_scan_threads(rec, opt_threads);
+                }
+            }
+        }
+        break;
+    case OPT_CKPT:
+        /* Nothing entered turns checkpoints off */
+        prompt_popup("Checkpoint File", "Path to the checkpoint file:",
+            opt_ckpt, sizeof(opt_ckpt));
+        if (rec && set_checkpoint(rec, (*opt_ckpt) ? opt_ckpt : 0,
+            opt_groups)) {
+            *opt_ckpt = 0;
+        }
+        break;
+    case OPT_GROUPS:
+        if (prompt_popup("Checkpoint Interval", "Groups between checkpoints:",
+            value, sizeof(value))) {
+            num = strtol(value, 0, 10);
+            if (num < 1) {
+                status(rec, WARN, "Invalid group count: %s", value);
+            } else {
+                opt_groups = num;
+                if (rec && set_checkpoint(rec,
+                    (*opt_ckpt) ? opt_ckpt : 0, opt_groups)) {
+                    *opt_ckpt = 0;
+                }
+            }
+        }
+        break;
+    case OPT_RESUME:
+        opt_resume = !opt_resume;
+        if (rec) {
+            set_resume(rec, opt_resume);
+        }
+        break;
+    case OPT_PATCH:
+        /* The drive is opened read-only or not when it is selected */
+        if (drive_selected) {
+            status(rec, WARN, "Only possible before a drive is selected");
+            break;
+        }
+        prompt_popup("Patch File", "Save changes to (empty to write them):",
+            opt_patch, sizeof(opt_patch));
+        break;
+    case OPT_CACHE:
+        opt_cache = !opt_cache;
+        if (rec) {
+            set_cache_neutral(rec, opt_cache);
+        }
+        break;
+    case OPT_PACE:
+        /* Nothing entered runs the scan at full speed */
+        if (!prompt_popup("Throttle", "MiB/s[,IOPS] (empty for no limit):",
+            value, sizeof(value))) {
+            opt_pace_mib = 0;
+            opt_pace_iops = 0;
+        } else if (pace_parse(value, &opt_pace_mib, &opt_pace_iops)) {
+            status(rec, WARN, "Invalid throttle: %s", value);
+            break;
+        }
+        if (rec) {
+            set_throttle(rec, opt_pace_mib, opt_pace_iops);
+        }
+        break;
+    case OPT_FCAST:
+        /* Nothing entered scans without a forecast */
+        if (!prompt_popup("Scan Forecast",
+            "Per mille of the drive to sample (empty for none):",
+            value, sizeof(value))) {
+            opt_fcast = 0;
+            break;
+        }
+        num = strtol(value, 0, 10);
+        if (num < 1 || num > 1000) {
+            status(rec, WARN, "Invalid sample size: %s", value);
+        } else {
+            opt_fcast = num;
+        }
+        break;
+    }
+}
+
+/*
+ * Popup with the forecast of the scan
+ * Return 1 if the scan should go ahead, 0 otherwise
+ */
+int forecast_popup () {
+    const char *title = "Scan Forecast";
+    const char *inst1_str = "[Enter]: Scan";
+    chtype *inst1 = 0;
+    const char *inst2_str = "[Q]: Cancel";
+    chtype *inst2 = 0;
+    int key;
+    int x;
+    int y;
+    int width;
+    int height = 9;
+
+    inst1 = strchtype(inst1, inst1_str, strlen(inst1_str));
+    inst2 = strchtype(inst2, inst2_str, strlen(inst2_str));
+
+    fcast.title_len = strlen(title);
+    fcast.title = strchtype(fcast.title, title, fcast.title_len);
+
+    /* Center the popup */
+    width = COLS / 2;
+    fcast.text_w = width - 2;
+    fcast.text_h = height - 2;
+    x = (COLS - width) / 2;
+    y = (LINES - height) / 2;
+
+    /* Setup shadow */
+    fcast_shadow.win = newwin(height, width, y, x + 1);
+    wborder(fcast_shadow.win,
+        SHADOW, SHADOW, SHADOW, SHADOW,
+        SHADOW, SHADOW, SHADOW, SHADOW);
+
+    /* Setup popup */
+    fcast.win = newwin(height, width, y - 1, x);
+    mvwprintw(fcast.win, 1, 2, "Sampled %u of the %u free blocks",
+        *fcast_sample, *(fcast_sample + 1));
+    mvwprintw(fcast.win, 2, 2, "Potential BMP headers: about %u",
+        *fcast_pots);
+    mvwprintw(fcast.win, 3, 2, "Potential indirects: about %u 1x, %u 2x, "
+        "%u 3x", *(fcast_pots + 1), *(fcast_pots + 2), *(fcast_pots + 3));
+    mvwprintw(fcast.win, 4, 2, "To read: %u MiB at %u MiB/s",
+        *fcast_time, *(fcast_time + 1));
+    mvwprintw(fcast.win, 5, 2, "Takes about %u:%02u:%02u with one thread",
+        *(fcast_time + 2) / 3600, *(fcast_time + 2) / 60 % 60,
+        *(fcast_time + 2) % 60);
+    /* Print instructions */
+    move_to(&fcast, 1, fcast.text_h);
+    waddchstr(fcast.win, inst1);
+    move_to(&fcast, fcast.text_w - strlen(inst2_str), fcast.text_h);
+    waddchstr(fcast.win, inst2);
+    /* Set up border */
+    wborder(fcast.win,
+        /* Left, right, top, bottom sides */
+        BOX_VER, BOX_VER, BOX_HOR, BOX_HOR,
+        BOX_TL, BOX_TR, BOX_BL, BOX_BR);
+    move_to(&fcast, 1, 0);
+    waddchstr(fcast.win, fcast.title);
+    wbkgd(fcast.win, A_REVERSE);
+
+    wnoutrefresh(fcast_shadow.win);
+    wnoutrefresh(fcast.win);
+    doupdate();
+
+    do {
+        key = getch();
+    } while (key != '\n' && key != 'Q' && key != 'q');
+
+    close_win(fcast.win);
+    close_win(fcast_shadow.win);
+    fcast.win = 0;
+    fcast_shadow.win = 0;
+    free(inst2);
+    free(inst1);
+
+    return (key == '\n') ? 1 : 0;
+}
+
+/*
+ * Popup warning that recovered files were not written out yet
+ * Return 1 if quitting anyway, 0 otherwise
+ */
+int quit_popup () {
+    const char *title = "Quit";
+    const char *inst1_str = "[Enter]: Quit";
+    chtype *inst1 = 0;
+    const char *inst2_str = "[Q]: Cancel";
+    chtype *inst2 = 0;
+    int key;
+    int x;
+    int y;
+    int width;
+    int height = 6;
+
+    inst1 = strchtype(inst1, inst1_str, strlen(inst1_str));
+    inst2 = strchtype(inst2, inst2_str, strlen(inst2_str));
+
+    quit.title_len = strlen(title);
+    quit.title = strchtype(quit.title, title, quit.title_len);
+
+    /* Center the popup */
+    width = COLS / 2;
+    quit.text_w = width - 2;
+    quit.text_h = height - 2;
+    x = (COLS - width) / 2;
+    y = (LINES - height) / 2;
+
+    /* Setup shadow */
+    quit_shadow.win = newwin(height, width, y, x + 1);
+    wborder(quit_shadow.win,
+        SHADOW, SHADOW, SHADOW, SHADOW,
+        SHADOW, SHADOW, SHADOW, SHADOW);
+
+    /* Setup popup */
+    quit.win = newwin(height, width, y - 1, x);
+    mvwprintw(quit.win, 1, 2, "%d recovered files are not written out yet",
+        files_pending);
+    mvwprintw(quit.win, 2, 2, "F7 writes them, quitting drops them");
+    /* Print instructions */
+    move_to(&quit, 1, quit.text_h);
+    waddchstr(quit.win, inst1);
+    move_to(&quit, quit.text_w - strlen(inst2_str), quit.text_h);
+    waddchstr(quit.win, inst2);
+    /* Set up border */
+    wborder(quit.win,
+        /* Left, right, top, bottom sides */
+        BOX_VER, BOX_VER, BOX_HOR, BOX_HOR,
+        BOX_TL, BOX_TR, BOX_BL, BOX_BR);
+    move_to(&quit, 1, 0);
+    waddchstr(quit.win, quit.title);
+    wbkgd(quit.win, A_REVERSE);
+
+    wnoutrefresh(quit_shadow.win);
+    wnoutrefresh(quit.win);
+    doupdate();
+
+    do {
+        key = getch();
+    } while (key != '\n' && key != 'Q' && key != 'q');
+
+    close_win(quit.win);
+    close_win(quit_shadow.win);
+    quit.win = 0;
+    quit_shadow.win = 0;
+    free(inst2);
+    free(inst1);
+
+    return (key == '\n') ? 1 : 0;
+}
+
+/*
+ * Popup to change the recovery options
+ */
+void options_popup () {
+    const char *title = "Options";
+    const char *inst1_str = "[Up/Down]: Choose";
+    chtype *inst1 = 0;
+    const char *inst2_str = "[Enter]: Change";
+    chtype *inst2 = 0;
+    const char *inst3_str = "[Q]: Close";
+    chtype *inst3 = 0;
+    char option_str [OPT_LEN];
+    chtype *option = 0;
+    int cx;
+    int choice = 0;
+    int x;
+    int y;
+    int width;
+    int height;
+    attr_t attr = A_REVERSE;
+
+    inst1 = strchtype(inst1, inst1_str, strlen(inst1_str));
+    inst2 = strchtype(inst2, inst2_str, strlen(inst2_str));
+    inst3 = strchtype(inst3, inst3_str, strlen(inst3_str));
+
+    opts.title_len = strlen(title);
+    opts.title = strchtype(opts.title, title, opts.title_len);
+
+    /* Center horizontally */
+    width = COLS / 2;
+    opts.text_w = width - 2;
+    x = (COLS - width) / 2;
+
+    /* Center vertically */
+    height = (N_OPTIONS + 4 > LINES / 3) ? N_OPTIONS + 4 : LINES / 3;
+    opts.text_h = height - 2;
+    y = (LINES - height) / 2;
+
+    for (;;) {
+        /* Setup shadow */
+        opts_shadow.win = newwin(height, width, y, x + 1);
+        wborder(opts_shadow.win,
+            SHADOW, SHADOW, SHADOW, SHADOW,
+            SHADOW, SHADOW, SHADOW, SHADOW);
+
+        /* Setup popup */
+        opts.win = newwin(height, width, y - 1, x);
+        /* Print the listing */
+        for (cx = 0; cx < N_OPTIONS; cx++) {
+            describe_option(cx, option_str);
+            option = strchtype(option, option_str, strlen(option_str));
+            move_to(&opts, 2, cx + 1);
+            waddchstr(opts.win, option);
+        }
+        /* Print instructions */
+        move_to(&opts, 1, opts.text_h);
+        waddchstr(opts.win, inst1);
+        move_to(&opts,
+            strlen(inst1_str) +
+                (((opts.text_w - (strlen(inst1_str) + strlen(inst3_str))) -
+                strlen(inst2_str)) / 2),
+            opts.text_h);
+        waddchstr(opts.win, inst2);
+        move_to(&opts, opts.text_w - strlen(inst3_str), opts.text_h);
+        waddchstr(opts.win, inst3);
+        /* Set up border */
+        wborder(opts.win,
+            /* Left, right, top, bottom sides */
+            BOX_VER, BOX_VER, BOX_HOR, BOX_HOR,
+            BOX_TL, BOX_TR, BOX_BL, BOX_BR);
+        move_to(&opts, 1, 0);
+        waddchstr(opts.win, opts.title);
+        wbkgd(opts.win, attr);
+
+        wnoutrefresh(opts_shadow.win);
+
+        /* Selection */
+        for (;;) {
+            move_to(&opts, 2, choice + 1);
+            wchgat(opts.win, opts.text_w - 2, A_NORMAL, 0, NULL);
+            wnoutrefresh(opts.win);
+            doupdate();
+
+            cx = getch();
+            move_to(&opts, 2, choice + 1);
+            wchgat(opts.win, opts.text_w - 2, attr, 0, NULL);
+            if (cx == KEY_DOWN) {
+                choice = (choice + 1 < N_OPTIONS) ? choice + 1 : choice;
+            } else if (cx == KEY_UP) {
+                choice = (choice > 0) ? choice - 1 : 0;
+            } else if (cx == '\n' || cx == 'Q' || cx == 'q') {
+                break;
+            }
+        }
+
+        close_win(opts.win);
+        close_win(opts_shadow.win);
+        opts.win = 0;
+        opts_shadow.win = 0;
+        if (cx != '\n') {
+            break;
+        }
+        edit_option(choice);
+    }
+
+    free(option);
+    free(inst3);
+    free(inst2);
+    free(inst1);
 }
 
 /*
@@ -910,6 +1744,7 @@ select:
 void find_block_devs () {
     int cx;
     const char *dname = "/dev/";
+    const char *path_entry = "[path...]";
     DIR *dir;
     struct dirent *de;
 
@@ -938,7 +1773,7 @@ void find_block_devs () {
     /* Open a stream to /dev */
     dir = opendir(dname);
     if (!dir) {
-        status(ERROR, "Unable to open directory: %s", dname);
+        status(0, ERROR, "Unable to open directory: %s", dname);
         return;
     }
 
@@ -957,6 +1792,14 @@ void find_block_devs () {
                 strlen(dname)), de->d_name);
         }
     }
+    /* Entry for typing in a path to a device or image file */
+    n_block_devices++;
+    block_devices_str = realloc(block_devices_str,
+        n_block_devices * sizeof(*block_devices_str));
+    *(block_devices_str + n_block_devices - 1) =
+        calloc(strlen(path_entry) + 1,
+        sizeof(**(block_devices_str + n_block_devices - 1)));
+    strcpy(*(block_devices_str + n_block_devices - 1), path_entry);
     block_devices = calloc(n_block_devices, sizeof(*block_devices));
 
     block_dev_popup();
@@ -970,19 +1813,8 @@ void find_block_devs () {
 void tui_cleanup () {
     int cx;
 
-    if (files) {
-        for (cx = 0; cx < file_count; cx++) {
-            if ((files + cx)->name) {
-                free((files + cx)->name);
-            }
-        }
-        free(files);
-    }
-    for (cx = 0; cx < 4; cx++) {
-        if ((pots + cx)->blocks) {
-            free((pots + cx)->blocks);
-        }
-    }
+    cleanup(rec);
+    clear_files();
     if (prog_shadow.win) {
         delwin(prog_shadow.win);
     }
@@ -1016,6 +1848,12 @@ void tui_cleanup () {
         }
         free(block_devices_str);
     }
+    if (prompt.title) {
+        free(prompt.title);
+    }
+    if (opts.title) {
+        free(opts.title);
+    }
     if (blk_dev_shadow.win) {
         delwin(blk_dev_shadow.win);
     }
@@ -1076,13 +1914,13 @@ void build_win (struct win_s *w, const char *title, int x, int y,
 void tui_init () {
     /* Register the exit handler */
     if (atexit(tui_cleanup)) {
-        status(ERROR, "Unable to register the exit handler!\n");
+        status(0, ERROR, "Unable to register the exit handler!\n");
         exit(-1);
     }
 
     /* Init ncurses */
     if (!initscr()) {
-        status(ERROR, "Unable to start ncurses!\n");
+        status(0, ERROR, "Unable to start ncurses!\n");
         exit(-1);
     }
     raw();
@@ -1099,14 +1937,14 @@ void tui_init () {
     /* Create the main output window */
     build_win(&op, "Output", 0, 0, COLS, LINES - 4);
     if (!op.win) {
-        status(ERROR, "Unable to create output window!\n");
+        status(0, ERROR, "Unable to create output window!\n");
         exit(-1);
     }
 
     /* Create the command window */
     build_win(&cmds, "Commands", 0, LINES - 4, COLS, 4);
     if (!cmds.win) {
-        status(ERROR, "Unable to create command window!\n");
+        status(0, ERROR, "Unable to create command window!\n");
         exit(-1);
     }
 }
@@ -1148,6 +1986,8 @@ void prep_cmds () {
     chtype *drive_stats = 0;
     const char *f01_str = "F1: Select Drive";
     chtype *f01 = 0;
+    const char *f02_str = "F2: Options";
+    chtype *f02 = 0;
     const char *f03_str = "F3: Scan Drive";
     chtype *f03 = 0;
     const char *f05_str = "F5: Scan Results";
@@ -1167,6 +2007,7 @@ void prep_cmds () {
     no_drive_msg = strchtype(no_drive_msg,
         no_drive_msg_str, strlen(no_drive_msg_str));
     f01 = strchtype(f01, f01_str, strlen(f01_str));
+    f02 = strchtype(f02, f02_str, strlen(f02_str));
     f03 = strchtype(f03, f03_str, strlen(f03_str));
     f05 = strchtype(f05, f05_str, strlen(f05_str));
     f07 = strchtype(f07, f07_str, strlen(f07_str));
@@ -1181,8 +2022,8 @@ void prep_cmds () {
     if (drive_selected == 2) {
         sprintf(drive_stats_str,
             "%s    %u blocks * %u B/block = %u MiB",
-            fs_info.name, *(fs_info.nblocks), BYTES_PER_BLOCK,
-            (*(fs_info.nblocks) >> 10) * (BYTES_PER_BLOCK >> 10));
+            fs_info(rec)->name, *(fs_info(rec)->nblocks), BYTES_PER_BLOCK,
+            (*(fs_info(rec)->nblocks) >> 10) * (BYTES_PER_BLOCK >> 10));
         drive_stats = strchtype(drive_stats,
             drive_stats_str, strlen(drive_stats_str));
         waddchstr(cmds.win, drive_stats);
@@ -1190,7 +2031,7 @@ void prep_cmds () {
         waddchstr(cmds.win, no_drive_msg);
     }
     /* Show the command help */
-    inc = cmds.text_w / 6;
+    inc = cmds.text_w / 7;
     move_to(&cmds, 1, 2);
     waddchstr(cmds.win, f01);
     /* Mark as done after drive selected */
@@ -1198,6 +2039,8 @@ void prep_cmds () {
         wchgat(cmds.win, strlen(f01_str), A_NORMAL, COLOR_GOOD, NULL);
     }
     move_to(&cmds, cmds.cur_x + inc, cmds.cur_y);
+    waddchstr(cmds.win, f02);
+    move_to(&cmds, cmds.cur_x + inc, cmds.cur_y);
     waddchstr(cmds.win, f03);
     /* Disable if no drive selected */
     if (drive_selected < 2) {
@@ -1225,8 +2068,8 @@ void prep_cmds () {
     }
     move_to(&cmds, cmds.cur_x + inc, cmds.cur_y);
     waddchstr(cmds.win, f09);
-    /* Disable if files not rebuilt */
-    if (files_rebuilt < 2) {
+    /* Disable if no files rebuilt, by any pass */
+    if (files_rebuilt < 2 && file_count == 0) {
         wchgat(cmds.win, strlen(f09_str), A_UNDERLINE, COLOR_ERROR, NULL);
     }
     move_to(&cmds, cmds.cur_x + inc, cmds.cur_y);
@@ -1247,6 +2090,9 @@ void prep_cmds () {
     if (f03) {
         free(f03);
     }
+    if (f02) {
+        free(f02);
+    }
     if (f01) {
         free(f01);
     }
@@ -1273,22 +2119,32 @@ int parse_input (int key) {
     case KEY_F(1):
         find_block_devs();
         return 1;
+    /* Options */
+    case KEY_F(2):
+        options_popup();
+        return 1;
     /* Scan Drive */
     case KEY_F(3):
         /* Error if no drive selected */
         if (drive_selected == 0) {
-            status(ERROR, "No drive selected!");
+            status(rec, ERROR, "No drive selected!");
         } else if (drive_scanned == 2) {
-            status(WARN, "Drive %s already scanned.", fs_info.name);
-        } else {
-            scan();
+            status(rec, WARN, "Drive %s already scanned.",
+                fs_info(rec)->name);
+        } else if (opt_fcast > 0 &&
+            (estimate(rec, opt_fcast) < 0 || !forecast_popup())) {
+            /* Left for later, or for other options */
+            return 1;
+        } else if (scan_journal(rec) < 0 || scan_inodes(rec) < 0 ||
+            scan(rec) < 0) {
+            exit(-1);
         }
         return 1;
     /* Scan Results */
     case KEY_F(5):
         /* Error if no drive not scanned */
         if (drive_scanned == 0) {
-            status(ERROR, "No drive scanned!");
+            status(rec, ERROR, "No drive scanned!");
         } else {
             display_scan_results();
         }
@@ -1297,25 +2153,26 @@ int parse_input (int key) {
     case KEY_F(7):
         /* Error if no drive not scanned */
         if (drive_scanned == 0) {
-            status(ERROR, "No drive scanned!");
+            status(rec, ERROR, "No drive scanned!");
         } else if (files_rebuilt == 2) {
-            status(WARN, "Files already rebuilt.");
-        } else {
-            collect();
+            status(rec, WARN, "Files already rebuilt.");
+        } else if (collect(rec)) {
+            exit(-1);
         }
         return 1;
     /* List Files */
     case KEY_F(9):
-        /* Error if no rebuilt files */
-        if (files_rebuilt == 0) {
-            status(ERROR, "No files have been rebuilt yet!");
+        /* Error if no rebuilt files, by F7 or while scanning */
+        if (files_rebuilt == 0 && file_count == 0) {
+            status(rec, ERROR, "No files have been rebuilt yet!");
         } else {
             display_recovery_results();
         }
         return 1;
     /* Quit */
     case KEY_F(11):
-        return 0;
+        /* Files recovered but not written out are lost on quitting */
+        return files_pending > 0 && !quit_popup();
     default:
         return 1;
     }
@@ -1324,7 +2181,7 @@ int parse_input (int key) {
 int main () {
     /* Test if running as root */
     if (getuid()) {
-        status(ERROR, "Requires root permissions to run!\n");
+        status(0, ERROR, "Requires root permissions to run!\n");
         exit(-1);
     }
 
@@ -0,0 +1,220 @@
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "ext.h"
+#include "txn.h"
+
+/*
+ * Private method
+ * Orders changed blocks by block number for qsort(3)
+ */
+int cmp_ent (const void *a, const void *b) {
+    uint32_t ba = ((const struct txn_ent_s*)a)->block;
+    uint32_t bb = ((const struct txn_ent_s*)b)->block;
+
+    return (ba > bb) - (ba < bb);
+}
+
+/*
+ * Private method
+ * Adds a block to the transaction, starting from the given contents
+ * Returns the copy to change, 0 if out of memory
+ */
+uint8_t* add_ent (struct txn_s *t, uint32_t block, const uint8_t *base,
+    const uint8_t *copy) {
+    struct txn_ent_s *ents;
+    struct txn_ent_s *ent;
+    size_t cap;
+
+    if (t->count == t->cap) {
+        cap = (t->cap > 0) ? t->cap * 2 : 16;
+        ents = realloc(t->ents, cap * sizeof(*ents));
+        if (!ents) {
+            return 0;
+        }
+        t->ents = ents;
+        t->cap = cap;
+    }
+    ent = t->ents + t->count;
+    ent->block = block;
+    ent->copy = malloc(BYTES_PER_BLOCK);
+    ent->base = malloc(BYTES_PER_BLOCK);
+    if (!ent->copy || !ent->base || !cand_map_add(&t->index, block)) {
+        free(ent->copy);
+        free(ent->base);
+        return 0;
+    }
+    memcpy(ent->base, base, BYTES_PER_BLOCK);
+    memcpy(ent->copy, copy, BYTES_PER_BLOCK);
+    t->count++;
+
+    return ent->copy;
+}
+
+/*
+ * Public method
+ * Starts an empty transaction
+ */
+void txn_init (struct txn_s *t, int fd, uint8_t *map) {
+    txn_free(t);
+    t->fd = fd;
+    t->map = map;
+}
+
+/*
+ * Public method
+ * Gets the copy of a block to change
+ */
+uint8_t* txn_block (struct txn_s *t, uint32_t block) {
+    uint32_t pos;
+
+    pos = cand_map_first(&t->index, block);
+    if (pos) {
+        return (t->ents + pos - 1)->copy;
+    }
+
+    return add_ent(t, block, t->map + (uint64_t)block * BYTES_PER_BLOCK,
+        t->map + (uint64_t)block * BYTES_PER_BLOCK);
+}
+
+/*
+ * Public method
+ * Writes the changes out in one ordered pass
+ * If fail the copies are kept until the caller frees them, sorting has
+ * left the index behind by then
+ */
+int txn_commit (struct txn_s *t, uint64_t *bytes, uint64_t *pages) {
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t first;
+    uint64_t end;
+    uint64_t off;
+    size_t cx;
+    int ret = 0;
+
+    *bytes = 0;
+    *pages = 0;
+    qsort(t->ents, t->count, sizeof(*t->ents), cmp_ent);
+
+    for (cx = 0; cx < t->count; cx++) {
+        off = (uint64_t)(t->ents + cx)->block * BYTES_PER_BLOCK;
+        memcpy(t->map + off, (t->ents + cx)->copy, BYTES_PER_BLOCK);
+        *bytes += BYTES_PER_BLOCK;
+    }
+
+    /* Flush runs of neighbouring blocks with one msync(2) each */
+    for (cx = 0; cx < t->count; ) {
+        first = (uint64_t)(t->ents + cx)->block * BYTES_PER_BLOCK;
+        end = first + BYTES_PER_BLOCK;
+        for (cx++; cx < t->count &&
+            (uint64_t)(t->ents + cx)->block * BYTES_PER_BLOCK <= end; cx++) {
+            end = (uint64_t)(t->ents + cx)->block * BYTES_PER_BLOCK +
+                BYTES_PER_BLOCK;
+        }
+        first -= first % page;
+        end += (end % page) ? page - end % page : 0;
+        if (msync(t->map + first, end - first, MS_SYNC)) {
+            ret = -1;
+        }
+        *pages += (end - first) / page;
+    }
+
+    /* Only the target device, not every filesystem on the host */
+    if (t->count > 0 && fdatasync(t->fd)) {
+        ret = -1;
+    }
+
+    if (!ret) {
+        txn_free(t);
+    }
+    return ret;
+}
+
+/*
+ * Public method
+ * Writes the changed blocks to the file
+ */
+int txn_save (const struct txn_s *t, FILE *f) {
+    size_t cx;
+
+    for (cx = 0; cx < t->count; cx++) {
+        if (fwrite(&(t->ents + cx)->block,
+            sizeof((t->ents + cx)->block), 1, f) != 1 ||
+            fwrite((t->ents + cx)->base, BYTES_PER_BLOCK, 1, f) != 1 ||
+            fwrite((t->ents + cx)->copy, BYTES_PER_BLOCK, 1, f) != 1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Public method
+ * Reads changed blocks from the file
+ * A block past the end of the device means the file is corrupt, it would
+ * be compared and written outside the mapping
+ */
+int txn_load (struct txn_s *t, FILE *f, size_t n, uint32_t nblocks) {
+    uint8_t *base;
+    uint8_t *copy;
+    uint32_t block;
+    size_t cx;
+    int ret = 0;
+
+    base = malloc(BYTES_PER_BLOCK);
+    copy = malloc(BYTES_PER_BLOCK);
+    for (cx = 0; !ret && cx < n; cx++) {
+        if (!base || !copy ||
+            fread(&block, sizeof(block), 1, f) != 1 ||
+            fread(base, BYTES_PER_BLOCK, 1, f) != 1 ||
+            fread(copy, BYTES_PER_BLOCK, 1, f) != 1 ||
+            block >= nblocks ||
+            cand_map_first(&t->index, block) ||
+            !add_ent(t, block, base, copy)) {
+            ret = -1;
+        }
+    }
+    free(base);
+    free(copy);
+
+    return ret;
+}
+
+/*
+ * Public method
+ * Counts the changed blocks that were changed on the device since
+ */
+size_t txn_stale (const struct txn_s *t) {
+    size_t cx;
+    size_t n = 0;
+
+    for (cx = 0; cx < t->count; cx++) {
+        if (memcmp(t->map + (uint64_t)(t->ents + cx)->block * BYTES_PER_BLOCK,
+            (t->ents + cx)->base, BYTES_PER_BLOCK)) {
+            n++;
+        }
+    }
+    return n;
+}
+
+/*
+ * Public method
+ * Drops every change
+ */
+void txn_free (struct txn_s *t) {
+    size_t cx;
+
+    for (cx = 0; cx < t->count; cx++) {
+        free((t->ents + cx)->copy);
+        free((t->ents + cx)->base);
+    }
+    free(t->ents);
+    t->ents = 0;
+    t->count = 0;
+    t->cap = 0;
+    cand_map_free(&t->index);
+}
@@ -0,0 +1,76 @@
+#ifndef TXN_H_20261016_231127
+#define TXN_H_20261016_231127
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cand.h"
+
+/* A changed copy of a block, and the block as it was when copied */
+struct txn_ent_s {
+    uint32_t block;
+    uint8_t *copy;
+    uint8_t *base;
+};
+
+/*
+ * Metadata changes held back from the device mapping
+ * The first change to a block copies it out of the mapping, later changes
+ * and reads go to the copy until the whole set is written out at once
+ */
+struct txn_s {
+    int fd;
+    uint8_t *map;
+    struct txn_ent_s *ents;
+    size_t count;
+    size_t cap;
+    /* Positions in ents by block number */
+    struct cand_map_s index;
+};
+
+#define TXN_EMPTY   { -1, (uint8_t*)0, (struct txn_ent_s*)0, 0, 0, \
+    CAND_MAP_EMPTY }
+
+/* Starts an empty transaction over the device */
+void txn_init (struct txn_s *t, int fd, uint8_t *map);
+
+/*
+ * Gets the copy of a block to change, copying it in on first use
+ * Returns 0 if out of memory
+ */
+uint8_t* txn_block (struct txn_s *t, uint32_t block);
+
+/*
+ * Writes every changed block into the mapping in block order, flushes only
+ * the touched pages with msync(2), then the device with fdatasync(2)
+ * The bytes and pages written are returned through the pointers
+ * Leaves the transaction empty if success, if fail the copies are kept for
+ * whatever still points into them, and only txn_free() may follow
+ * Returns 0 if success, -1 if fail
+ */
+int txn_commit (struct txn_s *t, uint64_t *bytes, uint64_t *pages);
+
+/*
+ * Writes the changed blocks, with what they were changed from, to the file
+ * Returns 0 if success, -1 if fail
+ */
+int txn_save (const struct txn_s *t, FILE *f);
+
+/*
+ * Reads n changed blocks written by txn_save() into the transaction
+ * Every block has to be below nblocks, the blocks of the device
+ * Returns 0 if success, -1 if fail
+ */
+int txn_load (struct txn_s *t, FILE *f, size_t n, uint32_t nblocks);
+
+/*
+ * Counts the changed blocks whose device contents no longer match what
+ * they were changed from, eg the filesystem was used in the meantime
+ */
+size_t txn_stale (const struct txn_s *t);
+
+/* Drops every change, leaving the transaction empty */
+void txn_free (struct txn_s *t);
+
+#endif /* TXN_H_20261016_231127 */